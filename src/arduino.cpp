@@ -5,6 +5,12 @@
 #include "SD_MMC.h"
 
 #include "EVE.h"
+#include "eve_present.h"
+#include "eve_audio.h"
+extern "C" {
+#include "video.h"
+#include "audio.h"
+}
 
 #include "rom/cache.h"
 
@@ -17,21 +23,38 @@ main(int argc, const char *argv[]);
 extern "C"
 void *emulator_loop(void *param);
 
-extern "C" void vga_init()
+static void eve_spi_mem_write(void *ctx, uint32_t address, const uint8_t *data, uint32_t length)
+{
+  //esp_cache_msync(&panel->fbs[panel->bb_fb_index][panel->bounce_pos_px * bytes_per_pixel], (size_t)panel->bb_size, ESP_CACHE_MSYNC_FLAG_INVALIDATE);
+  Cache_WriteBack_Addr((uint32_t)data, length);
+  EVE_memWrite_sram_buffer(address, data, length);
+}
+
+static void eve_spi_inflate(void *ctx, uint32_t address, const uint8_t *data, uint32_t length)
 {
+  EVE_cmd_inflate(address, data, length);
+}
+
+static void eve_spi_show(void *ctx, uint8_t buffer, bool half)
+{
+  // a half resolution bitmap is scaled up 2x in both directions
+  const uint32_t width = half ? EVE_DISPLAY_HALF_WIDTH : SCREEN_WIDTH;
+  const uint32_t height = half ? EVE_DISPLAY_HALF_HEIGHT : SCREEN_HEIGHT;
+
   EVE_cmd_dl(CMD_DLSTART);
   EVE_cmd_dl(DL_CLEAR_COLOR_RGB | 0x000000); /* set the default clear color to black */
   EVE_cmd_dl(DL_CLEAR | CLR_COL);            /* clear the screen - this and the previous prevent artifacts between lists, attributes are the color, stencil and tag buffers */
 
   constexpr uint32_t BPP = 1; // bytes per pixel
   EVE_cmd_dl(BITMAP_HANDLE(1));
-  EVE_cmd_dl(BITMAP_SOURCE(0x1000));
-  EVE_cmd_dl(BITMAP_LAYOUT_H(SCREEN_WIDTH * BPP, SCREEN_HEIGHT));
-  EVE_cmd_dl(BITMAP_LAYOUT(EVE_PALETTED565, SCREEN_WIDTH * BPP, SCREEN_HEIGHT));
-  EVE_cmd_dl(BITMAP_TRANSFORM_E(128));  // double height
+  EVE_cmd_dl(BITMAP_SOURCE(EVE_DISPLAY_BITMAP(buffer)));
+  EVE_cmd_dl(BITMAP_LAYOUT_H(width * BPP, height));
+  EVE_cmd_dl(BITMAP_LAYOUT(EVE_PALETTED565, width * BPP, height));
+  EVE_cmd_dl(BITMAP_TRANSFORM_A(half ? 128 : 256));
+  EVE_cmd_dl(BITMAP_TRANSFORM_E(half ? 64 : 128));  // double height
   EVE_cmd_dl(BITMAP_SIZE_H(SCREEN_WIDTH, SCREEN_HEIGHT * 2));
   EVE_cmd_dl(BITMAP_SIZE(EVE_NEAREST, EVE_BORDER, EVE_BORDER, SCREEN_WIDTH, SCREEN_HEIGHT * 2));
-  EVE_cmd_dl(PALETTE_SOURCE(0x0));
+  EVE_cmd_dl(PALETTE_SOURCE(EVE_DISPLAY_PALETTE(buffer)));
   EVE_cmd_dl(DL_BEGIN | EVE_BITMAPS);
   EVE_cmd_dl(VERTEX2II(0, 0 * BPP, 1, 0));
   EVE_cmd_dl(DL_END);
@@ -39,26 +62,83 @@ extern "C" void vga_init()
   EVE_cmd_dl(CMD_SWAP);   /* make this list active */
   EVE_execute_cmd();      /* wait for EVE to be no longer busy */
 
-  EVE_switch_SPI(true);
+  /* the swap happens with the next frame, only then the other buffer may be written */
+  while (EVE_memRead8(REG_DLSWAP) != 0) {
+  }
 }
 
-constexpr uint32_t pixel_offset(int x, int y) {
-  return (y * SCREEN_WIDTH + x) * 1;
+/* -eve-layers: the list is written to RAM_DL directly, the coprocessor isn't needed */
+static void eve_spi_show_list(void *ctx, const uint32_t *dl, uint16_t length)
+{
+  eve_spi_mem_write(ctx, EVE_RAM_DL, (const uint8_t *)dl, length * 4);
+  EVE_memWrite8(REG_DLSWAP, EVE_DLSWAP_FRAME);
+
+  /* as above, the images of the next frame may only be written once this list is shown */
+  while (EVE_memRead8(REG_DLSWAP) != 0) {
+  }
 }
 
-extern "C" void vga_display(void* framebuffer, void* palette)
+/* the audio ring is played in a loop, the emulator keeps writing ahead of REG_PLAYBACK_READPTR */
+static void eve_spi_play(void *ctx, uint32_t address, uint32_t length, uint16_t rate, uint8_t format)
 {
-  long now = millis();
+  EVE_memWrite32(REG_PLAYBACK_START, address);
+  EVE_memWrite32(REG_PLAYBACK_LENGTH, length);
+  EVE_memWrite16(REG_PLAYBACK_FREQ, rate);
+  EVE_memWrite8(REG_PLAYBACK_FORMAT, format);
+  EVE_memWrite8(REG_PLAYBACK_LOOP, 1);
+  EVE_memWrite8(REG_VOL_PB, 255);
+  EVE_memWrite8(REG_PLAYBACK_PLAY, 1);
+}
 
-  EVE_memWrite_sram_buffer(0x0, (uint8_t *)palette, 2*256);
+static uint32_t eve_spi_play_position(void *ctx)
+{
+  return EVE_memRead32(REG_PLAYBACK_READPTR);
+}
 
-  constexpr int ROWS = 32;
-  for (int y=0; y<SCREEN_HEIGHT; y+=ROWS)
-  {
-    //esp_cache_msync(&panel->fbs[panel->bb_fb_index][panel->bounce_pos_px * bytes_per_pixel], (size_t)panel->bb_size, ESP_CACHE_MSYNC_FLAG_INVALIDATE);
-    Cache_WriteBack_Addr((uint32_t)framebuffer + pixel_offset(0, y), pixel_offset(0, ROWS));
-    EVE_memWrite_sram_buffer(0x1000 + pixel_offset(0, y), (uint8_t *)framebuffer + pixel_offset(0, y), pixel_offset(0, ROWS));
+static const struct eve_transport eve_spi = { eve_spi_mem_write, eve_spi_inflate, eve_spi_show, eve_spi_show_list, eve_spi_play, eve_spi_play_position, NULL };
+
+static void eve_spi_line(void *ctx, uint16_t y, const uint8_t *pixels)
+{
+  eve_present_line(y, pixels);
+}
+
+static void eve_spi_part(void *ctx, uint16_t y, uint16_t x, uint16_t width, const uint8_t *pixels)
+{
+  eve_present_line_part(y, x, width, pixels);
+}
+
+static void eve_spi_frame(void *ctx, const uint16_t *palette, bool palette_dirty)
+{
+  eve_present_lines_end_frame(palette, palette_dirty);
+}
+
+/* -stream-lines: no framebuffer, the lines go to the EVE as they are rendered */
+static const struct video_line_sink eve_spi_sink = { eve_spi_line, eve_spi_part, eve_spi_frame, NULL };
+
+extern "C" void vga_init()
+{
+  eve_spi_show(NULL, 0, false);
+
+  EVE_switch_SPI(true);
+
+  /* the EVE's playback clock paces the synthesis, there is no SDL audio device */
+  audio_init_pull(EVE_AUDIO_RATE, 8, RESAMPLER_DEFAULT);
+  eve_audio_init(&eve_spi, EVE_AUDIO_ULAW, EVE_AUDIO_RATE, audio_pull);
+
+  if (stream_lines) {
+    eve_present_lines_init(&eve_spi);
+    video_set_line_sink(&eve_spi_sink);
+  } else {
+    eve_present_init(&eve_spi);
   }
+}
+
+extern "C" void vga_display(void* framebuffer, void* palette, const uint32_t *dirty_lines, bool palette_dirty, bool scaled_2x)
+{
+  long now = millis();
+
+  /* the transfer runs on the other core, this only copies the changed lines */
+  eve_present_submit((const uint8_t *)framebuffer, (const uint16_t *)palette, dirty_lines, palette_dirty, scaled_2x, false);
 
   now = millis() - now;
   printf("Blit VGA = %li ms\n", now);
@@ -295,7 +375,7 @@ void loop()
 {
   SDL_setenv("SDL_VIDEODRIVER","dummy",1);
   SDL_setenv("SDL_AUDIODRIVER","dummy",1);
-  const char* argv[] = { "x16emu", "-mhz", "1", /*"-log", "KS"*/ };
+  const char* argv[] = { "x16emu", "-mhz", "1", "-sound", "none", /*"-log", "KS"*/ };
   main(sizeof(argv)/sizeof(*argv), argv);
 
   extern uint8_t* ROM;
@@ -7,6 +7,10 @@
 #include "vera_psg.h"
 #include "vera_pcm.h"
 #include "wav_recorder.h"
+#include "capture.h"
+#include "shm_export.h"
+#include "sound_log.h"
+#include "resampler.h"
 #include "ymglue.h"
 #include <stdint.h>
 #include <stdio.h>
@@ -27,64 +31,219 @@
 #define SAMP_POS_MASK (SAMPLES_PER_BUFFER - 1)
 #define SAMP_POS_MASK_FRAC (((uint32_t)SAMPLES_PER_BUFFER << SAMP_POS_FRAC_BITS) - 1)
 
-// windowed sinc
-static const int16_t filter[512] = {
-	32767,32765,32761,32755,32746,32736,32723,32707,32690,32670,32649,32625,32598,32570,32539,32507,
-	32472,32435,32395,32354,32310,32265,32217,32167,32115,32061,32004,31946,31885,31823,31758,31691,
-	31623,31552,31479,31404,31327,31248,31168,31085,31000,30913,30825,30734,30642,30547,30451,30353,
-	30253,30151,30048,29943,29835,29726,29616,29503,29389,29273,29156,29037,28916,28793,28669,28544,
-	28416,28288,28157,28025,27892,27757,27621,27483,27344,27204,27062,26918,26774,26628,26481,26332,
-	26182,26031,25879,25726,25571,25416,25259,25101,24942,24782,24621,24459,24296,24132,23967,23801,
-	23634,23466,23298,23129,22959,22788,22616,22444,22271,22097,21923,21748,21572,21396,21219,21042,
-	20864,20686,20507,20328,20148,19968,19788,19607,19426,19245,19063,18881,18699,18517,18334,18152,
-	17969,17786,17603,17420,17237,17054,16871,16688,16505,16322,16139,15957,15774,15592,15409,15227,
-	15046,14864,14683,14502,14321,14141,13961,13781,13602,13423,13245,13067,12890,12713,12536,12360,
-	12185,12010,11836,11663,11490,11317,11146,10975,10804,10635,10466,10298,10131, 9964, 9799, 9634,
-	 9470, 9306, 9144, 8983, 8822, 8662, 8504, 8346, 8189, 8033, 7878, 7724, 7571, 7419, 7268, 7118,
-	 6969, 6822, 6675, 6529, 6385, 6241, 6099, 5958, 5818, 5679, 5541, 5405, 5269, 5135, 5002, 4870,
-	 4739, 4610, 4482, 4355, 4229, 4104, 3981, 3859, 3738, 3619, 3500, 3383, 3268, 3153, 3040, 2928,
-	 2817, 2708, 2600, 2493, 2388, 2284, 2181, 2079, 1979, 1880, 1783, 1686, 1591, 1498, 1405, 1314,
-	 1225, 1136, 1049,  963,  879,  795,  714,  633,  554,  476,  399,  323,  249,  176,  105,   34,
-	  -34, -102, -168, -234, -298, -361, -422, -482, -542, -599, -656, -712, -766, -819, -871, -922,
-	 -971,-1020,-1067,-1113,-1158,-1202,-1244,-1286,-1326,-1366,-1404,-1441,-1477,-1512,-1546,-1579,
-	-1611,-1642,-1671,-1700,-1728,-1755,-1781,-1806,-1830,-1852,-1874,-1896,-1916,-1935,-1953,-1971,
-	-1987,-2003,-2018,-2032,-2045,-2058,-2069,-2080,-2090,-2099,-2108,-2116,-2123,-2129,-2134,-2139,
-	-2143,-2147,-2150,-2152,-2153,-2154,-2154,-2154,-2153,-2151,-2149,-2146,-2143,-2139,-2135,-2130,
-	-2124,-2118,-2112,-2105,-2098,-2090,-2082,-2073,-2064,-2054,-2045,-2034,-2024,-2012,-2001,-1989,
-	-1977,-1965,-1952,-1939,-1926,-1912,-1898,-1884,-1870,-1855,-1840,-1825,-1810,-1794,-1778,-1762,
-	-1746,-1730,-1714,-1697,-1680,-1663,-1646,-1629,-1612,-1595,-1577,-1560,-1542,-1525,-1507,-1489, 
-	-1471,-1453,-1435,-1418,-1400,-1382,-1364,-1346,-1328,-1310,-1292,-1274,-1256,-1238,-1220,-1203,
-	-1185,-1167,-1150,-1132,-1115,-1097,-1080,-1063,-1046,-1029,-1012, -995, -978, -962, -945, -929,
-     -912, -896, -880, -864, -849, -833, -817, -802, -787, -772, -757, -742, -727, -713, -699, -684,
-	 -670, -656, -643, -629, -616, -603, -589, -577, -564, -551, -539, -526, -514, -502, -491, -479,
-	 -468, -456, -445, -434, -423, -413, -402, -392, -381, -371, -361, -352, -342, -333, -323, -314,
-	 -305, -296, -288, -279, -270, -262, -254, -246, -238, -230, -222, -215, -207, -200, -193, -186,
-	 -179, -172, -165, -158, -152, -145, -139, -133, -127, -120, -114, -108, -103,  -97,  -91,  -85,
-	  -80,  -74,  -69,  -63,  -58,  -53,  -47,  -42,  -37,  -32,  -27,  -22,  -17,  -12,   -7,   -2
+#if ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+typedef SemaphoreHandle_t synth_sem_t;
+#define synth_sem_create(value) xSemaphoreCreateCounting(BATCHES, value)
+#define synth_sem_wait(sem) xSemaphoreTake(sem, portMAX_DELAY)
+#define synth_sem_post(sem) xSemaphoreGive(sem)
+#else
+typedef SDL_sem *synth_sem_t;
+#define synth_sem_create(value) SDL_CreateSemaphore(value)
+#define synth_sem_wait(sem) SDL_SemWait(sem)
+#define synth_sem_post(sem) SDL_SemPost(sem)
+#endif
+
+// Stereo samples from one thread to another, without a lock: only the
+// writer stores wridx and only the reader stores rdidx. One sample stays
+// unused, so that a full ring is not mistaken for an empty one.
+struct sample_ring {
+	int16_t *samples;
+	uint32_t size; // in int16_t
+	SDL_atomic_t rdidx;
+	SDL_atomic_t wridx;
 };
 
 static SDL_AudioDeviceID audio_dev;
-static int16_t * buffer;
-static uint32_t buffer_size = 0;
-static uint32_t rdidx = 0;
-static uint32_t wridx = 0;
-static uint32_t buffer_written = 0;
+// Synthesis runs, for a device or offline for the recorders only
+static bool running;
+static struct sample_ring output;   // synthesis -> audio_callback()
+static struct sample_ring recorded; // synthesis -> the recorders, on the emulator thread
+static uint32_t dropped_samples = 0;
+// since the first samples went out
+static SDL_atomic_t output_started;
+static SDL_atomic_t underruns;
+static SDL_atomic_t overruns;
+
+// Rate control: instead of dropping samples when the emulator runs ahead
+// of the device's clock and playing silence when it falls behind, the
+// sources are resampled slightly faster or slower, so that the output
+// buffer stays half full. rate_adjust is added to the resampling steps,
+// in 1/65536: more than half full gives fewer host samples.
+#define RATE_ADJUST_MAX 328 // 0.5%
+static uint32_t target_fill;
+static int32_t avg_fill;         // in 1/16 host samples
+static int32_t rate_adjust;
+static uint32_t handed_over;     // host samples in all batches so far
+static SDL_atomic_t synthesized; // of those, the ones in the output by now
+static uint32_t log_samples;
+
+// emulator side: where the sources are, and where the resampler will be
 static uint32_t vera_samp_pos_rd = 0;
-static uint32_t vera_samp_pos_wr = 0;
 static uint32_t vera_samp_pos_hd = 0;
+static uint32_t pcm_samp_pos_wr = 0;
 static uint32_t ym_samp_pos_rd = 0;
-static uint32_t ym_samp_pos_wr = 0;
 static uint32_t ym_samp_pos_hd = 0;
 static uint32_t vera_samps_per_host_samps = 0;
 static uint32_t ym_samps_per_host_samps = 0;
+static struct resampler vera_resampler;
+static struct resampler ym_resampler;
+// YM2151 samples since audio_init(), in SAMP_POS_FRAC_BITS fixed point:
+// the time of the YM's timers
+static uint64_t ym_clock = 0;
+
+// synthesis side
+static uint32_t vera_samp_pos_wr = 0;
+static uint32_t ym_samp_pos_wr = 0;
 static uint32_t limiter_amp = 0;
 
+// Sound register writes, until the samples in front of them are
+// rendered. pos is the sample of the source the write happened at, the
+// last one rendered with the old value.
+#define WRITE_QUEUE_SIZE 256
+
+typedef enum {
+	WRITE_PSG,
+	WRITE_PSG_RESET,
+	WRITE_YM,
+} write_target_t;
+
+struct sound_write {
+	write_target_t target;
+	uint16_t pos;
+	uint8_t reg;
+	uint8_t value;
+};
+
+// What the synthesis thread does with the time since the last batch: the
+// writes, the sources up to vera_to and ym_to, and then len host samples
+// from vera_rd and ym_rd on. The PCM FIFO is visible to the CPU, so its
+// samples are rendered on the emulator thread and come with the batch.
+#define BATCHES 4
+
+struct batch {
+	struct sound_write writes[WRITE_QUEUE_SIZE];
+	uint32_t write_count;
+	int32_t pcm[2 * SAMPLES_PER_BUFFER];
+	uint32_t pcm_count;
+	uint32_t pcm_read;
+	uint32_t vera_to;
+	uint32_t ym_to;
+	uint32_t vera_rd;
+	uint32_t ym_rd;
+	uint32_t vera_step;
+	uint32_t ym_step;
+	uint32_t len;
+};
+
+static struct batch batches[BATCHES];
+static uint8_t current_batch; // the one the emulator fills
+static uint8_t next_synth;
+static bool threaded;
+// free: batches the emulator can fill, ready: batches to synthesize
+static synth_sem_t free_batches;
+static synth_sem_t ready_batches;
+
 static int32_t psg_buf[2 * SAMPLES_PER_BUFFER];
 static int32_t pcm_buf[2 * SAMPLES_PER_BUFFER];
 static int16_t ym_buf[2 * SAMPLES_PER_BUFFER];
+static int16_t mix_buf[2 * SAMPLES_PER_BUFFER];
+// the samples the resampler reads, in order, and what it makes of them
+static int16_t vera_src_l[SAMPLES_PER_BUFFER + RESAMPLER_MAX_TAPS];
+static int16_t vera_src_r[SAMPLES_PER_BUFFER + RESAMPLER_MAX_TAPS];
+static int16_t ym_src_l[SAMPLES_PER_BUFFER + RESAMPLER_MAX_TAPS];
+static int16_t ym_src_r[SAMPLES_PER_BUFFER + RESAMPLER_MAX_TAPS];
+static int32_t vera_out_l[SAMPLES_PER_BUFFER];
+static int32_t vera_out_r[SAMPLES_PER_BUFFER];
+static int32_t ym_out_l[SAMPLES_PER_BUFFER];
+static int32_t ym_out_r[SAMPLES_PER_BUFFER];
 
 uint32_t host_sample_rate = 0;
 
+static bool
+ring_alloc(struct sample_ring *ring, uint32_t size)
+{
+	ring->samples = malloc(size * sizeof(int16_t));
+	ring->size = size;
+	SDL_AtomicSet(&ring->rdidx, 0);
+	SDL_AtomicSet(&ring->wridx, 0);
+	return ring->samples != NULL;
+}
+
+static void
+ring_free(struct sample_ring *ring)
+{
+	free(ring->samples);
+	ring->samples = NULL;
+	ring->size = 0;
+	SDL_AtomicSet(&ring->rdidx, 0);
+	SDL_AtomicSet(&ring->wridx, 0);
+}
+
+// Writes what fits of count stereo samples, returns how many
+static uint32_t
+ring_write(struct sample_ring *ring, const int16_t *samples, uint32_t count)
+{
+	uint32_t wridx = SDL_AtomicGet(&ring->wridx);
+	uint32_t rdidx = SDL_AtomicGet(&ring->rdidx);
+	uint32_t space = (rdidx + ring->size - wridx - 2) % ring->size / 2;
+	count = SDL_min(count, space);
+	uint32_t n = SDL_min(count, (ring->size - wridx) / 2);
+	memcpy(&ring->samples[wridx], samples, n * SAMPLE_BYTES);
+	memcpy(&ring->samples[0], &samples[n * 2], (count - n) * SAMPLE_BYTES);
+	SDL_AtomicSet(&ring->wridx, (wridx + count * 2) % ring->size);
+	return count;
+}
+
+// All stereo samples that can be read
+static uint32_t
+ring_fill(struct sample_ring *ring)
+{
+	uint32_t rdidx = SDL_AtomicGet(&ring->rdidx);
+	uint32_t wridx = SDL_AtomicGet(&ring->wridx);
+	return (wridx + ring->size - rdidx) % ring->size / 2;
+}
+
+// The stereo samples that can be read in one piece
+static uint32_t
+ring_readable(struct sample_ring *ring, int16_t **samples)
+{
+	uint32_t rdidx = SDL_AtomicGet(&ring->rdidx);
+	uint32_t wridx = SDL_AtomicGet(&ring->wridx);
+	*samples = &ring->samples[rdidx];
+	return (wridx >= rdidx ? wridx - rdidx : ring->size - rdidx) / 2;
+}
+
+static void
+ring_consume(struct sample_ring *ring, uint32_t count)
+{
+	uint32_t rdidx = SDL_AtomicGet(&ring->rdidx);
+	SDL_AtomicSet(&ring->rdidx, (rdidx + count * 2) % ring->size);
+}
+
+// Copies count samples from the output, and silence where it runs out
+static void
+fill_from_output(int16_t *stream, uint32_t count)
+{
+	for (int i = 0; i < 2 && count > 0; i++) {
+		int16_t *samples;
+		uint32_t actual_len = SDL_min(count, ring_readable(&output, &samples));
+		memcpy(stream, samples, actual_len * SAMPLE_BYTES);
+		stream += actual_len * 2;
+		count -= actual_len;
+		ring_consume(&output, actual_len);
+	}
+	if (count > 0) {
+		memset(stream, 0, count * SAMPLE_BYTES);
+		if (SDL_AtomicGet(&output_started)) {
+			SDL_AtomicAdd(&underruns, 1);
+		}
+	}
+}
+
 static void
 audio_callback(void *userdata, Uint8 *stream, int len)
 {
@@ -98,56 +257,299 @@ audio_callback(void *userdata, Uint8 *stream, int len)
 		return;
 	}
 
-	uint32_t spos = 0;
-	if (rdidx > wridx) {
-		uint32_t actual_len = SDL_min(len / SAMPLE_BYTES, (buffer_size - rdidx) / 2);
-		if (actual_len > 0) {
-			memcpy(&stream[spos], &buffer[rdidx], actual_len * SAMPLE_BYTES);
-			spos += actual_len * SAMPLE_BYTES;
-			len -= actual_len * SAMPLE_BYTES;
-			rdidx = (rdidx + actual_len * 2) % buffer_size;
-			buffer_written -= actual_len * 2;
+	fill_from_output((int16_t *)stream, SAMPLES_PER_BUFFER);
+}
+
+// Renders VERA's sources from the last sample rendered up to sample to,
+// the PCM samples come from the batch
+static void
+render_vera(struct batch *b, uint32_t to)
+{
+	uint32_t pos = (vera_samp_pos_wr + 1) & SAMP_POS_MASK;
+	uint32_t len = (to - vera_samp_pos_wr) & SAMP_POS_MASK;
+	vera_samp_pos_wr = to;
+	while (len > 0) {
+		uint32_t n = SDL_min(len, SAMPLES_PER_BUFFER - pos);
+		psg_render(&psg_buf[pos * 2], n);
+		memcpy(&pcm_buf[pos * 2], &b->pcm[b->pcm_read * 2], n * 2 * sizeof(int32_t));
+		b->pcm_read += n;
+		len -= n;
+		pos = 0;
+	}
+}
+
+static void
+render_ym(uint32_t to)
+{
+	uint32_t pos = (ym_samp_pos_wr + 1) & SAMP_POS_MASK;
+	uint32_t len = (to - ym_samp_pos_wr) & SAMP_POS_MASK;
+	ym_samp_pos_wr = to;
+	if ((pos + len) > SAMPLES_PER_BUFFER) {
+		YM_stream_update((uint16_t *)&ym_buf[pos * 2], SAMPLES_PER_BUFFER - pos);
+		len -= SAMPLES_PER_BUFFER - pos;
+		pos = 0;
+	}
+	if (len > 0) {
+		YM_stream_update((uint16_t *)&ym_buf[pos * 2], len);
+	}
+}
+
+static void
+output_samples(const int16_t *samples, uint32_t count)
+{
+	if (output.samples) {
+		SDL_AtomicAdd(&overruns, count - ring_write(&output, samples, count));
+		SDL_AtomicSet(&output_started, 1);
+	}
+	// the recorders run on the emulator thread, they must get everything
+	dropped_samples += count - ring_write(&recorded, samples, count);
+}
+
+// How many source samples len host samples from rd on are made of
+static uint32_t
+window(const struct resampler *r, uint32_t rd, uint32_t len)
+{
+	uint32_t n = (((rd & ((1 << SAMP_POS_FRAC_BITS) - 1)) + (len - 1) * r->step) >> SAMP_POS_FRAC_BITS) + r->taps;
+	return SDL_min(n, SAMPLES_PER_BUFFER + RESAMPLER_MAX_TAPS);
+}
+
+// The sources' samples from sample pos on, out of the ring buffers and
+// into separate channels: VERA's fit into 16 bits once PSG and PCM are
+// added up
+static void
+unwrap_sources(uint32_t vera_pos, uint32_t vera_len, uint32_t ym_pos, uint32_t ym_len)
+{
+	for (uint32_t i = 0; i < vera_len; i++) {
+		uint32_t j = ((vera_pos + i) & SAMP_POS_MASK) * 2;
+		vera_src_l[i] = (psg_buf[j] + pcm_buf[j]) >> 8;
+		vera_src_r[i] = (psg_buf[j + 1] + pcm_buf[j + 1]) >> 8;
+	}
+	for (uint32_t i = 0; i < ym_len; i++) {
+		uint32_t j = ((ym_pos + i) & SAMP_POS_MASK) * 2;
+		ym_src_l[i] = ym_buf[j];
+		ym_src_r[i] = ym_buf[j + 1];
+	}
+}
+
+// Resamples and mixes the sources into host samples
+static void
+mix(uint32_t vera_rd, uint32_t ym_rd, uint32_t len)
+{
+	if (len == 0) {
+		return;
+	}
+	unwrap_sources(vera_rd >> SAMP_POS_FRAC_BITS, window(&vera_resampler, vera_rd, len),
+	               ym_rd >> SAMP_POS_FRAC_BITS, window(&ym_resampler, ym_rd, len));
+	// from now on relative to the first sample unwrapped
+	vera_rd &= (1 << SAMP_POS_FRAC_BITS) - 1;
+	ym_rd &= (1 << SAMP_POS_FRAC_BITS) - 1;
+	while (len > 0) {
+		uint32_t n = SDL_min(len, SAMPLES_PER_BUFFER);
+		resampler_run(&vera_resampler, vera_src_l, vera_src_r, vera_rd, n, vera_out_l, vera_out_r);
+		resampler_run(&ym_resampler, ym_src_l, ym_src_r, ym_rd, n, ym_out_l, ym_out_r);
+		for (uint32_t i = 0; i < n; i++) {
+			// Mixing is according to the Developer Board
+			// Loudest single PSG channel is 1/8 times the max output
+			// mix = (psg + pcm) * 2 + ym
+			int32_t mix_l = (vera_out_l[i] >> 13) + (ym_out_l[i] >> 15);
+			int32_t mix_r = (vera_out_r[i] >> 13) + (ym_out_r[i] >> 15);
+			uint32_t amp = SDL_max(SDL_abs(mix_l), SDL_abs(mix_r));
+			if (amp > 32767) {
+				uint32_t limiter_amp_new = (32767 << 16) / amp;
+				limiter_amp = SDL_min(limiter_amp_new, limiter_amp);
+			}
+			mix_buf[i * 2] = (int16_t)((mix_l * limiter_amp) >> 16);
+			mix_buf[i * 2 + 1] = (int16_t)((mix_r * limiter_amp) >> 16);
+			if (limiter_amp < (1 << 16)) limiter_amp++;
 		}
+		output_samples(mix_buf, n);
+		vera_rd += n * vera_resampler.step;
+		ym_rd += n * ym_resampler.step;
+		len -= n;
 	}
-	uint32_t actual_len = SDL_min(len / SAMPLE_BYTES, (wridx - rdidx) / 2);
-	if (actual_len > 0) {
-		memcpy(&stream[spos], &buffer[rdidx], actual_len * SAMPLE_BYTES);
-		spos += actual_len * SAMPLE_BYTES;
-		len -= actual_len * SAMPLE_BYTES;
-		rdidx = (rdidx + actual_len * 2) % buffer_size;
-		buffer_written -= actual_len * 2;
+}
+
+static void
+synthesize(struct batch *b)
+{
+	// every source up to each of its writes, then the write
+	b->pcm_read = 0;
+	for (uint32_t i = 0; i < b->write_count; i++) {
+		const struct sound_write *w = &b->writes[i];
+		switch (w->target) {
+			case WRITE_PSG:
+				render_vera(b, w->pos);
+				psg_writereg(w->reg, w->value);
+				break;
+			case WRITE_PSG_RESET:
+				render_vera(b, w->pos);
+				psg_reset();
+				break;
+			case WRITE_YM:
+				render_ym(w->pos);
+				YM_write_reg(w->reg, w->value);
+				break;
+		}
 	}
-	if (len > 0) memset(&stream[spos], 0, len);
+	render_vera(b, b->vera_to);
+	render_ym(b->ym_to);
+	vera_resampler.step = b->vera_step;
+	ym_resampler.step = b->ym_step;
+	mix(b->vera_rd, b->ym_rd, b->len);
+	SDL_AtomicAdd(&synthesized, b->len);
 }
 
-void
-audio_init(const char *dev_name, int num_audio_buffers)
+#if ESP_PLATFORM
+static void
+synth_worker(void *arg)
+#else
+static int
+synth_worker(void *arg)
+#endif
 {
-	if (audio_dev > 0) {
-		audio_close();
+	for (;;) {
+		synth_sem_wait(ready_batches);
+		synthesize(&batches[next_synth]);
+		next_synth = (next_synth + 1) % BATCHES;
+		synth_sem_post(free_batches);
 	}
+#if !ESP_PLATFORM
+	return 0;
+#endif
+}
 
-	if (dev_name) {
-		if (!strcmp("none", dev_name)) {
-			return;
+static void
+start_batch(void)
+{
+	struct batch *b = &batches[current_batch];
+	b->write_count = 0;
+	b->pcm_count = 0;
+}
+
+// Waits until the synthesis thread is done with everything it got
+static void
+synth_wait(void)
+{
+	if (!threaded) {
+		return;
+	}
+	for (int i = 0; i < BATCHES - 1; i++) {
+		synth_sem_wait(free_batches);
+	}
+	for (int i = 0; i < BATCHES - 1; i++) {
+		synth_sem_post(free_batches);
+	}
+}
+
+// The recorders get the samples on the emulator thread, like the frames
+static void
+record_samples(void)
+{
+	int16_t *samples;
+	uint32_t count;
+	while ((count = ring_readable(&recorded, &samples)) > 0) {
+		wav_recorder_process(samples, count);
+		capture_audio(samples, count);
+		shm_export_audio(samples, count);
+		ring_consume(&recorded, count);
+	}
+}
+
+// What a device and offline synthesis have in common, once the sample
+// rate is known; output has been allocated for a device
+static void
+start(uint32_t sample_rate, uint32_t num_bufs, resampler_quality_t quality)
+{
+	// Init YM2151 emulation. 3.579545 MHz clock
+	YM_Create(3579545);
+	YM_init(3579545/64, 60);
+
+	host_sample_rate = sample_rate;
+	vera_samps_per_host_samps = ((25000000ULL << SAMP_POS_FRAC_BITS) / 512 / host_sample_rate);
+	ym_samps_per_host_samps = ((3579545ULL << SAMP_POS_FRAC_BITS) / 64 / host_sample_rate);
+	if (!resampler_init(&vera_resampler, quality, vera_samps_per_host_samps, SAMP_POS_FRAC_BITS) ||
+	    !resampler_init(&ym_resampler, quality, ym_samps_per_host_samps, SAMP_POS_FRAC_BITS)) {
+		// the one without a table
+		resampler_free(&vera_resampler);
+		resampler_init(&vera_resampler, RESAMPLER_NEAREST, vera_samps_per_host_samps, SAMP_POS_FRAC_BITS);
+		resampler_init(&ym_resampler, RESAMPLER_NEAREST, ym_samps_per_host_samps, SAMP_POS_FRAC_BITS);
+	}
+	vera_samp_pos_rd = 0;
+	vera_samp_pos_wr = 0;
+	vera_samp_pos_hd = 0;
+	pcm_samp_pos_wr = 0;
+	ym_samp_pos_rd = 0;
+	ym_samp_pos_wr = 0;
+	ym_samp_pos_hd = 0;
+	ym_clock = 0;
+	limiter_amp = (1 << 16);
+	dropped_samples = 0;
+	target_fill = SAMPLES_PER_BUFFER * num_bufs / 2;
+	avg_fill = 0;
+	rate_adjust = 0;
+	handed_over = 0;
+	log_samples = 0;
+	SDL_AtomicSet(&synthesized, 0);
+	SDL_AtomicSet(&output_started, 0);
+	SDL_AtomicSet(&underruns, 0);
+	SDL_AtomicSet(&overruns, 0);
+
+	// What all batches until the emulator thread gets to record them can
+	// hold: a batch has up to a buffer of the fastest source, resampled
+	// as slowly as the rate control goes
+	uint32_t min_step = ym_samps_per_host_samps - (uint32_t)(((uint64_t)ym_samps_per_host_samps * RATE_ADJUST_MAX) >> 16);
+	uint32_t batch_len = (uint32_t)(((uint64_t)SAMPLES_PER_BUFFER << SAMP_POS_FRAC_BITS) / min_step) + 1;
+	ring_alloc(&recorded, output.size + (BATCHES + 1) * batch_len * 2);
+
+	psg_buf[0] = psg_buf[1] = 0;
+	pcm_buf[0] = pcm_buf[1] = 0;
+	ym_buf[0] = ym_buf[1] = 0;
+
+	if (!free_batches) {
+		free_batches = synth_sem_create(BATCHES);
+		ready_batches = synth_sem_create(0);
+		if (free_batches && ready_batches) {
+#if ESP_PLATFORM
+			threaded = xTaskCreatePinnedToCore(synth_worker, "audio_synth", 4096, NULL, 1, NULL, 0) == pdPASS;
+#else
+			threaded = SDL_CreateThread(synth_worker, "audio_synth", NULL) != NULL;
+#endif
+		}
+		if (threaded) {
+			// the batch the emulator fills first, it keeps one from now on
+			synth_sem_wait(free_batches);
 		}
 	}
+	start_batch();
+	running = true;
+}
 
-	// Set number of buffers
-	int num_bufs = num_audio_buffers;
-	if (num_bufs < 3) {
-		num_bufs = 3;
+static int
+clamp_buffers(int num_bufs)
+{
+	if (num_bufs < 2) {
+		num_bufs = 2;
 	}
 	if (num_bufs > 1024) {
 		num_bufs = 1024;
 	}
-	buffer_size = SAMPLES_PER_BUFFER * num_bufs * 2;
+	return num_bufs;
+}
 
-	// Allocate audio buffer
-	buffer = malloc(buffer_size * sizeof(int16_t));
-	rdidx = 0;
-	wridx = 0;
-	buffer_written = 0;
+bool
+audio_init(const char *dev_name, int num_audio_buffers, resampler_quality_t quality)
+{
+	if (running) {
+		audio_close();
+	}
+
+	if (dev_name) {
+		if (!strcmp("none", dev_name)) {
+			return false;
+		}
+	}
+
+	int num_bufs = clamp_buffers(num_audio_buffers);
 
 	SDL_AudioSpec desired;
 	SDL_AudioSpec obtained;
@@ -160,6 +562,9 @@ audio_init(const char *dev_name, int num_audio_buffers)
 	desired.channels = 2;
 	desired.callback = audio_callback;
 
+	// Allocate audio buffer; the callback can run as soon as the device is open
+	ring_alloc(&output, SAMPLES_PER_BUFFER * num_bufs * 2);
+
 	audio_dev = SDL_OpenAudioDevice(dev_name, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
 	if (audio_dev <= 0) {
 		fprintf(stderr, "SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
@@ -170,58 +575,102 @@ audio_init(const char *dev_name, int num_audio_buffers)
 	}
 	if (obtained.freq <= 0 || (AUDIO_SAMPLERATE / obtained.freq) > SAMPLES_PER_BUFFER) {
 		fprintf(stderr, "Obtained sample rate is too low");
+		SDL_CloseAudioDevice(audio_dev);
+		audio_dev = 0;
+		ring_free(&output);
+		return false;
+	}
+
+	start(obtained.freq, num_bufs, quality);
+
+	// Start playback
+	SDL_PauseAudioDevice(audio_dev, 0);
+	return true;
+}
+
+void
+audio_init_offline(resampler_quality_t quality)
+{
+	if (running) {
 		audio_close();
-		return;
 	}
 
-	// Init YM2151 emulation. 3.579545 MHz clock
-	YM_Create(3579545);
-	YM_init(3579545/64, 60);
+	// VERA's own rate: the PSG and PCM samples are copied, and a second
+	// of emulated time is a second of samples, however fast it runs
+	start(AUDIO_SAMPLERATE, 0, quality);
+}
 
-	host_sample_rate = obtained.freq;
-	vera_samps_per_host_samps = ((25000000ULL << SAMP_POS_FRAC_BITS) / 512 / host_sample_rate);
-	ym_samps_per_host_samps = ((3579545ULL << SAMP_POS_FRAC_BITS) / 64 / host_sample_rate);
-	vera_samp_pos_rd = 0;
-	vera_samp_pos_wr = 0;
-	vera_samp_pos_hd = 0;
-	ym_samp_pos_rd = 0;
-	ym_samp_pos_wr = 0;
-	ym_samp_pos_hd = 0;
-	limiter_amp = (1 << 16);
+void
+audio_init_pull(uint32_t sample_rate, int num_audio_buffers, resampler_quality_t quality)
+{
+	if (running) {
+		audio_close();
+	}
 
-	psg_buf[0] = psg_buf[1] = 0;
-	pcm_buf[0] = pcm_buf[1] = 0;
-	ym_buf[0] = ym_buf[1] = 0;
+	int num_bufs = clamp_buffers(num_audio_buffers);
+	ring_alloc(&output, SAMPLES_PER_BUFFER * num_bufs * 2);
+	start(sample_rate, num_bufs, quality);
+}
 
-	// Start playback
-	SDL_PauseAudioDevice(audio_dev, 0);
+void
+audio_pull(int16_t *samples, uint32_t count)
+{
+	if (!output.samples) {
+		memset(samples, 0, count * SAMPLE_BYTES);
+		return;
+	}
+	fill_from_output(samples, count);
 }
 
 void
 audio_close(void)
 {
-	if (audio_dev == 0) {
+	if (!running) {
 		return;
 	}
 
-	SDL_CloseAudioDevice(audio_dev);
-	audio_dev = 0;
+	// everything until now is synthesized and recorded
+	audio_render();
+	running = false;
+	if (audio_dev) {
+		SDL_CloseAudioDevice(audio_dev);
+		audio_dev = 0;
+	}
+	synth_wait();
+	record_samples();
+	if (dropped_samples) {
+		printf("Audio: %u samples dropped from recording\n", dropped_samples);
+	}
 
 	// Free audio buffers
-	if (buffer != NULL) {
-		free(buffer);
-		buffer = NULL;
-	}
+	ring_free(&output);
+	ring_free(&recorded);
+	resampler_free(&vera_resampler);
+	resampler_free(&ym_resampler);
 }
 
 void
 audio_step(int cpu_clocks)
 {
+	sound_log_step(cpu_clocks);
+
 	// Accumulate how many samples each source have to render
-	if (audio_dev == 0) {
+	if (!running) {
+		// Nothing is played, but the PCM FIFO still drains at VERA's
+		// sample rate, so that its IRQ comes when the program expects it
+		vera_samp_pos_hd += cpu_clocks * VERA_SAMP_CLKS_PER_CPU_CLK;
+		ym_clock += cpu_clocks * YM_SAMP_CLKS_PER_CPU_CLK;
+		uint32_t len = vera_samp_pos_hd >> SAMP_POS_FRAC_BITS;
+		vera_samp_pos_hd &= (1 << SAMP_POS_FRAC_BITS) - 1;
+		while (len > 0) {
+			uint32_t n = SDL_min(len, SAMPLES_PER_BUFFER);
+			pcm_render(pcm_buf, n);
+			len -= n;
+		}
 		return;
 	}
 
+	ym_clock += cpu_clocks * YM_SAMP_CLKS_PER_CPU_CLK;
 	while (cpu_clocks > 0) {
 		// Only the source with the higest sample rate (YM2151) is needed for calculation
 		uint32_t max_cpu_clks_ym = ((ym_samp_pos_rd - ym_samp_pos_hd - (1 << SAMP_POS_FRAC_BITS)) & SAMP_POS_MASK_FRAC) / YM_SAMP_CLKS_PER_CPU_CLK;
@@ -234,140 +683,185 @@ audio_step(int cpu_clocks)
 }
 
 void
-audio_render()
+audio_render_pcm()
 {
-	// Render all audio sources until read and write positions catch up
-	// This happens when there's a change to sound registers or one of the
-	// sources' sample buffer head position is too far
-	if (audio_dev == 0) {
+	if (!running) {
 		return;
 	}
+	struct batch *b = &batches[current_batch];
+	uint32_t to = vera_samp_pos_hd >> SAMP_POS_FRAC_BITS;
+	uint32_t len = (to - pcm_samp_pos_wr) & SAMP_POS_MASK;
+	pcm_samp_pos_wr = to;
+	pcm_render(&b->pcm[b->pcm_count * 2], len);
+	b->pcm_count += len;
+}
 
-	uint32_t pos, len;
-
-	pos = (vera_samp_pos_wr + 1) & SAMP_POS_MASK;
-	len = ((vera_samp_pos_hd >> SAMP_POS_FRAC_BITS) - vera_samp_pos_wr) & SAMP_POS_MASK;
-	vera_samp_pos_wr = vera_samp_pos_hd >> SAMP_POS_FRAC_BITS;
-	if (pos + len > SAMPLES_PER_BUFFER) {
-		psg_render(&psg_buf[pos * 2], SAMPLES_PER_BUFFER - pos);
-		pcm_render(&pcm_buf[pos * 2], SAMPLES_PER_BUFFER - pos);
-		len -= SAMPLES_PER_BUFFER - pos;
-		pos = 0;
+static void
+queue_write(write_target_t target, uint32_t pos, uint8_t reg, uint8_t value)
+{
+	struct batch *b = &batches[current_batch];
+	if (b->write_count == WRITE_QUEUE_SIZE) {
+		audio_render();
+		b = &batches[current_batch];
 	}
-	if (len > 0) {
-		psg_render(&psg_buf[pos * 2], len);
-		pcm_render(&pcm_buf[pos * 2], len);
+	struct sound_write *w = &b->writes[b->write_count++];
+	w->target = target;
+	w->pos = pos;
+	w->reg = reg;
+	w->value = value;
+}
+
+void
+audio_write_psg(uint8_t reg, uint8_t value)
+{
+	sound_log_write(SOUND_LOG_PSG, reg, value);
+	if (!running) {
+		psg_writereg(reg, value);
+		return;
 	}
+	queue_write(WRITE_PSG, vera_samp_pos_hd >> SAMP_POS_FRAC_BITS, reg, value);
+}
 
-	pos = (ym_samp_pos_wr + 1) & SAMP_POS_MASK;
-	len = ((ym_samp_pos_hd >> SAMP_POS_FRAC_BITS) - ym_samp_pos_wr) & SAMP_POS_MASK;
-	ym_samp_pos_wr = ym_samp_pos_hd >> SAMP_POS_FRAC_BITS;
-	if ((pos + len) > SAMPLES_PER_BUFFER) {
-		YM_stream_update((uint16_t *)&ym_buf[pos * 2], SAMPLES_PER_BUFFER - pos);
-		len -= SAMPLES_PER_BUFFER - pos;
-		pos = 0;
+void
+audio_reset_psg()
+{
+	sound_log_write(SOUND_LOG_PSG_RESET, 0, 0);
+	if (!running) {
+		psg_reset();
+		return;
 	}
-	if (len > 0) {
-		YM_stream_update((uint16_t *)&ym_buf[pos * 2], len);
+	queue_write(WRITE_PSG_RESET, vera_samp_pos_hd >> SAMP_POS_FRAC_BITS, 0, 0);
+}
+
+void
+audio_write_ym(uint8_t reg, uint8_t value)
+{
+	sound_log_write(SOUND_LOG_YM, reg, value);
+	YM_timers_write(ym_clock >> SAMP_POS_FRAC_BITS, reg, value);
+	if (!running) {
+		// nothing is rendered that would take the chip out of busy
+		return;
 	}
+	queue_write(WRITE_YM, ym_samp_pos_hd >> SAMP_POS_FRAC_BITS, reg, value);
+}
 
-	uint32_t wridx_old = wridx;
-	uint32_t len_vera = (vera_samp_pos_hd - vera_samp_pos_rd) & SAMP_POS_MASK_FRAC;
-	uint32_t len_ym = (ym_samp_pos_hd - ym_samp_pos_rd) & SAMP_POS_MASK_FRAC;
-	if (len_vera < (4 << SAMP_POS_FRAC_BITS) || len_ym < (4 << SAMP_POS_FRAC_BITS)) {
-		// not enough samples yet, at least 4 are needed for the filter
+uint8_t
+audio_read_ym_status()
+{
+	return YM_read_status(ym_clock >> SAMP_POS_FRAC_BITS);
+}
+
+bool
+audio_ym_irq()
+{
+	return YM_irq(ym_clock >> SAMP_POS_FRAC_BITS);
+}
+
+// The output buffer's fill, with what is still being synthesized, steers
+// the resampling steps of the next batch
+static void
+update_rate(void)
+{
+	if (!output.samples) {
+		// offline, emulated time is the clock
 		return;
 	}
-	len_vera = (len_vera - (4 << SAMP_POS_FRAC_BITS)) / vera_samps_per_host_samps;
-	len_ym = (len_ym - (4 << SAMP_POS_FRAC_BITS)) / ym_samps_per_host_samps;
-	len = SDL_min(len_vera, len_ym);
-	SDL_LockAudioDevice(audio_dev);
-	for (int i = 0; i < len; i++) {
-		int32_t samp[8];
-		int32_t filter_idx = 0;
-		int32_t vera_out_l = 0;
-		int32_t vera_out_r = 0;
-		int32_t ym_out_l = 0;
-		int32_t ym_out_r = 0;
-		// Don't resample VERA outputs if the host sample rate is as desired
-		if (host_sample_rate == AUDIO_SAMPLERATE) {
-			pos = (vera_samp_pos_rd >> SAMP_POS_FRAC_BITS) * 2;
-			vera_out_l = ((psg_buf[pos] + pcm_buf[pos]) >> 8) * 32768;
-			vera_out_r = ((psg_buf[pos + 1] + pcm_buf[pos + 1]) >> 8) * 32768;
-		} else {
-			filter_idx = (vera_samp_pos_rd >> (SAMP_POS_FRAC_BITS - 8)) & 0xff;
-			pos = (vera_samp_pos_rd >> SAMP_POS_FRAC_BITS) * 2;
-			for (int j = 0; j < 8; j += 2) {
-				samp[j] = (psg_buf[pos] + pcm_buf[pos]) >> 8;
-				samp[j + 1] = (psg_buf[pos + 1] + pcm_buf[pos + 1]) >> 8;
-				pos = (pos + 2) & (SAMP_POS_MASK * 2);
-			}
-			vera_out_l += samp[0] * filter[256 + filter_idx];
-			vera_out_r += samp[1] * filter[256 + filter_idx];
-			vera_out_l += samp[2] * filter[  0 + filter_idx];
-			vera_out_r += samp[3] * filter[  0 + filter_idx];
-			vera_out_l += samp[4] * filter[255 - filter_idx];
-			vera_out_r += samp[5] * filter[255 - filter_idx];
-			vera_out_l += samp[6] * filter[511 - filter_idx];
-			vera_out_r += samp[7] * filter[511 - filter_idx];
-		}
-		filter_idx = (ym_samp_pos_rd >> (SAMP_POS_FRAC_BITS - 8)) & 0xff;
-		pos = (ym_samp_pos_rd >> SAMP_POS_FRAC_BITS) * 2;
-		for (int j = 0; j < 8; j += 2) {
-			samp[j] = ym_buf[pos];
-			samp[j + 1] = ym_buf[pos + 1];
-			pos = (pos + 2) & (SAMP_POS_MASK * 2);
-		}
-		ym_out_l += samp[0] * filter[256 + filter_idx];
-		ym_out_r += samp[1] * filter[256 + filter_idx];
-		ym_out_l += samp[2] * filter[  0 + filter_idx];
-		ym_out_r += samp[3] * filter[  0 + filter_idx];
-		ym_out_l += samp[4] * filter[255 - filter_idx];
-		ym_out_r += samp[5] * filter[255 - filter_idx];
-		ym_out_l += samp[6] * filter[511 - filter_idx];
-		ym_out_r += samp[7] * filter[511 - filter_idx];
-		// Mixing is according to the Developer Board
-		// Loudest single PSG channel is 1/8 times the max output
-		// mix = (psg + pcm) * 2 + ym
-		int32_t mix_l = (vera_out_l >> 13) + (ym_out_l >> 15);
-		int32_t mix_r = (vera_out_r >> 13) + (ym_out_r >> 15);
-		uint32_t amp = SDL_max(SDL_abs(mix_l), SDL_abs(mix_r));
-		if (amp > 32767) {
-			uint32_t limiter_amp_new = (32767 << 16) / amp;
-			limiter_amp = SDL_min(limiter_amp_new, limiter_amp);
-		}
-		buffer[wridx++] = (int16_t)((mix_l * limiter_amp) >> 16);
-		buffer[wridx++] = (int16_t)((mix_r * limiter_amp) >> 16);
-		if (limiter_amp < (1 << 16)) limiter_amp++;
-		vera_samp_pos_rd = (vera_samp_pos_rd + vera_samps_per_host_samps) & SAMP_POS_MASK_FRAC;
-		ym_samp_pos_rd = (ym_samp_pos_rd + ym_samps_per_host_samps) & SAMP_POS_MASK_FRAC;
-		if (wridx == buffer_size) {
-			wav_recorder_process(&buffer[wridx_old], (buffer_size - wridx_old) / 2);
-			wridx = 0;
-			wridx_old = 0;
-		}
+	uint32_t queued = ring_fill(&output) + (handed_over - (uint32_t)SDL_AtomicGet(&synthesized));
+	avg_fill += ((int32_t)(queued << 4) - avg_fill) >> 4;
+	int32_t error = (avg_fill >> 4) - (int32_t)target_fill;
+	rate_adjust = error * RATE_ADJUST_MAX / (int32_t)target_fill;
+	rate_adjust = SDL_max(SDL_min(rate_adjust, RATE_ADJUST_MAX), -RATE_ADJUST_MAX);
+}
+
+static uint32_t
+adjust_step(uint32_t step)
+{
+	return step + (int32_t)(((int64_t)step * rate_adjust) >> 16);
+}
+
+// Once a second with -log A
+static void
+log_rate(uint32_t len)
+{
+	if (!log_audio) {
+		return;
 	}
-	if ((wridx - wridx_old) > 0) {
-		wav_recorder_process(&buffer[wridx_old], (wridx - wridx_old) / 2);
+	log_samples += len;
+	if (log_samples >= host_sample_rate) {
+		struct audio_stats stats;
+		audio_get_stats(&stats);
+		printf("Audio: latency %u ms, rate %+d ppm, %u underruns, %u samples overrun\n",
+		       stats.latency_ms, stats.rate_ppm, stats.underruns, stats.overruns);
+		log_samples = 0;
 	}
-	buffer_written += len * 2;
-	if (buffer_written > buffer_size) {
-		// Prevent the buffer from overflowing by skipping the read pointer ahead.
-		uint32_t buffer_skip_amount = (buffer_written / buffer_size) * SAMPLES_PER_BUFFER * 2;
-		rdidx = (rdidx + buffer_skip_amount) % buffer_size;
-		buffer_written -= buffer_skip_amount;
+}
+
+void
+audio_get_stats(struct audio_stats *stats)
+{
+	stats->underruns = SDL_AtomicGet(&underruns);
+	stats->overruns = SDL_AtomicGet(&overruns);
+	// the device has a buffer more
+	stats->latency_ms = host_sample_rate ? (uint32_t)(((avg_fill >> 4) + SAMPLES_PER_BUFFER) * 1000ULL / host_sample_rate) : 0;
+	stats->rate_ppm = -(int32_t)((int64_t)rate_adjust * 1000000 / 65536);
+}
+
+void
+audio_render()
+{
+	// Hand all audio sources until now to the synthesis. This happens when
+	// the write queue is full or one of the sources' sample buffer head
+	// position is too far
+	if (!running) {
+		return;
 	}
-	SDL_UnlockAudioDevice(audio_dev);
 
-	// catch up all buffers if they are too far behind
-	uint32_t skip = len_vera - len;
-	if (skip > 1) {
-		vera_samp_pos_rd = (vera_samp_pos_rd + vera_samps_per_host_samps) & SAMP_POS_MASK_FRAC;
+	audio_render_pcm();
+	update_rate();
+	struct batch *b = &batches[current_batch];
+	b->vera_to = vera_samp_pos_hd >> SAMP_POS_FRAC_BITS;
+	b->ym_to = ym_samp_pos_hd >> SAMP_POS_FRAC_BITS;
+	b->vera_rd = vera_samp_pos_rd;
+	b->ym_rd = ym_samp_pos_rd;
+	b->vera_step = adjust_step(vera_samps_per_host_samps);
+	b->ym_step = adjust_step(ym_samps_per_host_samps);
+	b->len = 0;
+
+	uint32_t len_vera = (vera_samp_pos_hd - vera_samp_pos_rd) & SAMP_POS_MASK_FRAC;
+	uint32_t len_ym = (ym_samp_pos_hd - ym_samp_pos_rd) & SAMP_POS_MASK_FRAC;
+	// the resampler needs its taps' samples from the last position on
+	const uint32_t vera_taps = vera_resampler.taps << SAMP_POS_FRAC_BITS;
+	const uint32_t ym_taps = ym_resampler.taps << SAMP_POS_FRAC_BITS;
+	if (len_vera >= vera_taps && len_ym >= ym_taps) {
+		len_vera = (len_vera - vera_taps) / b->vera_step;
+		len_ym = (len_ym - ym_taps) / b->ym_step;
+		b->len = SDL_min(len_vera, len_ym);
+		vera_samp_pos_rd = (vera_samp_pos_rd + b->len * b->vera_step) & SAMP_POS_MASK_FRAC;
+		ym_samp_pos_rd = (ym_samp_pos_rd + b->len * b->ym_step) & SAMP_POS_MASK_FRAC;
+
+		// catch up all buffers if they are too far behind
+		uint32_t skip = len_vera - b->len;
+		if (skip > 1) {
+			vera_samp_pos_rd = (vera_samp_pos_rd + b->vera_step) & SAMP_POS_MASK_FRAC;
+		}
+		skip = len_ym - b->len;
+		if (skip > 1) {
+			ym_samp_pos_rd = (ym_samp_pos_rd + b->ym_step) & SAMP_POS_MASK_FRAC;
+		}
 	}
-	skip = len_ym - len;
-	if (skip > 1) {
-		ym_samp_pos_rd = (ym_samp_pos_rd + ym_samps_per_host_samps) & SAMP_POS_MASK_FRAC;
+
+	handed_over += b->len;
+	log_rate(b->len);
+
+	if (threaded) {
+		synth_sem_post(ready_batches);
+		synth_sem_wait(free_batches);
+		current_batch = (current_batch + 1) % BATCHES;
+	} else {
+		synthesize(b);
 	}
+	start_batch();
+	record_samples();
 }
 
 void
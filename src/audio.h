@@ -4,13 +4,48 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <SDL.h>
+#include "resampler.h"
 
 #define AUDIO_SAMPLERATE (25000000 / 512)
 
-void audio_init(const char *dev_name, int num_audio_buffers);
+// false if there is no device ("none") to play the audio
+bool audio_init(const char *dev_name, int num_audio_buffers, resampler_quality_t quality);
+// Synthesis and mixing for the recorders only, without a device, at
+// AUDIO_SAMPLERATE and the speed the emulator runs at
+void audio_init_offline(resampler_quality_t quality);
+// For a sink that asks for the samples itself, like the EVE's playback
+// on the ESP32: its clock drives the rate control like a device's
+void audio_init_pull(uint32_t sample_rate, int num_audio_buffers, resampler_quality_t quality);
+// count stereo samples, silence where the synthesis is behind; the sink
+// has to stop asking before audio_close()
+void audio_pull(int16_t *samples, uint32_t count);
 void audio_close(void);
 void audio_step(int cpu_clocks);
 void audio_render();
+// The PCM FIFO up to now, for an access to its registers
+void audio_render_pcm(void);
+
+// Writes to the PSG and the YM2151 are queued with the sample they
+// happened at, and rendered by the synthesis thread after the next
+// audio_render(). The YM's status and IRQ come from its timers, without
+// rendering.
+void audio_write_psg(uint8_t reg, uint8_t value);
+void audio_reset_psg(void);
+void audio_write_ym(uint8_t reg, uint8_t value);
+uint8_t audio_read_ym_status(void);
+bool audio_ym_irq(void);
+
+// The output is kept half full by resampling up to 0.5% faster or
+// slower; this is what that looks like, for -log A
+struct audio_stats {
+	uint32_t underruns;  // device buffers that were filled up with silence
+	uint32_t overruns;   // samples that did not fit into the output
+	uint32_t latency_ms; // from the synthesis to the speaker, on average
+	int32_t rate_ppm;    // how many more host samples there are than nominal
+};
+void audio_get_stats(struct audio_stats *stats);
 
 void audio_usage(void);
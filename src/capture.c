@@ -0,0 +1,279 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "capture.h"
+
+#if ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+typedef SemaphoreHandle_t capture_sem_t;
+#define capture_sem_create(value) xSemaphoreCreateCounting(QUEUE_SLOTS, value)
+#define capture_sem_wait(sem) xSemaphoreTake(sem, portMAX_DELAY)
+#define capture_sem_trywait(sem) (xSemaphoreTake(sem, 0) == pdTRUE)
+#define capture_sem_post(sem) xSemaphoreGive(sem)
+#else
+#include <SDL.h>
+
+typedef SDL_sem *capture_sem_t;
+#define capture_sem_create(value) SDL_CreateSemaphore(value)
+#define capture_sem_wait(sem) SDL_SemWait(sem)
+#define capture_sem_trywait(sem) (SDL_SemTryWait(sem) == 0)
+#define capture_sem_post(sem) SDL_SemPost(sem)
+#ifndef _WIN32
+#include <signal.h>
+#endif
+#endif
+
+#define QUEUE_SLOTS 4
+#define PALETTE_SIZE (256 * 3)
+#define CHANNELS 2
+
+// A frame with the audio in front of it. The emulator always fills one
+// of them; it only goes to the worker with a video frame, and if there
+// is no other slot to continue with, the frame is dropped instead.
+struct slot {
+	uint8_t *pixels;
+	uint8_t palette[PALETTE_SIZE];
+	bool palette_changed;
+	bool has_video;
+	uint32_t number;
+	int16_t *audio;
+	uint32_t audio_count; // stereo samples
+};
+
+static FILE *file;
+static uint16_t width;
+static uint16_t height;
+static uint32_t audio_capacity;
+static bool threaded;
+static volatile bool failed;
+
+// emulator side
+static struct slot slots[QUEUE_SLOTS];
+static uint8_t current;
+static uint8_t last_palette[PALETTE_SIZE];
+static bool palette_valid;
+static uint32_t dropped_frames;
+static uint32_t dropped_samples;
+
+// worker side
+static uint8_t next_write;
+
+// free: slots the emulator can fill, ready: slots for the worker
+static capture_sem_t free_slots;
+static capture_sem_t ready_slots;
+
+static void
+put16(uint8_t *p, uint16_t value)
+{
+	p[0] = value & 0xff;
+	p[1] = value >> 8;
+}
+
+static void
+put32(uint8_t *p, uint32_t value)
+{
+	put16(p, value & 0xffff);
+	put16(p + 2, value >> 16);
+}
+
+static void
+record_header(char type, uint32_t length)
+{
+	uint8_t header[5];
+	header[0] = type;
+	put32(header + 1, length);
+	fwrite(header, 1, sizeof(header), file);
+}
+
+static void
+write_slot(struct slot *slot)
+{
+	if (slot->audio_count) {
+		// the samples are in the byte order of the host, which is
+		// little endian on every platform this runs on
+		record_header('A', slot->audio_count * CHANNELS * sizeof(int16_t));
+		fwrite(slot->audio, CHANNELS * sizeof(int16_t), slot->audio_count, file);
+	}
+	if (slot->has_video) {
+		if (slot->palette_changed) {
+			record_header('P', PALETTE_SIZE);
+			fwrite(slot->palette, 1, PALETTE_SIZE, file);
+		}
+		uint8_t number[4];
+		put32(number, slot->number);
+		record_header('V', sizeof(number) + width * height);
+		fwrite(number, 1, sizeof(number), file);
+		fwrite(slot->pixels, 1, width * height, file);
+	}
+	// a pipe gets what there is
+	fflush(file);
+	if (ferror(file)) {
+		failed = true;
+	}
+	slot->audio_count = 0;
+	slot->palette_changed = false;
+	slot->has_video = false;
+}
+
+#if ESP_PLATFORM
+static void
+capture_worker(void *arg)
+#else
+static int
+capture_worker(void *arg)
+#endif
+{
+	for (;;) {
+		capture_sem_wait(ready_slots);
+		write_slot(&slots[next_write]);
+		next_write = (next_write + 1) % QUEUE_SLOTS;
+		capture_sem_post(free_slots);
+	}
+#if !ESP_PLATFORM
+	return 0;
+#endif
+}
+
+bool
+capture_begin(const char *path, uint16_t w, uint16_t h, uint32_t frame_rate_num, uint32_t frame_rate_den, uint32_t sample_rate)
+{
+#if !ESP_PLATFORM && !defined(_WIN32)
+	// an encoder that quits ends the capture, not the emulator
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	// opening a named pipe waits for the reader
+	file = fopen(path, "wb");
+	if (!file) {
+		printf("Cannot create %s\n", path);
+		return false;
+	}
+	width = w;
+	height = h;
+	palette_valid = false;
+	dropped_frames = 0;
+	dropped_samples = 0;
+	// a second of audio per slot
+	audio_capacity = sample_rate;
+	for (int i = 0; i < QUEUE_SLOTS; i++) {
+		slots[i].pixels = malloc(width * height);
+		slots[i].audio = malloc(audio_capacity * CHANNELS * sizeof(int16_t));
+	}
+
+	uint8_t header[18];
+	put16(header, width);
+	put16(header + 2, height);
+	put32(header + 4, frame_rate_num);
+	put32(header + 8, frame_rate_den);
+	put32(header + 12, sample_rate);
+	header[16] = CHANNELS;
+	header[17] = 16; // bits per sample
+	fwrite("X16CAP", 1, 6, file);
+	record_header('H', sizeof(header));
+	fwrite(header, 1, sizeof(header), file);
+
+	if (!free_slots) {
+		free_slots = capture_sem_create(QUEUE_SLOTS);
+		ready_slots = capture_sem_create(0);
+		if (free_slots && ready_slots) {
+#if ESP_PLATFORM
+			threaded = xTaskCreatePinnedToCore(capture_worker, "capture", 4096, NULL, 1, NULL, 0) == pdPASS;
+#else
+			threaded = SDL_CreateThread(capture_worker, "capture", NULL) != NULL;
+#endif
+		}
+	}
+	if (threaded) {
+		// the slot the emulator fills first
+		capture_sem_wait(free_slots);
+	}
+	current = next_write;
+	return true;
+}
+
+void
+capture_audio(const int16_t *samples, uint32_t count)
+{
+	if (!file) {
+		return;
+	}
+	struct slot *slot = &slots[current];
+	uint32_t n = audio_capacity - slot->audio_count;
+	if (n > count) {
+		n = count;
+	}
+	memcpy(slot->audio + slot->audio_count * CHANNELS, samples, n * CHANNELS * sizeof(int16_t));
+	slot->audio_count += n;
+	dropped_samples += count - n;
+}
+
+bool
+capture_frame(const uint8_t *pixels, const uint8_t *palette, uint32_t number)
+{
+	if (!file) {
+		return false;
+	}
+	if (threaded && !capture_sem_trywait(free_slots)) {
+		// the audio stays in the slot until the next frame
+		dropped_frames++;
+		return !failed;
+	}
+
+	struct slot *slot = &slots[current];
+	memcpy(slot->pixels, pixels, width * height);
+	if (!palette_valid || memcmp(palette, last_palette, PALETTE_SIZE)) {
+		memcpy(slot->palette, palette, PALETTE_SIZE);
+		memcpy(last_palette, palette, PALETTE_SIZE);
+		slot->palette_changed = true;
+		palette_valid = true;
+	}
+	slot->number = number;
+	slot->has_video = true;
+
+	if (threaded) {
+		current = (current + 1) % QUEUE_SLOTS;
+		capture_sem_post(ready_slots);
+	} else {
+		write_slot(slot);
+	}
+	return !failed;
+}
+
+void
+capture_end()
+{
+	if (!file) {
+		return;
+	}
+	if (threaded) {
+		// the audio after the last frame, then everything is written
+		// once all slots are free again
+		capture_sem_post(ready_slots);
+		for (int i = 0; i < QUEUE_SLOTS; i++) {
+			capture_sem_wait(free_slots);
+		}
+	} else {
+		write_slot(&slots[current]);
+	}
+	fclose(file);
+	file = NULL;
+	for (int i = 0; i < QUEUE_SLOTS; i++) {
+		free(slots[i].pixels);
+		free(slots[i].audio);
+	}
+	if (dropped_frames || dropped_samples) {
+		printf("Capture: %u frames and %u samples dropped\n", dropped_frames, dropped_samples);
+	}
+
+	if (threaded) {
+		for (int i = 0; i < QUEUE_SLOTS; i++) {
+			capture_sem_post(free_slots);
+		}
+	}
+}
@@ -0,0 +1,46 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Raw video and audio capture for external encoders (-capture): every
+// frame that is shown, as 8 bit indexed pixels, and the mixed audio go
+// into a file or a named pipe. The emulator only copies them into a
+// preallocated slot; a worker writes the slots. If it falls behind,
+// video frames are dropped, and the audio of the frames in between is
+// kept with the next one.
+//
+// The file starts with "X16CAP", followed by records of a type byte,
+// a 32 bit length, and that many bytes. All numbers are little endian.
+//
+//   'H' header, the first record: width and height (16 bit each), the
+//       frame rate as a fraction (32 bit numerator and denominator),
+//       the sample rate (32 bit, 0 without audio), the channels (8
+//       bit, 2) and the bits per sample (8 bit, 16)
+//   'A' audio: interleaved signed samples
+//   'P' palette: 256 RGB triples, before the first frame and before
+//       every frame that has a different one
+//   'V' video: the frame number (32 bit), then width * height pixels.
+//       Numbers that are missing are frames that were skipped or
+//       dropped; the last frame is still shown then.
+//
+// The audio in front of a frame is what was played until it was shown.
+
+bool capture_begin(const char *path, uint16_t width, uint16_t height, uint32_t frame_rate_num, uint32_t frame_rate_den, uint32_t sample_rate);
+
+// Stereo samples
+void capture_audio(const int16_t *samples, uint32_t count);
+
+// Captures a frame; palette is 256 RGB triples. Returns false if
+// writing failed.
+bool capture_frame(const uint8_t *pixels, const uint8_t *palette, uint32_t number);
+
+// Waits for the worker, and closes the file
+void capture_end(void);
+
+#endif
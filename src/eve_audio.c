@@ -0,0 +1,142 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#include <string.h>
+#include "eve_audio.h"
+
+#define RING_MASK (EVE_DISPLAY_AUDIO_SIZE - 1)
+
+#define CHUNK_SIZE (EVE_AUDIO_LEAD + EVE_AUDIO_MAX_CHUNK + EVE_AUDIO_PAD)
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+static const struct eve_transport *transport;
+static eve_audio_format_t format;
+static eve_audio_pull_t pull;
+static bool synced;
+static uint32_t write_pos; // in the ring, of the sample after the last one written
+static uint32_t play_pos;  // where the EVE was at the last turn
+static uint32_t queued;    // samples written that it hasn't played
+static struct eve_audio_stats stats;
+
+static int16_t pulled[EVE_AUDIO_MAX_CHUNK * 2];
+// in turn, the transport may still send from them
+static uint8_t chunks[EVE_TRANSPORT_BUFFERS][CHUNK_SIZE];
+static uint8_t next_chunk;
+
+static uint8_t
+ulaw(int16_t sample)
+{
+	// a sign, a 3 bit exponent and a 4 bit mantissa, inverted
+	int32_t value = sample;
+	uint8_t sign = 0;
+	if (value < 0) {
+		value = -value;
+		sign = 0x80;
+	}
+	value = MIN(value, 32635) + 0x84;
+	uint8_t exponent = 7;
+	for (int32_t mask = 0x4000; !(value & mask) && exponent > 0; mask >>= 1) {
+		exponent--;
+	}
+	uint8_t mantissa = (value >> (exponent + 3)) & 0x0f;
+	return ~(sign | exponent << 4 | mantissa);
+}
+
+uint8_t
+eve_audio_encode(eve_audio_format_t format, int16_t sample)
+{
+	if (format == EVE_AUDIO_ULAW) {
+		return ulaw(sample);
+	}
+	return (uint8_t)(sample >> 8);
+}
+
+// A write that goes past the end of the ring continues at its start
+static void
+write_ring(uint32_t pos, const uint8_t *data, uint32_t length)
+{
+	const uint32_t n = MIN(length, EVE_DISPLAY_AUDIO_SIZE - pos);
+	transport->mem_write(transport->ctx, EVE_DISPLAY_AUDIO_RING + pos, data, n);
+	if (length > n) {
+		transport->mem_write(transport->ctx, EVE_DISPLAY_AUDIO_RING, data + n, length - n);
+	}
+}
+
+bool
+eve_audio_init(const struct eve_transport *t, eve_audio_format_t f, uint16_t rate, eve_audio_pull_t p)
+{
+	if (!t->play || !t->play_position) {
+		return false;
+	}
+	transport = t;
+	format = f;
+	pull = p;
+	synced = false;
+	queued = 0;
+	memset(&stats, 0, sizeof(stats));
+
+	// the same silence every time, it doesn't matter when it is sent
+	uint8_t *silence = chunks[0];
+	memset(silence, eve_audio_encode(format, 0), CHUNK_SIZE);
+	for (uint32_t pos = 0; pos < EVE_DISPLAY_AUDIO_SIZE; pos += CHUNK_SIZE) {
+		write_ring(pos, silence, MIN(CHUNK_SIZE, EVE_DISPLAY_AUDIO_SIZE - pos));
+	}
+	next_chunk = 1;
+	transport->play(transport->ctx, EVE_DISPLAY_AUDIO_RING, EVE_DISPLAY_AUDIO_SIZE, rate, format);
+	return true;
+}
+
+void
+eve_audio_service(void)
+{
+	if (!transport) {
+		return;
+	}
+	const uint32_t pos = (transport->play_position(transport->ctx) - EVE_DISPLAY_AUDIO_RING) & RING_MASK;
+	const uint32_t played = (pos - play_pos) & RING_MASK;
+	play_pos = pos;
+
+	uint32_t lead = 0;
+	if (!synced || played > queued) {
+		// It got past the samples into the silence behind them (or it has
+		// just started): the next ones go a little ahead of it
+		if (synced) {
+			stats.underruns++;
+		}
+		synced = true;
+		write_pos = pos;
+		queued = 0;
+		lead = EVE_AUDIO_LEAD;
+	} else {
+		queued -= played;
+	}
+
+	uint32_t count = EVE_AUDIO_TARGET > queued + lead ? EVE_AUDIO_TARGET - queued - lead : 0;
+	count = MIN(count, EVE_AUDIO_MAX_CHUNK);
+	if (!lead && count < EVE_AUDIO_MIN_CHUNK) {
+		return;
+	}
+	pull(pulled, count);
+
+	uint8_t *chunk = chunks[next_chunk];
+	next_chunk = (next_chunk + 1) % EVE_TRANSPORT_BUFFERS;
+	const uint8_t silence = eve_audio_encode(format, 0);
+	memset(chunk, silence, lead);
+	for (uint32_t i = 0; i < count; i++) {
+		chunk[lead + i] = eve_audio_encode(format, (pulled[i * 2] + pulled[i * 2 + 1]) >> 1);
+	}
+	memset(chunk + lead + count, silence, EVE_AUDIO_PAD);
+	write_ring(write_pos, chunk, lead + count + EVE_AUDIO_PAD);
+
+	write_pos = (write_pos + lead + count) & RING_MASK;
+	queued += lead + count;
+	stats.samples += count;
+}
+
+void
+eve_audio_get_stats(struct eve_audio_stats *s)
+{
+	*s = stats;
+}
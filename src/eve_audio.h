@@ -0,0 +1,70 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#ifndef _EVE_AUDIO_H_
+#define _EVE_AUDIO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "eve_display.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The audio on the EVE's speaker output: the mix goes into a ring in
+// RAM_G (EVE_DISPLAY_AUDIO_RING), which the EVE plays in a loop. Where it
+// is playing says how much can be written. The EVE only plays 8 bit mono,
+// the stereo mix is downmixed and encoded to one of these
+// (REG_PLAYBACK_FORMAT):
+typedef enum {
+	EVE_AUDIO_LINEAR = 0, // signed 8 bit
+	EVE_AUDIO_ULAW   = 1, // G.711 µ-law, about 14 bits of range
+} eve_audio_format_t;
+
+// The EVE plays 8 to 48 kHz
+#define EVE_AUDIO_RATE 48000
+
+// Samples that are kept ahead of the EVE, enough for the longest
+// display transfer (a frame's swap)
+#define EVE_AUDIO_TARGET    2048
+// Samples written at once at most, so that a turn of the audio between
+// display transfers is short, and at least, unless it is behind
+#define EVE_AUDIO_MAX_CHUNK 1024
+#define EVE_AUDIO_MIN_CHUNK 64
+// Silence after the samples, played if the next turn is late
+#define EVE_AUDIO_PAD       256
+// Silence before the samples when the EVE got past them, for the time
+// that the write takes
+#define EVE_AUDIO_LEAD      64
+// A turn is due this often even without display transfers
+#define EVE_AUDIO_PERIOD_MS 10
+
+// count stereo samples, like audio_pull()
+typedef void (*eve_audio_pull_t)(int16_t *samples, uint32_t count);
+
+struct eve_audio_stats {
+	uint32_t underruns; // the EVE got past the samples written
+	uint64_t samples;   // pulled and written
+};
+
+// Fills the ring with silence and starts the playback. false if the
+// transport can't play.
+bool eve_audio_init(const struct eve_transport *transport, eve_audio_format_t format, uint16_t rate, eve_audio_pull_t pull);
+
+// A turn of the audio: writes what the EVE has played since the last
+// one, EVE_AUDIO_MAX_CHUNK samples at most. The caller owns the
+// transport. If turns are more than the ring (a third of a second)
+// apart, the EVE's lap goes unnoticed.
+void eve_audio_service(void);
+
+void eve_audio_get_stats(struct eve_audio_stats *stats);
+
+uint8_t eve_audio_encode(eve_audio_format_t format, int16_t sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
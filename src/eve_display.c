@@ -0,0 +1,116 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#include <zlib.h>
+#include "eve_display.h"
+
+// Fast compression with a small window: the lines compress well anyway,
+// and the deflate state stays small on the ESP32.
+#define DEFLATE_LEVEL 1
+#define DEFLATE_WINDOW_BITS 12
+#define DEFLATE_MEM_LEVEL 6
+
+// CMD_INFLATE and its address, and padding to 32 bits
+#define INFLATE_OVERHEAD 12
+
+#define MAX_REGION (EVE_DISPLAY_MAX_ROWS * EVE_DISPLAY_WIDTH)
+
+static z_stream deflate_stream;
+static bool deflate_ready;
+static uint8_t deflate_buffer[MAX_REGION];
+
+// Compresses a region into deflate_buffer. Returns the size, or 0 if
+// that wouldn't save anything.
+static uint32_t
+deflate_region(const uint8_t *data, uint32_t length)
+{
+	if (!deflate_ready) {
+		if (deflateInit2(&deflate_stream, DEFLATE_LEVEL, Z_DEFLATED, DEFLATE_WINDOW_BITS, DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+			return 0;
+		}
+		deflate_ready = true;
+	} else {
+		deflateReset(&deflate_stream);
+	}
+	if (length <= INFLATE_OVERHEAD) {
+		return 0;
+	}
+
+	// Output space for less than the raw size only: deflate gives up
+	// early on data that doesn't compress.
+	deflate_stream.next_in = (Bytef *)data;
+	deflate_stream.avail_in = length;
+	deflate_stream.next_out = deflate_buffer;
+	deflate_stream.avail_out = length - INFLATE_OVERHEAD;
+	if (deflate(&deflate_stream, Z_FINISH) != Z_STREAM_END) {
+		return 0;
+	}
+	return deflate_stream.total_out;
+}
+
+static void
+send_region(const struct eve_transport *transport, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	if (transport->inflate) {
+		const uint32_t compressed = deflate_region(data, length);
+		if (compressed) {
+			transport->inflate(transport->ctx, address, deflate_buffer, compressed);
+			return;
+		}
+	}
+	transport->mem_write(transport->ctx, address, data, length);
+}
+
+static bool
+line_is_dirty(const uint32_t *dirty_lines, uint16_t y)
+{
+	return (dirty_lines[y >> 5] >> (y & 31)) & 1;
+}
+
+void
+eve_display_send(const struct eve_transport *transport, uint8_t buffer, const uint8_t *pixels, const uint16_t *palette, const uint32_t *dirty_lines, bool palette_dirty, bool half)
+{
+	const uint16_t width = half ? EVE_DISPLAY_HALF_WIDTH : EVE_DISPLAY_WIDTH;
+	const uint16_t height = half ? EVE_DISPLAY_HALF_HEIGHT : EVE_DISPLAY_HEIGHT;
+
+	if (palette_dirty) {
+		eve_display_send_palette(transport, buffer, palette);
+	}
+
+	// Runs of changed lines are contiguous in both framebuffers,
+	// so each is one write.
+	uint16_t y = 0;
+	while (y < height) {
+		if (!line_is_dirty(dirty_lines, y)) {
+			y++;
+			continue;
+		}
+		uint16_t y_end = y + 1;
+		while (y_end < height && y_end - y < EVE_DISPLAY_MAX_ROWS && line_is_dirty(dirty_lines, y_end)) {
+			y_end++;
+		}
+
+		const uint32_t offset = (uint32_t)y * width;
+		send_region(transport, EVE_DISPLAY_BITMAP(buffer) + offset, pixels + offset, (uint32_t)(y_end - y) * width);
+		y = y_end;
+	}
+}
+
+void
+eve_display_send_lines(const struct eve_transport *transport, uint8_t buffer, uint16_t y, const uint8_t *pixels, uint16_t count)
+{
+	send_region(transport, EVE_DISPLAY_BITMAP(buffer) + (uint32_t)y * EVE_DISPLAY_WIDTH, pixels, (uint32_t)count * EVE_DISPLAY_WIDTH);
+}
+
+void
+eve_display_send_line_part(const struct eve_transport *transport, uint8_t buffer, uint16_t y, uint16_t x, const uint8_t *pixels, uint16_t width)
+{
+	send_region(transport, EVE_DISPLAY_BITMAP(buffer) + (uint32_t)y * EVE_DISPLAY_WIDTH + x, pixels, width);
+}
+
+void
+eve_display_send_palette(const struct eve_transport *transport, uint8_t buffer, const uint16_t *palette)
+{
+	transport->mem_write(transport->ctx, EVE_DISPLAY_PALETTE(buffer), (const uint8_t *)palette, 256 * sizeof(*palette));
+}
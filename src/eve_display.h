@@ -0,0 +1,85 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#ifndef _EVE_DISPLAY_H_
+#define _EVE_DISPLAY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EVE_DISPLAY_WIDTH   640
+#define EVE_DISPLAY_HEIGHT  480
+// the panel shows every line twice
+#define EVE_DISPLAY_Y_SCALE 2
+
+// Layout of the EVE's RAM_G: two RGB565 palettes, then two 8 bit
+// paletted framebuffers. One buffer is shown while the other is updated.
+#define EVE_DISPLAY_BUFFERS 2
+#define EVE_DISPLAY_PALETTE(buffer) (0x0000 + (buffer) * 0x200)
+#define EVE_DISPLAY_BITMAP(buffer)  (0x1000 + (buffer) * EVE_DISPLAY_WIDTH * EVE_DISPLAY_HEIGHT)
+
+// The top of RAM_G is the ring that the EVE plays the audio from
+#define EVE_DISPLAY_AUDIO_SIZE 0x4000
+#define EVE_DISPLAY_AUDIO_RING (0x100000 - EVE_DISPLAY_AUDIO_SIZE)
+
+// In 320x240 modes, a buffer can hold a half resolution bitmap instead,
+// which the EVE scales up 2x.
+#define EVE_DISPLAY_HALF_WIDTH  (EVE_DISPLAY_WIDTH / 2)
+#define EVE_DISPLAY_HALF_HEIGHT (EVE_DISPLAY_HEIGHT / 2)
+
+// one bit per line
+#define EVE_DISPLAY_DIRTY_WORDS (EVE_DISPLAY_HEIGHT / 32)
+
+// lines per memory write at most
+#define EVE_DISPLAY_MAX_ROWS 32
+
+// mem_write() may return before it has read the data: the ESP32 queues
+// up to this many writes and sends them from their buffers later. A
+// buffer that is filled again for every write has to be one of
+// EVE_TRANSPORT_BUFFERS, used in turn.
+#define EVE_TRANSPORT_QUEUE_DEPTH 4
+#define EVE_TRANSPORT_BUFFERS (EVE_TRANSPORT_QUEUE_DEPTH + 1)
+
+// How data gets to the EVE: SPI on the ESP32, a mock on the host
+struct eve_transport {
+	// write length bytes from data to address in RAM_G, see above
+	void (*mem_write)(void *ctx, uint32_t address, const uint8_t *data, uint32_t length);
+	// have the coprocessor inflate a zlib stream to address (CMD_INFLATE),
+	// optional
+	void (*inflate)(void *ctx, uint32_t address, const uint8_t *data, uint32_t length);
+	// switch the display to a buffer with CMD_SWAP, returns once it is shown
+	void (*show)(void *ctx, uint8_t buffer, bool half);
+	// write a display list to RAM_DL and swap it in at the next frame,
+	// returns once it is shown
+	void (*show_list)(void *ctx, const uint32_t *dl, uint16_t length);
+	// play length bytes from address over and over, rate samples per
+	// second in a REG_PLAYBACK_FORMAT format, optional
+	void (*play)(void *ctx, uint32_t address, uint32_t length, uint16_t rate, uint8_t format);
+	// the address that is played next (REG_PLAYBACK_READPTR)
+	uint32_t (*play_position)(void *ctx);
+	void *ctx;
+};
+
+// Sends the palette (256 RGB565 entries) if it is dirty and the dirty
+// lines of pixels into a buffer in RAM_G, compressed where that makes
+// them smaller and the transport can inflate. With half, pixels and
+// dirty_lines are at half resolution.
+void eve_display_send(const struct eve_transport *transport, uint8_t buffer, const uint8_t *pixels, const uint16_t *palette, const uint32_t *dirty_lines, bool palette_dirty, bool half);
+
+// Sends count full resolution lines starting at line y, at most
+// EVE_DISPLAY_MAX_ROWS
+void eve_display_send_lines(const struct eve_transport *transport, uint8_t buffer, uint16_t y, const uint8_t *pixels, uint16_t count);
+// Sends width pixels of line y, starting at x
+void eve_display_send_line_part(const struct eve_transport *transport, uint8_t buffer, uint16_t y, uint16_t x, const uint8_t *pixels, uint16_t width);
+void eve_display_send_palette(const struct eve_transport *transport, uint8_t buffer, const uint16_t *palette);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
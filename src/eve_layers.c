@@ -0,0 +1,924 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#include <stdlib.h>
+#include <string.h>
+#include "eve_layers.h"
+
+#define VRAM_SIZE 0x20000
+
+#define SCREEN_WIDTH  EVE_DISPLAY_WIDTH
+#define SCREEN_HEIGHT EVE_DISPLAY_HEIGHT
+
+// Layout of the palettes image. VERA's 12 bit colors fit PALETTED4444
+// exactly, and entry 0 is transparent everywhere.
+// The palette offset of a tile applies to colors 1-15 only,
+#define TILE_PALETTE(offset)    ((offset) * 512)
+// that of a sprite to all colors but 0.
+#define SPRITE_PALETTE(offset)  (16 * 512 + (offset) * 512)
+// In text mode, the two colors of every attribute byte.
+#define TEXT_PALETTE(attr)      (32 * 512 + (attr) * 4)
+#define TEXT_256C_PALETTE(attr) (32 * 512 + 256 * 4 + (attr) * 4)
+#define PALETTES_SIZE           (32 * 512 + 2 * 256 * 4)
+
+// The color that runs of text are drawn in is reset to this for the
+// paletted bitmaps, which it would tint otherwise
+#define WHITE 0xFFFFFF
+
+// A layer has up to 1024 tiles, a bitmap handle 128 cells
+#define LAYER_HANDLES 8
+#define SPRITE_HANDLE (2 * LAYER_HANDLES)
+
+// VERA's sprite renderer has 800 clocks per line
+#define SPRITE_BUDGET 800
+
+// END and DISPLAY
+#define DL_RESERVE 2
+
+// VERTEX2II reaches this far from the origin
+#define VERTEX_MAX 511
+// and BITMAP_SIZE draws this wide
+#define BITMAP_SIZE_MAX 511
+
+// A run of text takes its source, a vertex, and mostly a new size or color
+#define RUN_WORDS 3
+
+// What the pixels of a tile are, found out when it is first needed
+#define TILE_UNKNOWN 0
+#define TILE_MIXED   1
+#define TILE_CLEAR   2 // all 0
+#define TILE_SET     3 // all 1, in text mode
+
+struct layer {
+	bool text;
+	bool text_256c;
+	uint8_t bpp;
+	uint8_t tilew_log2;
+	uint8_t tileh_log2;
+	uint8_t mapw_log2;
+	uint8_t maph_log2;
+	uint32_t map_base;
+	uint32_t tile_base;
+	uint16_t hscroll;
+	uint16_t vscroll;
+	int16_t max_tile; // of the visible cells, -1 if there are none
+	uint32_t cell_words;
+	const struct eve_layers_image *image;
+	uint8_t kinds[1024];
+};
+
+struct sprite {
+	int16_t x;
+	int16_t y;
+	uint8_t width;
+	uint8_t height;
+	uint8_t z;
+	uint8_t bpp;
+	uint8_t palette_offset;
+	bool hflip;
+	bool vflip;
+	uint32_t source;
+	const struct eve_layers_image *image;
+};
+
+struct builder {
+	const struct eve_layers_state *state;
+	struct eve_layers_frame *frame;
+	bool dl_full;
+	bool ram_full;
+	uint32_t ram;
+	uint32_t ram_end;
+	uint32_t palettes;
+
+	// the active area in display pixels, and in layer pixels
+	uint16_t hstart;
+	uint16_t hstop;
+	uint16_t vstart;
+	uint16_t vstop;
+	uint16_t width;
+	uint16_t height;
+	// display pixels per layer pixel
+	uint8_t sx;
+	uint8_t sy;
+
+	// graphics state, only sent when it changes
+	uint8_t handle;
+	uint32_t color;
+	uint32_t palette;
+	int32_t transform_a;
+	int32_t transform_c;
+	int32_t transform_e;
+	int32_t transform_f;
+	int32_t translate_x;
+	int32_t translate_y;
+	const struct eve_layers_image *sprite_image;
+
+	struct layer layers[2];
+	struct sprite sprites[128];
+	uint16_t sprite_cost[SCREEN_HEIGHT + 1];
+};
+
+static struct builder builder;
+
+// the region of RAM_G the next frame's images go to
+static uint8_t region;
+
+static uint32_t
+command(uint8_t op, uint32_t arg)
+{
+	return (uint32_t)op << 24 | arg;
+}
+
+static void
+emit(struct builder *b, uint32_t word)
+{
+	if (b->frame->dl_length >= EVE_LAYERS_DL_WORDS - DL_RESERVE) {
+		b->dl_full = true;
+		return;
+	}
+	b->frame->dl[b->frame->dl_length++] = word;
+}
+
+static uint32_t
+rgb(const uint8_t *palette, uint8_t index)
+{
+	const uint8_t lo = palette[index * 2];
+	const uint8_t hi = palette[index * 2 + 1];
+	return (uint32_t)(hi & 15) * 17 << 16 | (lo >> 4) * 17 << 8 | (lo & 15) * 17;
+}
+
+static struct eve_layers_image *
+add_image(struct builder *b, eve_layers_image_t type, uint8_t bpp, uint8_t width, uint8_t height, uint16_t count, uint32_t source)
+{
+	uint32_t length = (uint32_t)width * height * count;
+	if (type == EVE_LAYERS_PALETTES) {
+		length = PALETTES_SIZE;
+	} else if (type == EVE_LAYERS_TEXT) {
+		// two planes of 1 bit per pixel
+		length /= 4;
+	}
+	if (b->ram + length > b->ram_end) {
+		b->ram_full = true;
+		return NULL;
+	}
+	struct eve_layers_image *image = &b->frame->images[b->frame->image_count++];
+	memset(image, 0, sizeof(*image));
+	image->type = type;
+	image->bpp = bpp;
+	image->width = width;
+	image->height = height;
+	image->count = count;
+	image->source = source;
+	image->address = b->ram;
+	image->length = length;
+	b->ram += (length + 3) & ~3;
+	return image;
+}
+
+static void
+set_handle(struct builder *b, uint8_t handle)
+{
+	if (b->handle != handle) {
+		b->handle = handle;
+		emit(b, command(EVE_DL_BITMAP_HANDLE, handle));
+	}
+}
+
+static void
+set_color(struct builder *b, uint32_t color)
+{
+	if (b->color != color) {
+		b->color = color;
+		emit(b, command(EVE_DL_COLOR_RGB, color));
+	}
+}
+
+static void
+set_palette(struct builder *b, uint32_t address)
+{
+	if (b->palette != address) {
+		b->palette = address;
+		emit(b, command(EVE_DL_PALETTE_SOURCE, address));
+	}
+}
+
+static void
+set_transform(struct builder *b, uint8_t op, int32_t *current, int32_t value)
+{
+	if (*current != value) {
+		*current = value;
+		emit(b, command(op, value & 0x1FFFF));
+	}
+}
+
+// Scales a bitmap of width x height pixels to the layer size, and
+// mirrors it where VERA flips it. A mirrored bitmap is sampled from
+// just inside its far edge.
+static void
+set_flip(struct builder *b, uint8_t width, uint8_t height, bool hflip, bool vflip)
+{
+	const int32_t a = 256 / b->sx;
+	const int32_t e = 256 / (b->sy * b->state->y_scale);
+	set_transform(b, EVE_DL_BITMAP_TRANSFORM_A, &b->transform_a, hflip ? -a : a);
+	set_transform(b, EVE_DL_BITMAP_TRANSFORM_C, &b->transform_c, hflip ? width * 256 - 16 : 0);
+	set_transform(b, EVE_DL_BITMAP_TRANSFORM_E, &b->transform_e, vflip ? -e : e);
+	set_transform(b, EVE_DL_BITMAP_TRANSFORM_F, &b->transform_f, vflip ? height * 256 - 16 : 0);
+}
+
+// Draws a cell at (x, y) in display pixels. VERTEX2II only reaches
+// 511 pixels from the origin, which is moved along where needed.
+static void
+vertex(struct builder *b, int32_t x, int32_t y, uint8_t handle, uint8_t cell)
+{
+	if (x < b->translate_x || x > b->translate_x + VERTEX_MAX) {
+		b->translate_x = x;
+		emit(b, command(EVE_DL_VERTEX_TRANSLATE_X, (x * 16) & 0x1FFFF));
+	}
+	if (y < b->translate_y || y > b->translate_y + VERTEX_MAX) {
+		b->translate_y = y;
+		emit(b, command(EVE_DL_VERTEX_TRANSLATE_Y, (y * 16) & 0x1FFFF));
+	}
+	emit(b, EVE_DL_VERTEX2II | (uint32_t)(x - b->translate_x) << 21 | (uint32_t)(y - b->translate_y) << 12 | handle << 7 | cell);
+}
+
+static uint32_t
+tile_size(const struct layer *layer)
+{
+	return (1 << (layer->tilew_log2 + layer->tileh_log2)) * layer->bpp / 8;
+}
+
+static uint8_t
+tile_kind(const struct builder *b, struct layer *layer, uint16_t tile)
+{
+	if (layer->kinds[tile] == TILE_UNKNOWN) {
+		const uint32_t size = tile_size(layer);
+		const uint32_t start = layer->tile_base + tile * size;
+		bool clear = true;
+		bool set = layer->text;
+		for (uint32_t i = 0; i < size; i++) {
+			const uint8_t byte = b->state->vram[(start + i) & (VRAM_SIZE - 1)];
+			clear &= byte == 0;
+			set &= byte == 0xff;
+		}
+		layer->kinds[tile] = clear ? TILE_CLEAR : set ? TILE_SET : TILE_MIXED;
+	}
+	return layer->kinds[tile];
+}
+
+static bool
+layer_init(struct layer *layer, const uint8_t *regs)
+{
+	if (regs[0] & 4) {
+		// bitmap mode
+		return false;
+	}
+	layer->text = (regs[0] & 3) == 0;
+	layer->text_256c = (regs[0] & 8) != 0;
+	layer->bpp = 1 << (regs[0] & 3);
+	layer->mapw_log2 = 5 + ((regs[0] >> 4) & 3);
+	layer->maph_log2 = 5 + ((regs[0] >> 6) & 3);
+	layer->map_base = regs[1] << 9;
+	layer->tile_base = (regs[2] & 0xFC) << 9;
+	layer->tilew_log2 = 3 + (regs[2] & 1);
+	layer->tileh_log2 = 3 + ((regs[2] >> 1) & 1);
+	layer->hscroll = regs[3] | (regs[4] & 0xf) << 8;
+	layer->vscroll = regs[5] | (regs[6] & 0xf) << 8;
+	layer->max_tile = -1;
+	layer->cell_words = 0;
+	layer->image = NULL;
+	memset(layer->kinds, TILE_UNKNOWN, sizeof(layer->kinds));
+	return true;
+}
+
+// Goes through the map cells that are at least partly visible and
+// draws those that aren't transparent. Without draw, it only finds the
+// highest tile they use, and about how many words drawing them takes.
+static void
+layer_cells(struct builder *b, struct layer *layer, uint8_t handle, bool draw)
+{
+	const uint8_t *vram = b->state->vram;
+	const int32_t tilew = 1 << layer->tilew_log2;
+	const int32_t tileh = 1 << layer->tileh_log2;
+	const uint32_t layerw_max = (1 << (layer->mapw_log2 + layer->tilew_log2)) - 1;
+	const uint32_t layerh_max = (1 << (layer->maph_log2 + layer->tileh_log2)) - 1;
+	const uint32_t x0 = layer->hscroll & layerw_max;
+	const uint32_t y0 = layer->vscroll & layerh_max;
+	uint32_t last_palette = -1;
+
+	for (int32_t ly = -(int32_t)(y0 & (tileh - 1)); ly < b->height && !b->dl_full; ly += tileh) {
+		const uint32_t row = ((y0 + ly) & layerh_max) >> layer->tileh_log2;
+		for (int32_t lx = -(int32_t)(x0 & (tilew - 1)); lx < b->width; lx += tilew) {
+			const uint32_t col = ((x0 + lx) & layerw_max) >> layer->tilew_log2;
+			const uint32_t map = layer->map_base + (((row << layer->mapw_log2) + col) << 1);
+			const uint8_t byte0 = vram[map & (VRAM_SIZE - 1)];
+			const uint8_t byte1 = vram[(map + 1) & (VRAM_SIZE - 1)];
+
+			uint16_t tile;
+			uint32_t palette;
+			bool transparent;
+			if (layer->text) {
+				const uint8_t fg = layer->text_256c ? byte1 : byte1 & 15;
+				const uint8_t bg = layer->text_256c ? 0 : byte1 >> 4;
+				tile = byte0;
+				const uint8_t kind = tile_kind(b, layer, tile);
+				transparent = (kind == TILE_SET || bg == 0) && (kind == TILE_CLEAR || fg == 0);
+				palette = layer->text_256c ? TEXT_256C_PALETTE(byte1) : TEXT_PALETTE(byte1);
+			} else {
+				tile = byte0 | (byte1 & 3) << 8;
+				transparent = tile_kind(b, layer, tile) == TILE_CLEAR;
+				palette = TILE_PALETTE(byte1 >> 4);
+			}
+			if (transparent) {
+				continue;
+			}
+			if (!draw) {
+				if (tile > layer->max_tile) {
+					layer->max_tile = tile;
+				}
+				// a vertex, and a palette where it changes
+				layer->cell_words += 1 + (palette != last_palette);
+				last_palette = palette;
+				continue;
+			}
+
+			set_palette(b, b->palettes + palette);
+			set_flip(b, tilew, tileh, !layer->text && (byte1 & 4), !layer->text && (byte1 & 8));
+			vertex(b, b->hstart + lx * b->sx, (b->vstart + ly * b->sy) * b->state->y_scale, handle + (tile >> 7), tile & 127);
+		}
+	}
+}
+
+// The map entry of a cell of a text image
+static uint32_t
+text_cell(const struct eve_layers_image *image, uint32_t r, uint32_t c)
+{
+	const uint32_t row = (image->row + r) & ((1 << image->map_height_log2) - 1);
+	const uint32_t column = (image->column + c) & ((1 << image->map_width_log2) - 1);
+	return image->map + (((row << image->map_width_log2) + column) << 1);
+}
+
+// The image of the cells of a text layer that are at least partly
+// visible, without its place in RAM_G
+static void
+text_image(const struct builder *b, const struct layer *layer, struct eve_layers_image *image)
+{
+	const uint32_t tilew = 1 << layer->tilew_log2;
+	const uint32_t tileh = 1 << layer->tileh_log2;
+	const uint32_t x0 = layer->hscroll & ((1 << (layer->mapw_log2 + layer->tilew_log2)) - 1);
+	const uint32_t y0 = layer->vscroll & ((1 << (layer->maph_log2 + layer->tileh_log2)) - 1);
+	memset(image, 0, sizeof(*image));
+	image->type = EVE_LAYERS_TEXT;
+	image->bpp = 1;
+	image->width = tilew;
+	image->height = tileh;
+	image->source = layer->tile_base;
+	image->map = layer->map_base;
+	image->map_width_log2 = layer->mapw_log2;
+	image->map_height_log2 = layer->maph_log2;
+	image->column = x0 >> layer->tilew_log2;
+	image->row = y0 >> layer->tileh_log2;
+	image->columns = ((x0 & (tilew - 1)) + b->width + tilew - 1) >> layer->tilew_log2;
+	image->rows = ((y0 & (tileh - 1)) + b->height + tileh - 1) >> layer->tileh_log2;
+	image->count = image->columns * image->rows;
+}
+
+static const struct eve_layers_image *
+add_text(struct builder *b, const struct eve_layers_image *text)
+{
+	struct eve_layers_image *image = add_image(b, EVE_LAYERS_TEXT, 1, text->width, text->height, text->count, text->source);
+	if (image) {
+		image->map = text->map;
+		image->map_width_log2 = text->map_width_log2;
+		image->map_height_log2 = text->map_height_log2;
+		image->column = text->column;
+		image->row = text->row;
+		image->columns = text->columns;
+		image->rows = text->rows;
+	}
+	return image;
+}
+
+// Draws the cells of a row from first to end in one color, from the
+// image's pixels for the foreground, or its inverted ones for the
+// background
+static void
+text_run(struct builder *b, const struct layer *layer, uint8_t handle, bool background, uint32_t r, uint32_t first, uint32_t end, uint8_t color, uint32_t *size)
+{
+	const struct eve_layers_image *image = layer->image;
+	const uint32_t stride = image->columns * image->width / 8;
+	set_color(b, rgb(b->state->palette, color));
+	emit(b, command(EVE_DL_BITMAP_SOURCE, image->address + (background ? image->length / 2 : 0) + r * image->height * stride + first * image->width / 8));
+	const uint32_t width = (end - first) * image->width * b->sx;
+	if (*size != width) {
+		*size = width;
+		emit(b, command(EVE_DL_BITMAP_SIZE, width << 9 | image->height * b->sy * b->state->y_scale));
+	}
+	const int32_t x = first * image->width - (layer->hscroll & (image->width - 1));
+	const int32_t y = r * image->height - (layer->vscroll & (image->height - 1));
+	vertex(b, b->hstart + x * b->sx, (b->vstart + y * b->sy) * b->state->y_scale, handle, 0);
+}
+
+// Goes through the rows of a text image for the background, then the
+// foreground, in runs of cells of the same color; a cell without pixels
+// of the kind drawn doesn't end a run. Without draw, it only counts the
+// runs.
+static uint32_t
+text_runs(struct builder *b, struct layer *layer, const struct eve_layers_image *image, uint8_t handle, bool draw)
+{
+	const uint8_t *vram = b->state->vram;
+	const uint32_t max_run = BITMAP_SIZE_MAX / (image->width * b->sx);
+	uint32_t runs = 0;
+	uint32_t size = 0;
+
+	if (draw) {
+		set_handle(b, handle);
+		emit(b, command(EVE_DL_BITMAP_LAYOUT, EVE_DL_L1 << 19 | (image->columns * image->width / 8) << 9 | image->height));
+		set_flip(b, image->width, image->height, false, false);
+	}
+	for (uint8_t pass = layer->text_256c ? 1 : 0; pass < 2; pass++) {
+		const bool background = pass == 0;
+		for (uint32_t r = 0; r < image->rows && !b->dl_full; r++) {
+			// the run so far, of color 0 if there is none
+			uint8_t color = 0;
+			uint32_t first = 0;
+			uint32_t end = 0;
+			for (uint32_t c = 0; c <= image->columns; c++) {
+				uint8_t cell_color = 0;
+				if (c < image->columns) {
+					const uint32_t map = text_cell(image, r, c);
+					const uint8_t attr = vram[(map + 1) & (VRAM_SIZE - 1)];
+					const uint8_t kind = tile_kind(b, layer, vram[map & (VRAM_SIZE - 1)]);
+					if (kind == (background ? TILE_SET : TILE_CLEAR)) {
+						continue;
+					}
+					cell_color = background ? attr >> 4 : layer->text_256c ? attr : attr & 15;
+				}
+				if (color && cell_color == color && c + 1 - first <= max_run) {
+					end = c + 1;
+					continue;
+				}
+				if (color) {
+					runs++;
+					if (draw) {
+						text_run(b, layer, handle, background, r, first, end, color, &size);
+					}
+				}
+				color = cell_color;
+				first = c;
+				end = c + 1;
+			}
+		}
+	}
+	return runs;
+}
+
+static void
+draw_layer(struct builder *b, uint8_t l)
+{
+	struct layer *layer = &b->layers[l];
+	if (!layer->image) {
+		return;
+	}
+	const uint8_t handle = l * LAYER_HANDLES;
+	if (layer->image->type == EVE_LAYERS_TEXT) {
+		text_runs(b, layer, layer->image, handle, true);
+		return;
+	}
+	set_color(b, WHITE);
+	const uint32_t tilew = 1 << layer->tilew_log2;
+	const uint32_t tileh = 1 << layer->tileh_log2;
+	for (uint8_t h = 0; h <= layer->max_tile >> 7; h++) {
+		set_handle(b, handle + h);
+		emit(b, command(EVE_DL_BITMAP_SOURCE, layer->image->address + h * 128 * tilew * tileh));
+		emit(b, command(EVE_DL_BITMAP_LAYOUT, EVE_DL_PALETTED4444 << 19 | tilew << 9 | tileh));
+		emit(b, command(EVE_DL_BITMAP_SIZE, tilew * b->sx << 9 | tileh * b->sy * b->state->y_scale));
+	}
+	layer_cells(b, layer, handle, true);
+}
+
+static void
+read_sprite(struct sprite *sprite, const uint8_t *attr)
+{
+	sprite->z = (attr[6] >> 2) & 3;
+	sprite->x = attr[2] | (attr[3] & 3) << 8;
+	sprite->y = attr[4] | (attr[5] & 3) << 8;
+	sprite->width = 1 << (((attr[7] >> 4) & 3) + 3);
+	sprite->height = 1 << ((attr[7] >> 6) + 3);
+	// negative coordinates
+	if (sprite->x >= 0x400 - sprite->width) {
+		sprite->x -= 0x400;
+	}
+	if (sprite->y >= 0x400 - sprite->height) {
+		sprite->y -= 0x400;
+	}
+	sprite->hflip = attr[6] & 1;
+	sprite->vflip = (attr[6] >> 1) & 1;
+	sprite->bpp = attr[1] & 0x80 ? 8 : 4;
+	sprite->source = attr[0] << 5 | (attr[1] & 0xf) << 13;
+	sprite->palette_offset = attr[7] & 0xf;
+	sprite->image = NULL;
+}
+
+// The clocks VERA spends on a sprite per line: one per pixel that is
+// on the line buffer, and one per 32 bits fetched
+static uint16_t
+sprite_cost(const struct sprite *sprite)
+{
+	uint16_t cost = 0;
+	for (int16_t sx = 0; sx < sprite->width; sx++) {
+		if (sprite->x + sx >= 0 && sprite->x + sx < SCREEN_WIDTH) {
+			cost += (sx & 3) ? 1 : 2;
+		}
+	}
+	return cost;
+}
+
+// An 8 bpp sprite whose palette offset takes a color to 0 covers the
+// sprites below with a transparent pixel, which the EVE can't draw
+static bool
+sprite_wraps(const struct builder *b, const struct sprite *sprite)
+{
+	if (sprite->bpp != 8 || !sprite->palette_offset) {
+		return false;
+	}
+	const uint8_t wrapping = 256 - (sprite->palette_offset << 4);
+	const uint32_t size = sprite->width * sprite->height;
+	for (uint32_t i = 0; i < size; i++) {
+		if (b->state->vram[(sprite->source + i) & (VRAM_SIZE - 1)] == wrapping) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Reads the sprites, and finds the images of the visible ones
+static eve_layers_result_t
+sprites_init(struct builder *b)
+{
+	uint16_t *cost = b->sprite_cost;
+	memset(cost, 0, sizeof(b->sprite_cost));
+	for (int i = 0; i < 128; i++) {
+		struct sprite *sprite = &b->sprites[i];
+		read_sprite(sprite, b->state->sprites + i * 8);
+		if (!sprite->z) {
+			continue;
+		}
+		const int16_t y0 = sprite->y > 0 ? sprite->y : 0;
+		const int16_t y1 = sprite->y + sprite->height < b->height ? sprite->y + sprite->height : b->height;
+		if (y0 < y1) {
+			const uint16_t c = sprite_cost(sprite);
+			cost[y0] += c;
+			cost[y1] -= c;
+		}
+		if (sprite->x >= b->width || sprite->x + sprite->width <= 0 || y0 >= y1) {
+			continue;
+		}
+		if (sprite_wraps(b, sprite)) {
+			return EVE_LAYERS_UNSUPPORTED;
+		}
+
+		// sprites that share their pixels share the image
+		for (int j = 0; j < i && !sprite->image; j++) {
+			const struct sprite *other = &b->sprites[j];
+			if (other->image && other->source == sprite->source && other->bpp == sprite->bpp &&
+				other->width == sprite->width && other->height == sprite->height) {
+				sprite->image = other->image;
+			}
+		}
+		if (!sprite->image) {
+			sprite->image = add_image(b, EVE_LAYERS_SPRITE, sprite->bpp, sprite->width, sprite->height, 1, sprite->source);
+		}
+	}
+
+	// every sprite costs a clock for the lookup
+	uint16_t line_cost = 128;
+	for (uint16_t y = 0; y < b->height; y++) {
+		line_cost += cost[y];
+		if (line_cost > SPRITE_BUDGET) {
+			return EVE_LAYERS_SPRITE_BUDGET;
+		}
+	}
+	return EVE_LAYERS_OK;
+}
+
+// Sprites with the same z are drawn from the last to the first, so
+// that the lower index wins as on VERA
+static void
+draw_sprites(struct builder *b, uint8_t z)
+{
+	for (int i = 127; i >= 0; i--) {
+		const struct sprite *sprite = &b->sprites[i];
+		if (!sprite->image || sprite->z != z) {
+			continue;
+		}
+		set_handle(b, SPRITE_HANDLE);
+		set_color(b, WHITE);
+		if (b->sprite_image != sprite->image) {
+			b->sprite_image = sprite->image;
+			emit(b, command(EVE_DL_BITMAP_SOURCE, sprite->image->address));
+			emit(b, command(EVE_DL_BITMAP_LAYOUT, EVE_DL_PALETTED4444 << 19 | sprite->width << 9 | sprite->height));
+			emit(b, command(EVE_DL_BITMAP_SIZE, sprite->width * b->sx << 9 | sprite->height * b->sy * b->state->y_scale));
+		}
+		set_palette(b, b->palettes + SPRITE_PALETTE(sprite->palette_offset));
+		set_flip(b, sprite->width, sprite->height, sprite->hflip, sprite->vflip);
+		vertex(b, b->hstart + sprite->x * b->sx, (b->vstart + sprite->y * b->sy) * b->state->y_scale, SPRITE_HANDLE, 0);
+	}
+}
+
+eve_layers_result_t
+eve_layers_build(const struct eve_layers_state *state, struct eve_layers_frame *frame)
+{
+	struct builder *b = &builder;
+	const uint8_t *composer = state->composer;
+
+	frame->dl_length = 0;
+	frame->image_count = 0;
+
+	// VGA only, at scales that the EVE draws exactly
+	if ((composer[0] & 3) != 1 ||
+		(composer[1] != 128 && composer[1] != 64) ||
+		(composer[2] != 128 && composer[2] != 64)) {
+		return EVE_LAYERS_UNSUPPORTED;
+	}
+
+	b->state = state;
+	b->frame = frame;
+	b->dl_full = false;
+	b->ram_full = false;
+	b->ram = EVE_LAYERS_REGION(region);
+	b->ram_end = b->ram + EVE_LAYERS_REGION_SIZE;
+	b->handle = 0;
+	b->color = WHITE;
+	b->palette = 0;
+	b->transform_a = 256;
+	b->transform_c = 0;
+	b->transform_e = 256;
+	b->transform_f = 0;
+	b->translate_x = 0;
+	b->translate_y = 0;
+	b->sprite_image = NULL;
+
+	b->sx = composer[1] == 64 ? 2 : 1;
+	b->sy = composer[2] == 64 ? 2 : 1;
+	b->hstart = composer[4] << 2 < SCREEN_WIDTH ? composer[4] << 2 : SCREEN_WIDTH;
+	b->hstop = composer[5] << 2 < SCREEN_WIDTH ? composer[5] << 2 : SCREEN_WIDTH;
+	b->vstart = composer[6] << 1;
+	b->vstop = (composer[7] << 1) + 1 < SCREEN_HEIGHT ? (composer[7] << 1) + 1 : SCREEN_HEIGHT;
+	b->width = b->hstop > b->hstart ? (b->hstop - b->hstart + b->sx - 1) / b->sx : 0;
+	b->height = b->vstop > b->vstart ? (b->vstop - b->vstart + b->sy - 1) / b->sy : 0;
+	const bool active = b->width && b->height;
+
+	b->palettes = add_image(b, EVE_LAYERS_PALETTES, 0, 0, 0, 0, 0)->address;
+	for (uint8_t l = 0; l < 2 && active; l++) {
+		struct layer *layer = &b->layers[l];
+		layer->image = NULL;
+		if (!(composer[0] & (0x10 << l))) {
+			continue;
+		}
+		if (!layer_init(layer, state->layer[l])) {
+			return EVE_LAYERS_UNSUPPORTED;
+		}
+		layer_cells(b, layer, 0, false);
+		if (layer->max_tile < 0) {
+			continue;
+		}
+		// text in runs of cells, where that takes fewer words than a
+		// vertex per cell
+		struct eve_layers_image text;
+		if (layer->text) {
+			text_image(b, layer, &text);
+		}
+		if (layer->text && text_runs(b, layer, &text, 0, false) * RUN_WORDS < layer->cell_words) {
+			layer->image = add_text(b, &text);
+		} else {
+			layer->image = add_image(b, EVE_LAYERS_TILES, layer->bpp, 1 << layer->tilew_log2, 1 << layer->tileh_log2, layer->max_tile + 1, layer->tile_base);
+		}
+	}
+	const bool sprites = active && (composer[0] & 0x40);
+	if (sprites) {
+		const eve_layers_result_t result = sprites_init(b);
+		if (result != EVE_LAYERS_OK) {
+			return result;
+		}
+	}
+	if (b->ram_full) {
+		return EVE_LAYERS_RAM_FULL;
+	}
+
+	// the border, then the active area on top
+	emit(b, command(EVE_DL_CLEAR_COLOR_RGB, rgb(state->palette, composer[3])));
+	emit(b, command(EVE_DL_CLEAR, 4));
+	if (active) {
+		emit(b, command(EVE_DL_SCISSOR_XY, b->hstart << 11 | b->vstart * state->y_scale));
+		emit(b, command(EVE_DL_SCISSOR_SIZE, (b->hstop - b->hstart) << 12 | (b->vstop - b->vstart) * state->y_scale));
+		emit(b, command(EVE_DL_CLEAR_COLOR_RGB, rgb(state->palette, 0)));
+		emit(b, command(EVE_DL_CLEAR, 4));
+		emit(b, command(EVE_DL_BEGIN, EVE_DL_BITMAPS));
+		// in the order of VERA's composer, bottom to top
+		if (sprites) {
+			draw_sprites(b, 1);
+		}
+		draw_layer(b, 0);
+		if (sprites) {
+			draw_sprites(b, 2);
+		}
+		draw_layer(b, 1);
+		if (sprites) {
+			draw_sprites(b, 3);
+		}
+	}
+	if (b->dl_full) {
+		return EVE_LAYERS_DL_FULL;
+	}
+	if (active) {
+		frame->dl[frame->dl_length++] = command(EVE_DL_END, 0);
+	}
+	frame->dl[frame->dl_length++] = command(EVE_DL_DISPLAY, 0);
+	return EVE_LAYERS_OK;
+}
+
+static void
+put16(uint8_t *data, uint32_t offset, uint16_t value)
+{
+	data[offset] = value;
+	data[offset + 1] = value >> 8;
+}
+
+void
+eve_layers_expand(const struct eve_layers_state *state, const struct eve_layers_image *image, uint8_t *data)
+{
+	const uint8_t *vram = state->vram;
+
+	if (image->type == EVE_LAYERS_PALETTES) {
+		const uint8_t *palette = state->palette;
+		uint16_t colors[256];
+		colors[0] = 0; // transparent
+		for (int i = 1; i < 256; i++) {
+			colors[i] = 0xF000 | (palette[i * 2 + 1] & 0xf) << 8 | palette[i * 2];
+		}
+		for (int offset = 0; offset < 16; offset++) {
+			for (int i = 0; i < 256; i++) {
+				put16(data, TILE_PALETTE(offset) + i * 2, colors[i && i < 16 ? i + offset * 16 : i]);
+				put16(data, SPRITE_PALETTE(offset) + i * 2, i ? colors[(i + offset * 16) & 0xff] : 0);
+			}
+		}
+		for (int attr = 0; attr < 256; attr++) {
+			put16(data, TEXT_PALETTE(attr), colors[attr >> 4]);
+			put16(data, TEXT_PALETTE(attr) + 2, colors[attr & 15]);
+			put16(data, TEXT_256C_PALETTE(attr), 0);
+			put16(data, TEXT_256C_PALETTE(attr) + 2, colors[attr]);
+		}
+		return;
+	}
+
+	if (image->type == EVE_LAYERS_TEXT) {
+		// the lines of the glyphs side by side, a byte for 8 pixels
+		const uint32_t bytes = image->width / 8;
+		const uint32_t glyph_size = bytes * image->height;
+		const uint32_t stride = image->columns * bytes;
+		const uint32_t plane = image->length / 2;
+		for (uint32_t r = 0; r < image->rows; r++) {
+			for (uint32_t c = 0; c < image->columns; c++) {
+				const uint32_t glyph = image->source + vram[text_cell(image, r, c) & (VRAM_SIZE - 1)] * glyph_size;
+				for (uint32_t i = 0; i < glyph_size; i++) {
+					const uint32_t offset = (r * image->height + i / bytes) * stride + c * bytes + i % bytes;
+					data[offset] = vram[(glyph + i) & (VRAM_SIZE - 1)];
+					data[plane + offset] = ~data[offset];
+				}
+			}
+		}
+		return;
+	}
+
+	// one byte per pixel, the first one in the upper bits of the source
+	const uint32_t pixels = image->length;
+	const uint8_t mask = (1 << image->bpp) - 1;
+	for (uint32_t i = 0; i < pixels; i++) {
+		const uint32_t bit = i * image->bpp;
+		const uint8_t byte = vram[(image->source + (bit >> 3)) & (VRAM_SIZE - 1)];
+		data[i] = (byte >> (8 - image->bpp - (bit & 7))) & mask;
+	}
+}
+
+// Of everything an image's contents depend on
+static uint32_t
+image_hash(const struct eve_layers_state *state, const struct eve_layers_image *image)
+{
+	uint32_t hash = 2166136261u;
+	const uint32_t params[] = {
+		image->type, image->bpp, image->width, image->height, image->count,
+		image->map, image->map_width_log2, image->map_height_log2, image->column, image->row, image->columns, image->rows
+	};
+	for (int i = 0; i < sizeof(params) / sizeof(*params); i++) {
+		hash = (hash ^ params[i]) * 16777619u;
+	}
+	if (image->type == EVE_LAYERS_PALETTES) {
+		for (uint32_t i = 0; i < 512; i++) {
+			hash = (hash ^ state->palette[i]) * 16777619u;
+		}
+		return hash;
+	}
+	if (image->type == EVE_LAYERS_TEXT) {
+		// the characters, and the whole font
+		for (uint32_t r = 0; r < image->rows; r++) {
+			for (uint32_t c = 0; c < image->columns; c++) {
+				hash = (hash ^ state->vram[text_cell(image, r, c) & (VRAM_SIZE - 1)]) * 16777619u;
+			}
+		}
+		const uint32_t font_size = 256 * image->width * image->height / 8;
+		for (uint32_t i = 0; i < font_size; i++) {
+			hash = (hash ^ state->vram[(image->source + i) & (VRAM_SIZE - 1)]) * 16777619u;
+		}
+		return hash;
+	}
+	const uint32_t size = image->length * image->bpp / 8;
+	for (uint32_t i = 0; i < size; i++) {
+		hash = (hash ^ state->vram[(image->source + i) & (VRAM_SIZE - 1)]) * 16777619u;
+	}
+	return hash;
+}
+
+// what is in each region since it was last used
+struct sent_image {
+	uint32_t address;
+	uint32_t length;
+	uint32_t hash;
+};
+
+static struct sent_image sent[EVE_LAYERS_REGIONS][EVE_LAYERS_MAX_IMAGES];
+static uint16_t sent_count[EVE_LAYERS_REGIONS];
+static uint8_t *expand_buffer;
+static uint32_t expand_size;
+
+// The pieces of the images are copied into buffers that the transport
+// may still send from
+#define PIECE_SIZE (EVE_DISPLAY_MAX_ROWS * EVE_DISPLAY_WIDTH)
+static uint8_t *pieces[EVE_TRANSPORT_BUFFERS];
+static uint8_t next_piece;
+
+void
+eve_layers_send(const struct eve_transport *transport, const struct eve_layers_state *state, const struct eve_layers_frame *frame)
+{
+	struct sent_image now[EVE_LAYERS_MAX_IMAGES];
+	for (uint16_t i = 0; i < frame->image_count; i++) {
+		const struct eve_layers_image *image = &frame->images[i];
+		now[i].address = image->address;
+		now[i].length = image->length;
+		now[i].hash = image_hash(state, image);
+
+		bool found = false;
+		for (uint16_t j = 0; j < sent_count[region] && !found; j++) {
+			found = !memcmp(&sent[region][j], &now[i], sizeof(now[i]));
+		}
+		if (found) {
+			continue;
+		}
+
+		if (expand_size < image->length) {
+			free(expand_buffer);
+			expand_buffer = malloc(image->length);
+			expand_size = image->length;
+		}
+		eve_layers_expand(state, image, expand_buffer);
+		// in pieces no larger than the framebuffer transfers
+		for (uint32_t offset = 0; offset < image->length; offset += PIECE_SIZE) {
+			uint32_t length = image->length - offset;
+			if (length > PIECE_SIZE) {
+				length = PIECE_SIZE;
+			}
+			if (!pieces[next_piece]) {
+				pieces[next_piece] = malloc(PIECE_SIZE);
+			}
+			uint8_t *piece = pieces[next_piece];
+			next_piece = (next_piece + 1) % EVE_TRANSPORT_BUFFERS;
+			memcpy(piece, expand_buffer + offset, length);
+			transport->mem_write(transport->ctx, image->address + offset, piece, length);
+		}
+	}
+	memcpy(sent[region], now, frame->image_count * sizeof(*now));
+	sent_count[region] = frame->image_count;
+
+	transport->show_list(transport->ctx, frame->dl, frame->dl_length);
+	// the list is on the screen now, and the other region free
+	region = (region + 1) % EVE_LAYERS_REGIONS;
+}
+
+const char *
+eve_layers_result_string(eve_layers_result_t result)
+{
+	switch (result) {
+		case EVE_LAYERS_OK:
+			return "ok";
+		case EVE_LAYERS_UNSUPPORTED:
+			return "unsupported mode";
+		case EVE_LAYERS_SPRITE_BUDGET:
+			return "sprite budget";
+		case EVE_LAYERS_DL_FULL:
+			return "display list full";
+		case EVE_LAYERS_RAM_FULL:
+			return "RAM_G full";
+		default:
+			return "?";
+	}
+}
@@ -0,0 +1,142 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#ifndef _EVE_LAYERS_H_
+#define _EVE_LAYERS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "eve_display.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Drawing the VERA layers and sprites with the EVE's bitmap engine
+// (-eve-layers): the tile and sprite data are mirrored into RAM_G,
+// expanded to 8 bit paletted bitmaps, and a display list draws every
+// tile of the map and every sprite from there. Text can have a 1 bit
+// image of its visible cells instead, which is drawn in runs of cells of
+// the same color, so that a full screen of text fits into the display
+// list. This only works for frames without raster effects, in modes the
+// EVE can scale exactly; everything else is rendered line by line as
+// before.
+
+// Display list commands, as far as they are used here. lib/EVE has
+// them, too, but can't be built for the host.
+#define EVE_DL_DISPLAY            0x00
+#define EVE_DL_BITMAP_SOURCE      0x01
+#define EVE_DL_CLEAR_COLOR_RGB    0x02
+#define EVE_DL_COLOR_RGB          0x04
+#define EVE_DL_BITMAP_HANDLE      0x05
+#define EVE_DL_BITMAP_LAYOUT      0x07
+#define EVE_DL_BITMAP_SIZE        0x08
+#define EVE_DL_BITMAP_TRANSFORM_A 0x15
+#define EVE_DL_BITMAP_TRANSFORM_C 0x17
+#define EVE_DL_BITMAP_TRANSFORM_E 0x19
+#define EVE_DL_BITMAP_TRANSFORM_F 0x1A
+#define EVE_DL_SCISSOR_XY         0x1B
+#define EVE_DL_SCISSOR_SIZE       0x1C
+#define EVE_DL_BEGIN              0x1F
+#define EVE_DL_END                0x21
+#define EVE_DL_CLEAR              0x26
+#define EVE_DL_PALETTE_SOURCE     0x2A
+#define EVE_DL_VERTEX_TRANSLATE_X 0x2B
+#define EVE_DL_VERTEX_TRANSLATE_Y 0x2C
+// the only command with bit 31 set
+#define EVE_DL_VERTEX2II          0x80000000
+
+#define EVE_DL_L1           1
+#define EVE_DL_PALETTED4444 15
+#define EVE_DL_BITMAPS      1
+
+// RAM_DL holds 2048 commands
+#define EVE_LAYERS_DL_WORDS 2048
+
+// the images go into RAM_G between the framebuffers and the audio
+#define EVE_LAYERS_RAM_START EVE_DISPLAY_BITMAP(EVE_DISPLAY_BUFFERS)
+#define EVE_LAYERS_RAM_END   EVE_DISPLAY_AUDIO_RING
+
+// in two regions, used by every other display list: the images of the
+// next frame are written while the list on the screen draws from the
+// other region
+#define EVE_LAYERS_REGIONS     2
+#define EVE_LAYERS_REGION_SIZE (((EVE_LAYERS_RAM_END - EVE_LAYERS_RAM_START) / EVE_LAYERS_REGIONS) & ~3)
+#define EVE_LAYERS_REGION(region) (EVE_LAYERS_RAM_START + (region) * EVE_LAYERS_REGION_SIZE)
+
+// the palettes, the tiles of both layers, and every sprite
+#define EVE_LAYERS_MAX_IMAGES (1 + 2 + 128)
+
+// What a frame is drawn from: video RAM, the palette and the sprite
+// attributes, and the display composer and layer registers
+struct eve_layers_state {
+	const uint8_t *vram;
+	const uint8_t *palette; // 256 entries of 2 bytes
+	const uint8_t *sprites; // 128 attributes of 8 bytes
+	uint8_t composer[8];
+	uint8_t layer[2][7];
+	uint8_t y_scale; // display lines per VGA line
+};
+
+typedef enum {
+	EVE_LAYERS_OK,
+	EVE_LAYERS_UNSUPPORTED, // the output, a layer mode, the scale, or a sprite palette offset
+	EVE_LAYERS_SPRITE_BUDGET, // VERA would drop sprite pixels on a line
+	EVE_LAYERS_DL_FULL,
+	EVE_LAYERS_RAM_FULL,
+	EVE_LAYERS_RESULTS
+} eve_layers_result_t;
+
+typedef enum {
+	EVE_LAYERS_PALETTES,
+	EVE_LAYERS_TILES,
+	EVE_LAYERS_SPRITE,
+	EVE_LAYERS_TEXT, // the pixels of the cells, then the same inverted
+} eve_layers_image_t;
+
+// A block of RAM_G the display list draws from
+struct eve_layers_image {
+	eve_layers_image_t type;
+	uint8_t bpp;     // in video RAM
+	uint8_t width;   // of a tile or the sprite
+	uint8_t height;
+	uint16_t count;  // tiles, or the cells of text
+	uint32_t source; // in video RAM
+	uint32_t address;
+	uint32_t length;
+	// text: the map, and its cells in the image from the top left one on
+	uint32_t map;
+	uint8_t map_width_log2;
+	uint8_t map_height_log2;
+	uint16_t column;
+	uint16_t row;
+	uint16_t columns;
+	uint16_t rows;
+};
+
+struct eve_layers_frame {
+	uint32_t dl[EVE_LAYERS_DL_WORDS];
+	uint16_t dl_length;
+	struct eve_layers_image images[EVE_LAYERS_MAX_IMAGES];
+	uint16_t image_count;
+};
+
+// Builds the display list for a frame, and the list of images it needs,
+// in the region that is not on the screen
+eve_layers_result_t eve_layers_build(const struct eve_layers_state *state, struct eve_layers_frame *frame);
+
+// The contents of an image
+void eve_layers_expand(const struct eve_layers_state *state, const struct eve_layers_image *image, uint8_t *data);
+
+// Sends the images that changed since their region was last used, then
+// the display list; returns once it is shown
+void eve_layers_send(const struct eve_transport *transport, const struct eve_layers_state *state, const struct eve_layers_frame *frame);
+
+const char *eve_layers_result_string(eve_layers_result_t result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
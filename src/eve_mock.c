@@ -0,0 +1,478 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <SDL.h>
+#include "eve_mock.h"
+#include "eve_layers.h"
+
+#define RAM_G_SIZE (1024 * 1024)
+
+// every memory write starts with a 3 byte address
+#define MEM_WRITE_OVERHEAD 3
+// CMD_INFLATE and its address go to the command FIFO, the data follows
+// in blocks of up to 3840 bytes, each a memory write of its own
+#define INFLATE_OVERHEAD (MEM_WRITE_OVERHEAD + 8)
+#define CMD_BLOCK_SIZE 3840
+
+// The transfers take as long as on a 30 MHz SPI link, so that the
+// emulator sees the same back-pressure as on the ESP32.
+#define SPI_BYTES_PER_SECOND (30000000 / 8)
+
+#define MAX(a,b) ((a) > (b) ? a : b)
+#define MIN(a,b) ((a) < (b) ? a : b)
+
+// -eve-layers draws on a panel with EVE_DISPLAY_Y_SCALE lines per line
+#define LIST_HEIGHT (EVE_DISPLAY_HEIGHT * EVE_DISPLAY_Y_SCALE)
+
+static uint8_t *ram_g;
+static int shown = -1;
+static bool shown_half;
+static uint32_t half_frames;
+static uint32_t frames;
+// -stream-lines doesn't switch buffers, the frames are counted separately
+static uint32_t streamed_frames;
+// -stream-lines check: frames whose lines differ, and the first line
+static uint32_t lines_checked;
+static uint32_t lines_mismatches;
+static uint32_t lines_first_frame;
+static uint16_t lines_first_y;
+static uint64_t bytes;
+static uint64_t transactions;
+static uint32_t torn_writes;
+static bool mismatch;
+static uint64_t inflated_bytes;
+static uint64_t deflated_bytes;
+static uint64_t link_us;
+static bool unpaced;
+
+// -eve-layers: the display list last shown, and what it draws
+static uint32_t list[EVE_LAYERS_DL_WORDS];
+static uint16_t list_length;
+static uint32_t *list_screen;
+static uint32_t list_frames;
+static uint32_t list_checked;
+static uint32_t list_mismatches;
+
+static void
+transfer(uint32_t length)
+{
+	bytes += length;
+	if (unpaced) {
+		return;
+	}
+	link_us += (uint64_t)length * 1000000 / SPI_BYTES_PER_SECOND;
+	if (link_us >= 1000) {
+		SDL_Delay(link_us / 1000);
+		link_us %= 1000;
+	}
+}
+
+// Whether a write would change what is on the screen
+static bool
+hits_shown_buffer(uint32_t address, uint32_t length)
+{
+	if (shown < 0) {
+		return false;
+	}
+	const uint32_t palette = EVE_DISPLAY_PALETTE(shown);
+	const uint32_t bitmap = EVE_DISPLAY_BITMAP(shown);
+	return (address < palette + 0x200 && address + length > palette) ||
+		(address < bitmap + EVE_DISPLAY_WIDTH * EVE_DISPLAY_HEIGHT && address + length > bitmap);
+}
+
+static void
+mock_mem_write(void *ctx, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	if (!ram_g) {
+		ram_g = calloc(RAM_G_SIZE, 1);
+	}
+	if (address + length > RAM_G_SIZE) {
+		printf("EVE mock: write to $%06X-$%06X outside of RAM_G\n", address, address + length - 1);
+		return;
+	}
+	if (hits_shown_buffer(address, length)) {
+		torn_writes++;
+	}
+	memcpy(ram_g + address, data, length);
+	transfer(MEM_WRITE_OVERHEAD + length);
+	transactions++;
+}
+
+static void
+mock_inflate(void *ctx, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	if (!ram_g) {
+		ram_g = calloc(RAM_G_SIZE, 1);
+	}
+	uLongf size = RAM_G_SIZE - address;
+	if (address >= RAM_G_SIZE || uncompress(ram_g + address, &size, data, length) != Z_OK) {
+		printf("EVE mock: CMD_INFLATE to $%06X failed\n", address);
+		return;
+	}
+	if (hits_shown_buffer(address, size)) {
+		torn_writes++;
+	}
+	const uint32_t blocks = (length + CMD_BLOCK_SIZE - 1) / CMD_BLOCK_SIZE;
+	transfer(INFLATE_OVERHEAD + blocks * MEM_WRITE_OVERHEAD + ((length + 3) & ~3));
+	transactions += 1 + blocks;
+	inflated_bytes += size;
+	deflated_bytes += length;
+}
+
+static void
+mock_show(void *ctx, uint8_t buffer, bool half)
+{
+	// a new display list and CMD_SWAP
+	transfer(MEM_WRITE_OVERHEAD + 13 * 4);
+	transactions++;
+	shown = buffer;
+	shown_half = half;
+	frames++;
+	half_frames += half;
+}
+
+static void
+mock_show_list(void *ctx, const uint32_t *dl, uint16_t length)
+{
+	// the list goes to RAM_DL, then REG_DLSWAP is set
+	transfer(MEM_WRITE_OVERHEAD + length * 4);
+	transfer(MEM_WRITE_OVERHEAD + 1);
+	transactions += 2;
+	memcpy(list, dl, length * sizeof(*dl));
+	list_length = length;
+	shown = -1;
+	list_frames++;
+}
+
+static const struct eve_transport transport_raw = {
+	mock_mem_write,
+	NULL,
+	mock_show,
+	mock_show_list,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static const struct eve_transport transport_inflate = {
+	mock_mem_write,
+	mock_inflate,
+	mock_show,
+	mock_show_list,
+	NULL,
+	NULL,
+	NULL,
+};
+
+const struct eve_transport *
+eve_mock_transport(bool inflate)
+{
+	return inflate ? &transport_inflate : &transport_raw;
+}
+
+void
+eve_mock_check(const uint8_t *framebuffer, const uint16_t *palette)
+{
+	if (shown < 0 || memcmp(ram_g + EVE_DISPLAY_PALETTE(shown), palette, 256 * sizeof(*palette))) {
+		mismatch = true;
+		return;
+	}
+	// the bitmap as the EVE scales it
+	const uint8_t *bitmap = ram_g + EVE_DISPLAY_BITMAP(shown);
+	mismatch = false;
+	for (uint32_t y = 0; y < EVE_DISPLAY_HEIGHT; y++) {
+		for (uint32_t x = 0; x < EVE_DISPLAY_WIDTH; x++) {
+			const uint8_t pixel = shown_half ? bitmap[y / 2 * EVE_DISPLAY_HALF_WIDTH + x / 2] : bitmap[y * EVE_DISPLAY_WIDTH + x];
+			mismatch |= pixel != framebuffer[y * EVE_DISPLAY_WIDTH + x];
+		}
+	}
+}
+
+// Bitmap handle state, as far as the display lists of eve_layers.c use it
+struct list_bitmap {
+	uint32_t source;
+	uint8_t format;
+	uint16_t stride;
+	uint16_t layout_height;
+	uint16_t width;
+	uint16_t height;
+};
+
+static int32_t
+sign_extend(uint32_t value, uint8_t bits)
+{
+	return (int32_t)(value << (32 - bits)) >> (32 - bits);
+}
+
+// Draws a PALETTED4444 or L1 bitmap cell at (x, y), sampling it at the
+// pixel centres through the bitmap transform. L1 is drawn in color,
+// PALETTED4444 only ever in white.
+static void
+draw_bitmap(const struct list_bitmap *bitmap, uint8_t cell, int32_t x, int32_t y, const int32_t *transform, uint32_t palette, uint32_t color, const int32_t *scissor)
+{
+	const bool l1 = bitmap->format == EVE_DL_L1;
+	const int32_t layout_width = l1 ? bitmap->stride * 8 : bitmap->stride;
+	const int32_t x0 = MAX(MAX(x, scissor[0]), 0);
+	const int32_t y0 = MAX(MAX(y, scissor[1]), 0);
+	const int32_t x1 = MIN(MIN(x + bitmap->width, scissor[0] + scissor[2]), EVE_DISPLAY_WIDTH);
+	const int32_t y1 = MIN(MIN(y + bitmap->height, scissor[1] + scissor[3]), LIST_HEIGHT);
+	const uint32_t base = bitmap->source + cell * bitmap->stride * bitmap->layout_height;
+	for (int32_t py = y0; py < y1; py++) {
+		const int32_t v = transform[2] * (2 * (py - y) + 1) / 2 + transform[3];
+		const int32_t ty = v >> 8;
+		for (int32_t px = x0; px < x1; px++) {
+			const int32_t u = transform[0] * (2 * (px - x) + 1) / 2 + transform[1];
+			const int32_t tx = u >> 8;
+			// transparent outside of the bitmap
+			if (tx < 0 || ty < 0 || tx >= layout_width || ty >= bitmap->layout_height) {
+				continue;
+			}
+			if (l1) {
+				const uint8_t byte = ram_g[(base + ty * bitmap->stride + tx / 8) & (RAM_G_SIZE - 1)];
+				if ((byte << (tx & 7)) & 0x80) {
+					list_screen[py * EVE_DISPLAY_WIDTH + px] = 0xff000000 | color;
+				}
+				continue;
+			}
+			const uint8_t index = ram_g[(base + ty * bitmap->stride + tx) & (RAM_G_SIZE - 1)];
+			const uint16_t color = ram_g[palette + index * 2] | ram_g[palette + index * 2 + 1] << 8;
+			// only fully transparent or opaque colors are used
+			if (color >> 12) {
+				list_screen[py * EVE_DISPLAY_WIDTH + px] = 0xff000000 | ((color >> 8) & 15) * 17 << 16 | ((color >> 4) & 15) * 17 << 8 | (color & 15) * 17;
+			}
+		}
+	}
+}
+
+// Executes the display list last shown. Returns false if it uses
+// something this doesn't know.
+static bool
+draw_list()
+{
+	struct list_bitmap bitmaps[32];
+	uint8_t handle = 0;
+	// A, C, E, F
+	int32_t transform[4] = { 256, 0, 256, 0 };
+	int32_t translate_x = 0;
+	int32_t translate_y = 0;
+	uint32_t palette = 0;
+	uint32_t color = 0xffffff;
+	uint32_t clear_color = 0;
+	int32_t scissor[4] = { 0, 0, 2048, 2048 };
+
+	if (!list_screen) {
+		list_screen = calloc(EVE_DISPLAY_WIDTH * LIST_HEIGHT, sizeof(*list_screen));
+	}
+	memset(bitmaps, 0, sizeof(bitmaps));
+	for (uint16_t i = 0; i < list_length; i++) {
+		const uint32_t word = list[i];
+		if (word & EVE_DL_VERTEX2II) {
+			const struct list_bitmap *bitmap = &bitmaps[(word >> 7) & 31];
+			if (!(bitmap->format == EVE_DL_PALETTED4444 && color == 0xffffff) && bitmap->format != EVE_DL_L1) {
+				return false;
+			}
+			const int32_t x = ((word >> 21) & 0x1ff) + translate_x / 16;
+			const int32_t y = ((word >> 12) & 0x1ff) + translate_y / 16;
+			draw_bitmap(bitmap, word & 127, x, y, transform, palette, color, scissor);
+			continue;
+		}
+		switch (word >> 24) {
+			case EVE_DL_DISPLAY:
+				return true;
+			case EVE_DL_BITMAP_SOURCE:
+				bitmaps[handle].source = word & 0x3fffff;
+				break;
+			case EVE_DL_CLEAR_COLOR_RGB:
+				clear_color = 0xff000000 | (word & 0xffffff);
+				break;
+			case EVE_DL_COLOR_RGB:
+				color = word & 0xffffff;
+				break;
+			case EVE_DL_BITMAP_HANDLE:
+				handle = word & 31;
+				break;
+			case EVE_DL_BITMAP_LAYOUT:
+				bitmaps[handle].format = (word >> 19) & 31;
+				bitmaps[handle].stride = (word >> 9) & 0x3ff;
+				bitmaps[handle].layout_height = word & 0x1ff;
+				break;
+			case EVE_DL_BITMAP_SIZE:
+				// nearest, and transparent outside
+				if (word & 0x1c0000) {
+					return false;
+				}
+				bitmaps[handle].width = (word >> 9) & 0x1ff;
+				bitmaps[handle].height = word & 0x1ff;
+				break;
+			case EVE_DL_BITMAP_TRANSFORM_A:
+				transform[0] = sign_extend(word, 17);
+				break;
+			case EVE_DL_BITMAP_TRANSFORM_C:
+				transform[1] = sign_extend(word, 24);
+				break;
+			case EVE_DL_BITMAP_TRANSFORM_E:
+				transform[2] = sign_extend(word, 17);
+				break;
+			case EVE_DL_BITMAP_TRANSFORM_F:
+				transform[3] = sign_extend(word, 24);
+				break;
+			case EVE_DL_SCISSOR_XY:
+				scissor[0] = (word >> 11) & 0x7ff;
+				scissor[1] = word & 0x7ff;
+				break;
+			case EVE_DL_SCISSOR_SIZE:
+				scissor[2] = (word >> 12) & 0xfff;
+				scissor[3] = word & 0xfff;
+				break;
+			case EVE_DL_BEGIN:
+				if ((word & 15) != EVE_DL_BITMAPS) {
+					return false;
+				}
+				break;
+			case EVE_DL_END:
+				break;
+			case EVE_DL_CLEAR:
+				if (word & 4) {
+					for (int32_t y = MAX(scissor[1], 0); y < MIN(scissor[1] + scissor[3], LIST_HEIGHT); y++) {
+						for (int32_t x = MAX(scissor[0], 0); x < MIN(scissor[0] + scissor[2], EVE_DISPLAY_WIDTH); x++) {
+							list_screen[y * EVE_DISPLAY_WIDTH + x] = clear_color;
+						}
+					}
+				}
+				break;
+			case EVE_DL_PALETTE_SOURCE:
+				palette = word & 0x3fffff;
+				break;
+			case EVE_DL_VERTEX_TRANSLATE_X:
+				translate_x = sign_extend(word, 17);
+				break;
+			case EVE_DL_VERTEX_TRANSLATE_Y:
+				translate_y = sign_extend(word, 17);
+				break;
+			default:
+				return false;
+		}
+	}
+	// no DISPLAY
+	return false;
+}
+
+void
+eve_mock_check_list(const uint8_t *framebuffer, const uint32_t *argb)
+{
+	list_checked++;
+	if (!draw_list()) {
+		if (!list_mismatches++) {
+			printf("EVE mock: display list %u can't be drawn\n", list_frames);
+		}
+		return;
+	}
+	for (uint32_t y = 0; y < LIST_HEIGHT; y++) {
+		for (uint32_t x = 0; x < EVE_DISPLAY_WIDTH; x++) {
+			const uint32_t expected = argb[framebuffer[y / EVE_DISPLAY_Y_SCALE * EVE_DISPLAY_WIDTH + x]];
+			if ((list_screen[y * EVE_DISPLAY_WIDTH + x] ^ expected) & 0xffffff) {
+				if (!list_mismatches++) {
+					printf("EVE mock: display list %u differs from the framebuffer at %u,%u: %06X instead of %06X\n", list_frames, x, y / EVE_DISPLAY_Y_SCALE, list_screen[y * EVE_DISPLAY_WIDTH + x] & 0xffffff, expected & 0xffffff);
+				}
+				return;
+			}
+		}
+	}
+}
+
+const uint8_t *
+eve_mock_screen()
+{
+	if (shown < 0 || shown_half || !ram_g) {
+		return NULL;
+	}
+	return ram_g + EVE_DISPLAY_BITMAP(shown);
+}
+
+void
+eve_mock_end_frame()
+{
+	streamed_frames++;
+}
+
+void
+eve_mock_check_lines(const uint8_t *framebuffer)
+{
+	if (!ram_g) {
+		return;
+	}
+	const uint8_t *bitmap = ram_g + EVE_DISPLAY_BITMAP(0);
+	lines_checked++;
+	for (uint16_t y = 0; y < EVE_DISPLAY_HEIGHT; y++) {
+		if (memcmp(bitmap + y * EVE_DISPLAY_WIDTH, framebuffer + y * EVE_DISPLAY_WIDTH, EVE_DISPLAY_WIDTH)) {
+			if (!lines_mismatches) {
+				lines_first_frame = streamed_frames;
+				lines_first_y = y;
+			}
+			lines_mismatches++;
+			return;
+		}
+	}
+}
+
+void
+eve_mock_set_paced(bool paced)
+{
+	unpaced = !paced;
+}
+
+void
+eve_mock_get_stats(struct eve_mock_stats *stats)
+{
+	stats->frames = frames;
+	stats->bytes = bytes;
+	stats->transactions = transactions;
+	stats->inflated_bytes = inflated_bytes;
+	stats->deflated_bytes = deflated_bytes;
+	stats->torn_writes = torn_writes;
+	stats->mismatch = mismatch;
+}
+
+void
+eve_mock_report()
+{
+	if (streamed_frames) {
+		frames = streamed_frames;
+	}
+	frames += list_frames;
+	if (!frames) {
+		return;
+	}
+	printf("EVE mock: %u frames, %.1f KB and %.1f transactions per frame", frames, (double)bytes / frames / 1024, (double)transactions / frames);
+	if (deflated_bytes) {
+		printf(", compressed lines %.1f:1", (double)inflated_bytes / deflated_bytes);
+	}
+	if (half_frames) {
+		printf(", %u at 320x240", half_frames);
+	}
+	if (list_frames) {
+		printf(", %u from display lists", list_frames);
+	}
+	printf("\n");
+	if (list_checked) {
+		printf("EVE mock: %u of %u display lists compared differ from the framebuffer\n", list_mismatches, list_checked);
+	}
+	if (lines_checked) {
+		printf("EVE mock: %u of %u streamed frames differ from the framebuffer", lines_mismatches, lines_checked);
+		if (lines_mismatches) {
+			printf(", the first at line %u of frame %u", lines_first_y, lines_first_frame);
+		}
+		printf("\n");
+	}
+	if (torn_writes) {
+		printf("EVE mock: %u writes to the buffer on screen\n", torn_writes);
+	}
+	if (mismatch) {
+		printf("EVE mock: the screen differs from the framebuffer\n");
+	}
+}
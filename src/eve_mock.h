@@ -0,0 +1,51 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#ifndef _EVE_MOCK_H_
+#define _EVE_MOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "eve_display.h"
+
+// A stand-in for an EVE display on the host (-eve-mock): it keeps a copy
+// of RAM_G and counts what would have been sent over SPI. With inflate,
+// it also accepts compressed lines like the real coprocessor.
+const struct eve_transport *eve_mock_transport(bool inflate);
+
+// Checks that what is on the screen is the framebuffer, after
+// eve_present_flush()
+void eve_mock_check(const uint8_t *framebuffer, const uint16_t *palette);
+
+// With -eve-layers: draws the display list last shown, and checks that
+// it has the same colors as the framebuffer
+void eve_mock_check_list(const uint8_t *framebuffer, const uint32_t *argb);
+
+// With -stream-lines, after eve_present_lines_end_frame()
+void eve_mock_end_frame(void);
+
+// With -stream-lines check, after eve_mock_end_frame(): compares the
+// lines streamed into buffer 0 with the framebuffer
+void eve_mock_check_lines(const uint8_t *framebuffer);
+
+// The full resolution bitmap on the screen, or NULL
+const uint8_t *eve_mock_screen(void);
+void eve_mock_report(void);
+
+// For the testbench: the transfers without the SPI link's time, and
+// the counters of the report
+void eve_mock_set_paced(bool paced);
+
+struct eve_mock_stats {
+	uint32_t frames;         // buffers shown
+	uint64_t bytes;          // over SPI
+	uint64_t transactions;
+	uint64_t inflated_bytes; // compressed lines, as inflated
+	uint64_t deflated_bytes; // and as sent
+	uint32_t torn_writes;    // writes to the buffer on screen
+	bool mismatch;           // at the last eve_mock_check()
+};
+void eve_mock_get_stats(struct eve_mock_stats *stats);
+
+#endif
@@ -0,0 +1,400 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eve_present.h"
+#include "eve_audio.h"
+
+#if ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+typedef SemaphoreHandle_t present_sem_t;
+#define present_sem_create(value) xSemaphoreCreateCounting(EVE_DISPLAY_BUFFERS, value)
+#define present_sem_wait(sem) xSemaphoreTake(sem, portMAX_DELAY)
+#define present_sem_trywait(sem) (xSemaphoreTake(sem, 0) == pdTRUE)
+#define present_sem_post(sem) xSemaphoreGive(sem)
+#define present_sem_wait_ms(sem, ms) (xSemaphoreTake(sem, pdMS_TO_TICKS(ms)) == pdTRUE)
+
+typedef SemaphoreHandle_t present_lock_t;
+#define present_lock_create() xSemaphoreCreateMutex()
+#define present_lock(lock) xSemaphoreTake(lock, portMAX_DELAY)
+#define present_unlock(lock) xSemaphoreGive(lock)
+#else
+#include <SDL.h>
+
+typedef SDL_sem *present_sem_t;
+#define present_sem_create(value) SDL_CreateSemaphore(value)
+#define present_sem_wait(sem) SDL_SemWait(sem)
+#define present_sem_trywait(sem) (SDL_SemTryWait(sem) == 0)
+#define present_sem_post(sem) SDL_SemPost(sem)
+#define present_sem_wait_ms(sem, ms) (SDL_SemWaitTimeout(sem, ms) == 0)
+
+typedef SDL_mutex *present_lock_t;
+#define present_lock_create() SDL_CreateMutex()
+#define present_lock(lock) SDL_LockMutex(lock)
+#define present_unlock(lock) SDL_UnlockMutex(lock)
+#endif
+
+#define FRAME_SIZE (EVE_DISPLAY_WIDTH * EVE_DISPLAY_HEIGHT)
+
+// frames until a 320x240 mode that didn't scale evenly is tried again
+#define HALF_RES_RETRY 60
+
+// Frame slot n is always transferred into RAM_G buffer n, so it only
+// needs the lines that changed since it was last used.
+struct present_frame {
+	uint8_t *pixels;
+	uint16_t palette[256];
+	uint32_t dirty_lines[EVE_DISPLAY_DIRTY_WORDS];
+	bool palette_dirty;
+	bool half;
+};
+
+static const struct eve_transport *present_transport;
+// The display's transfers and the audio take turns on the transport:
+// after each transfer, the audio gets one (bounded) turn. The lock is
+// for the emulator thread, the worker, and the worker's turns of the
+// audio while it waits for frames.
+static const struct eve_transport *display_transport;
+static struct eve_transport shared_transport;
+static present_lock_t transport_lock;
+static struct present_frame frames[EVE_DISPLAY_BUFFERS];
+static bool threaded;
+
+// emulator side: what changed since each slot was filled
+static uint32_t pending_lines[EVE_DISPLAY_BUFFERS][EVE_DISPLAY_DIRTY_WORDS];
+static bool pending_palette[EVE_DISPLAY_BUFFERS];
+static uint8_t next_fill;
+static bool half_res;
+static uint16_t half_res_retry;
+
+// worker side
+static uint8_t next_show;
+
+// -stream-lines: the run of lines that hasn't been sent yet, in one of
+// the buffers the transport may still send from
+static uint8_t *run_buffers[EVE_TRANSPORT_BUFFERS];
+static uint8_t next_run;
+static uint8_t *run_pixels;
+static uint16_t run_y;
+static uint16_t run_count;
+static uint16_t run_palettes[EVE_TRANSPORT_BUFFERS][256];
+static uint8_t next_run_palette;
+
+// free: slots the emulator can fill, ready: slots for the worker
+static present_sem_t free_frames;
+static present_sem_t ready_frames;
+
+static void
+shared_mem_write(void *ctx, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	present_lock(transport_lock);
+	display_transport->mem_write(ctx, address, data, length);
+	eve_audio_service();
+	present_unlock(transport_lock);
+}
+
+static void
+shared_inflate(void *ctx, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	present_lock(transport_lock);
+	display_transport->inflate(ctx, address, data, length);
+	eve_audio_service();
+	present_unlock(transport_lock);
+}
+
+static void
+shared_show(void *ctx, uint8_t buffer, bool half)
+{
+	present_lock(transport_lock);
+	display_transport->show(ctx, buffer, half);
+	eve_audio_service();
+	present_unlock(transport_lock);
+}
+
+static void
+shared_show_list(void *ctx, const uint32_t *dl, uint16_t length)
+{
+	present_lock(transport_lock);
+	display_transport->show_list(ctx, dl, length);
+	eve_audio_service();
+	present_unlock(transport_lock);
+}
+
+static void
+share_transport(const struct eve_transport *transport)
+{
+	display_transport = transport;
+	shared_transport = *transport;
+	shared_transport.mem_write = shared_mem_write;
+	shared_transport.inflate = transport->inflate ? shared_inflate : NULL;
+	shared_transport.show = shared_show;
+	shared_transport.show_list = shared_show_list;
+	// the audio has the transport already
+	shared_transport.play = NULL;
+	shared_transport.play_position = NULL;
+	transport_lock = present_lock_create();
+	present_transport = &shared_transport;
+}
+
+static void
+audio_turn(void)
+{
+	present_lock(transport_lock);
+	eve_audio_service();
+	present_unlock(transport_lock);
+}
+
+static void
+show_frame(uint8_t buffer)
+{
+	const struct present_frame *frame = &frames[buffer];
+	eve_display_send(present_transport, buffer, frame->pixels, frame->palette, frame->dirty_lines, frame->palette_dirty, frame->half);
+	present_transport->show(present_transport->ctx, buffer, frame->half);
+}
+
+#if ESP_PLATFORM
+static void
+present_worker(void *arg)
+#else
+static int
+present_worker(void *arg)
+#endif
+{
+	for (;;) {
+		while (!present_sem_wait_ms(ready_frames, EVE_AUDIO_PERIOD_MS)) {
+			audio_turn();
+		}
+		show_frame(next_show);
+		next_show = (next_show + 1) % EVE_DISPLAY_BUFFERS;
+		present_sem_post(free_frames);
+	}
+#if !ESP_PLATFORM
+	return 0;
+#endif
+}
+
+void
+eve_present_init(const struct eve_transport *transport)
+{
+	share_transport(transport);
+	for (int i = 0; i < EVE_DISPLAY_BUFFERS; i++) {
+		frames[i].pixels = malloc(FRAME_SIZE);
+		memset(pending_lines[i], 0xff, sizeof(pending_lines[i]));
+		pending_palette[i] = true;
+	}
+
+	free_frames = present_sem_create(EVE_DISPLAY_BUFFERS);
+	ready_frames = present_sem_create(0);
+	if (free_frames && ready_frames) {
+#if ESP_PLATFORM
+		// the emulator runs on core 1
+		threaded = xTaskCreatePinnedToCore(present_worker, "eve_present", 4096, NULL, 1, NULL, 0) == pdPASS;
+#else
+		threaded = SDL_CreateThread(present_worker, "eve_present", NULL) != NULL;
+#endif
+	}
+	if (!threaded) {
+		printf("EVE: no worker thread, transferring frames synchronously\n");
+	}
+}
+
+// Both buffers have to be sent in full after the layout changed
+static void
+set_half_res(bool half)
+{
+	half_res = half;
+	memset(pending_lines, 0xff, sizeof(pending_lines));
+}
+
+// Halves a pair of lines, if both are the same and every pixel is doubled
+static bool
+copy_half_line(uint8_t *dst, const uint8_t *src)
+{
+	if (memcmp(src, src + EVE_DISPLAY_WIDTH, EVE_DISPLAY_WIDTH)) {
+		return false;
+	}
+	for (uint16_t x = 0; x < EVE_DISPLAY_HALF_WIDTH; x++) {
+		if (src[2 * x] != src[2 * x + 1]) {
+			return false;
+		}
+		dst[x] = src[2 * x];
+	}
+	return true;
+}
+
+// Copies the changed lines into a frame at half resolution. Returns
+// false if the framebuffer can't be halved without losing pixels.
+static bool
+copy_half(struct present_frame *frame, const uint8_t *framebuffer, const uint32_t *lines)
+{
+	memset(frame->dirty_lines, 0, sizeof(frame->dirty_lines));
+	for (uint16_t y = 0; y < EVE_DISPLAY_HALF_HEIGHT; y++) {
+		const uint16_t y2 = 2 * y;
+		if (!((lines[y2 >> 5] >> (y2 & 31)) & 3)) {
+			continue;
+		}
+		if (!copy_half_line(frame->pixels + y * EVE_DISPLAY_HALF_WIDTH, framebuffer + y2 * EVE_DISPLAY_WIDTH)) {
+			return false;
+		}
+		frame->dirty_lines[y >> 5] |= 1u << (y & 31);
+	}
+	return true;
+}
+
+static void
+copy_full(struct present_frame *frame, const uint8_t *framebuffer, const uint32_t *lines)
+{
+	for (uint16_t y = 0; y < EVE_DISPLAY_HEIGHT; y++) {
+		if ((lines[y >> 5] >> (y & 31)) & 1) {
+			memcpy(frame->pixels + y * EVE_DISPLAY_WIDTH, framebuffer + y * EVE_DISPLAY_WIDTH, EVE_DISPLAY_WIDTH);
+		}
+	}
+	memcpy(frame->dirty_lines, lines, sizeof(frame->dirty_lines));
+}
+
+bool
+eve_present_submit(const uint8_t *framebuffer, const uint16_t *palette, const uint32_t *dirty_lines, bool palette_dirty, bool scaled_2x, bool wait)
+{
+	for (int i = 0; i < EVE_DISPLAY_BUFFERS; i++) {
+		for (int w = 0; w < EVE_DISPLAY_DIRTY_WORDS; w++) {
+			pending_lines[i][w] |= dirty_lines[w];
+		}
+		pending_palette[i] |= palette_dirty;
+	}
+
+	if (!threaded) {
+		// nothing is in flight
+	} else if (wait) {
+		present_sem_wait(free_frames);
+	} else if (!present_sem_trywait(free_frames)) {
+		return false;
+	}
+
+	// The composer's scale only says whether halving is worth a try, the
+	// pixels decide: borders or mid-frame changes may not be doubled.
+	if (!scaled_2x) {
+		if (half_res) {
+			set_half_res(false);
+		}
+		half_res_retry = 0;
+	} else if (!half_res) {
+		if (half_res_retry) {
+			half_res_retry--;
+		} else {
+			set_half_res(true);
+		}
+	}
+
+	struct present_frame *frame = &frames[next_fill];
+	if (half_res && !copy_half(frame, framebuffer, pending_lines[next_fill])) {
+		set_half_res(false);
+		half_res_retry = HALF_RES_RETRY;
+	}
+	if (!half_res) {
+		copy_full(frame, framebuffer, pending_lines[next_fill]);
+	}
+	frame->half = half_res;
+	memset(pending_lines[next_fill], 0, sizeof(pending_lines[next_fill]));
+	if (pending_palette[next_fill]) {
+		memcpy(frame->palette, palette, sizeof(frame->palette));
+	}
+	frame->palette_dirty = pending_palette[next_fill];
+	pending_palette[next_fill] = false;
+	next_fill = (next_fill + 1) % EVE_DISPLAY_BUFFERS;
+
+	if (threaded) {
+		present_sem_post(ready_frames);
+	} else {
+		show_frame(next_show);
+		next_show = (next_show + 1) % EVE_DISPLAY_BUFFERS;
+	}
+	return true;
+}
+
+void
+eve_present_flush()
+{
+	if (!threaded) {
+		return;
+	}
+	for (int i = 0; i < EVE_DISPLAY_BUFFERS; i++) {
+		present_sem_wait(free_frames);
+	}
+	for (int i = 0; i < EVE_DISPLAY_BUFFERS; i++) {
+		present_sem_post(free_frames);
+	}
+}
+
+void
+eve_present_list(const struct eve_layers_state *state, const struct eve_layers_frame *frame)
+{
+	eve_present_flush();
+	eve_layers_send(present_transport, state, frame);
+}
+
+void
+eve_present_lines_init(const struct eve_transport *transport)
+{
+	share_transport(transport);
+	for (int i = 0; i < EVE_TRANSPORT_BUFFERS; i++) {
+		run_buffers[i] = malloc(EVE_DISPLAY_MAX_ROWS * EVE_DISPLAY_WIDTH);
+	}
+	run_pixels = run_buffers[0];
+	next_run = 1;
+	present_transport->show(present_transport->ctx, 0, false);
+}
+
+static void
+send_run()
+{
+	if (run_count) {
+		eve_display_send_lines(present_transport, 0, run_y, run_pixels, run_count);
+		run_pixels = run_buffers[next_run];
+		next_run = (next_run + 1) % EVE_TRANSPORT_BUFFERS;
+		run_count = 0;
+	}
+}
+
+void
+eve_present_line(uint16_t y, const uint8_t *pixels)
+{
+	if (run_count && (y != run_y + run_count || run_count == EVE_DISPLAY_MAX_ROWS)) {
+		send_run();
+	}
+	if (!run_count) {
+		run_y = y;
+	}
+	memcpy(run_pixels + run_count * EVE_DISPLAY_WIDTH, pixels, EVE_DISPLAY_WIDTH);
+	run_count++;
+}
+
+void
+eve_present_line_part(uint16_t y, uint16_t x, uint16_t width, const uint8_t *pixels)
+{
+	send_run();
+	memcpy(run_pixels, pixels + x, width);
+	eve_display_send_line_part(present_transport, 0, y, x, run_pixels, width);
+	run_pixels = run_buffers[next_run];
+	next_run = (next_run + 1) % EVE_TRANSPORT_BUFFERS;
+}
+
+void
+eve_present_lines_end_frame(const uint16_t *palette, bool palette_dirty)
+{
+	send_run();
+	if (palette_dirty) {
+		uint16_t *copy = run_palettes[next_run_palette];
+		next_run_palette = (next_run_palette + 1) % EVE_TRANSPORT_BUFFERS;
+		memcpy(copy, palette, sizeof(run_palettes[0]));
+		eve_display_send_palette(present_transport, 0, copy);
+	}
+	// there is no worker to give the audio its turns on a frame that
+	// sent nothing
+	audio_turn();
+}
@@ -0,0 +1,55 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#ifndef _EVE_PRESENT_H_
+#define _EVE_PRESENT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "eve_display.h"
+#include "eve_layers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Double-buffered presentation on an EVE display: finished frames are
+// handed to a worker, which transfers them into the RAM_G buffer that
+// is not shown while the emulation goes on, and then swaps buffers.
+// The audio (eve_audio.h) shares the transport: it gets a turn after
+// each transfer, and every EVE_AUDIO_PERIOD_MS while the worker waits.
+
+void eve_present_init(const struct eve_transport *transport);
+
+// Hands over the framebuffer and palette after video_update(), with what
+// changed since the last frame. If the worker is still busy with two
+// frames, the frame is dropped, unless wait is set; what changed is then
+// sent with the next one. Returns whether the frame was taken.
+// scaled_2x says that the whole frame was composed at HSCALE=VSCALE=64,
+// it is then sent at 320x240 if every pixel is doubled.
+bool eve_present_submit(const uint8_t *framebuffer, const uint16_t *palette, const uint32_t *dirty_lines, bool palette_dirty, bool scaled_2x, bool wait);
+
+// Waits until all frames that were taken are shown
+void eve_present_flush(void);
+
+// With -eve-layers, instead of a framebuffer: waits for the worker, then
+// sends a frame that the EVE draws from a display list. The buffers keep
+// their contents for the next framebuffer that is submitted.
+void eve_present_list(const struct eve_layers_state *state, const struct eve_layers_frame *frame);
+
+// Without a framebuffer (-stream-lines), instead of the above: buffer 0
+// stays on the screen, and lines are written to it as they are
+// completed, in runs of consecutive lines. The audio gets its turns
+// after each transfer and at the end of every frame.
+void eve_present_lines_init(const struct eve_transport *transport);
+void eve_present_line(uint16_t y, const uint8_t *pixels);
+// pixels[x] to pixels[x + width - 1] of line y, on their own
+void eve_present_line_part(uint16_t y, uint16_t x, uint16_t width, const uint8_t *pixels);
+void eve_present_lines_end_frame(const uint16_t *palette, bool palette_dirty);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,410 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gif_recorder.h"
+
+#if ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+typedef SemaphoreHandle_t gif_sem_t;
+#define gif_sem_create(value) xSemaphoreCreateCounting(QUEUE_FRAMES, value)
+#define gif_sem_wait(sem) xSemaphoreTake(sem, portMAX_DELAY)
+#define gif_sem_trywait(sem) (xSemaphoreTake(sem, 0) == pdTRUE)
+#define gif_sem_post(sem) xSemaphoreGive(sem)
+#else
+#include <SDL.h>
+
+typedef SDL_sem *gif_sem_t;
+#define gif_sem_create(value) SDL_CreateSemaphore(value)
+#define gif_sem_wait(sem) SDL_SemWait(sem)
+#define gif_sem_trywait(sem) (SDL_SemTryWait(sem) == 0)
+#define gif_sem_post(sem) SDL_SemPost(sem)
+#endif
+
+#define QUEUE_FRAMES 3
+#define PALETTE_SIZE (256 * 3)
+
+// GIF delays are in 1/100 s, and most viewers show frames shorter than
+// 2 for 10. A frame that would be shown for less is replaced by the
+// next one.
+#define MIN_DELAY 2
+
+#define LZW_CLEAR     256
+#define LZW_END       257
+#define LZW_MAX_CODES 4096
+// a prime larger than LZW_MAX_CODES
+#define LZW_HASH_SIZE 5003
+
+struct queued_frame {
+	uint8_t *pixels;
+	uint8_t palette[PALETTE_SIZE];
+	uint32_t number;
+};
+
+static FILE *file;
+static uint16_t width;
+static uint16_t height;
+static bool threaded;
+static volatile bool failed;
+
+// emulator side
+static struct queued_frame queue[QUEUE_FRAMES];
+static uint8_t next_fill;
+static uint32_t frame_number;
+static uint32_t dropped_frames;
+
+// worker side: the image as the file shows it so far, and the frame
+// that is written once it is known how long it is shown
+static uint8_t next_record;
+static bool header_written;
+static uint8_t global_palette[PALETTE_SIZE];
+static uint8_t *shown;
+static uint8_t shown_palette[PALETTE_SIZE];
+static uint8_t *pending;
+static uint8_t pending_palette[PALETTE_SIZE];
+static uint32_t pending_number;
+static bool pending_valid;
+
+// free: slots the emulator can fill, ready: slots for the worker
+static gif_sem_t free_frames;
+static gif_sem_t ready_frames;
+
+static struct {
+	uint32_t keys[LZW_HASH_SIZE]; // prefix << 8 | pixel, plus 1; 0 is free
+	uint16_t codes[LZW_HASH_SIZE];
+	uint16_t next_code;
+	uint8_t code_size;
+	uint32_t bits;
+	uint8_t bit_count;
+	uint8_t block[255];
+	uint8_t block_length;
+} lzw;
+
+static void
+put16(uint16_t value)
+{
+	fputc(value & 0xff, file);
+	fputc(value >> 8, file);
+}
+
+static void
+lzw_byte(uint8_t byte)
+{
+	lzw.block[lzw.block_length++] = byte;
+	if (lzw.block_length == sizeof(lzw.block)) {
+		fputc(lzw.block_length, file);
+		fwrite(lzw.block, 1, lzw.block_length, file);
+		lzw.block_length = 0;
+	}
+}
+
+static void
+lzw_code(uint16_t code)
+{
+	lzw.bits |= (uint32_t)code << lzw.bit_count;
+	lzw.bit_count += lzw.code_size;
+	while (lzw.bit_count >= 8) {
+		lzw_byte(lzw.bits);
+		lzw.bits >>= 8;
+		lzw.bit_count -= 8;
+	}
+}
+
+static void
+lzw_reset()
+{
+	memset(lzw.keys, 0, sizeof(lzw.keys));
+	lzw.next_code = LZW_END + 1;
+	lzw.code_size = 9;
+}
+
+// Writes the image data of a rectangle of the pending frame
+static void
+compress(uint16_t x0, uint16_t y0, uint16_t w, uint16_t h)
+{
+	fputc(8, file); // minimum code size
+	lzw.bits = 0;
+	lzw.bit_count = 0;
+	lzw.block_length = 0;
+	lzw_reset();
+	lzw_code(LZW_CLEAR);
+
+	int32_t prefix = -1;
+	for (uint16_t y = y0; y < y0 + h; y++) {
+		const uint8_t *row = pending + y * width;
+		for (uint16_t x = x0; x < x0 + w; x++) {
+			const uint8_t pixel = row[x];
+			if (prefix < 0) {
+				prefix = pixel;
+				continue;
+			}
+			const uint32_t key = ((uint32_t)prefix << 8 | pixel) + 1;
+			uint32_t i = key % LZW_HASH_SIZE;
+			while (lzw.keys[i] && lzw.keys[i] != key) {
+				i = (i + 1) % LZW_HASH_SIZE;
+			}
+			if (lzw.keys[i]) {
+				prefix = lzw.codes[i];
+				continue;
+			}
+			lzw_code(prefix);
+			if (lzw.next_code < LZW_MAX_CODES) {
+				lzw.keys[i] = key;
+				lzw.codes[i] = lzw.next_code++;
+				// the decoder adds its codes one step later
+				if (lzw.next_code > (1 << lzw.code_size) && lzw.code_size < 12) {
+					lzw.code_size++;
+				}
+			} else {
+				lzw_code(LZW_CLEAR);
+				lzw_reset();
+			}
+			prefix = pixel;
+		}
+	}
+	lzw_code(prefix);
+	lzw_code(LZW_END);
+	if (lzw.bit_count) {
+		lzw_byte(lzw.bits);
+	}
+	if (lzw.block_length) {
+		fputc(lzw.block_length, file);
+		fwrite(lzw.block, 1, lzw.block_length, file);
+	}
+	fputc(0, file);
+}
+
+static void
+write_header()
+{
+	memcpy(global_palette, pending_palette, PALETTE_SIZE);
+	fwrite("GIF89a", 1, 6, file);
+	put16(width);
+	put16(height);
+	fputc(0xF7, file); // a global color table of 256 entries
+	fputc(0, file);
+	fputc(0, file);
+	fwrite(global_palette, 1, PALETTE_SIZE, file);
+	// loop forever
+	fwrite("\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 1, 19, file);
+	header_written = true;
+}
+
+// Finds the rectangle that changed since the last frame in the file
+static void
+changed_rect(uint16_t *x0, uint16_t *y0, uint16_t *w, uint16_t *h)
+{
+	uint16_t top = height, bottom = 0, left = width, right = 0;
+	for (uint16_t y = 0; y < height; y++) {
+		const uint8_t *a = pending + y * width;
+		const uint8_t *b = shown + y * width;
+		if (!memcmp(a, b, width)) {
+			continue;
+		}
+		if (top == height) {
+			top = y;
+		}
+		bottom = y + 1;
+		uint16_t l = 0, r = width;
+		while (a[l] == b[l]) {
+			l++;
+		}
+		while (a[r - 1] == b[r - 1]) {
+			r--;
+		}
+		left = l < left ? l : left;
+		right = r > right ? r : right;
+	}
+	if (top == height) {
+		// back to what it was: one pixel stands for the frame
+		top = left = 0;
+		bottom = right = 1;
+	}
+	*x0 = left;
+	*y0 = top;
+	*w = right - left;
+	*h = bottom - top;
+}
+
+// Writes the pending frame, to be shown for delay 1/100 s
+static void
+write_frame(uint16_t delay)
+{
+	uint16_t x0 = 0, y0 = 0, w = width, h = height;
+	bool local_palette = false;
+	if (!header_written) {
+		write_header();
+	} else if (memcmp(pending_palette, shown_palette, PALETTE_SIZE)) {
+		// every pixel has to be drawn again
+		local_palette = memcmp(pending_palette, global_palette, PALETTE_SIZE) != 0;
+	} else {
+		changed_rect(&x0, &y0, &w, &h);
+	}
+
+	// graphic control extension: keep the pixels outside the rectangle
+	fwrite("\x21\xF9\x04\x04", 1, 4, file);
+	put16(delay);
+	fputc(0, file);
+	fputc(0, file);
+
+	fputc(0x2C, file);
+	put16(x0);
+	put16(y0);
+	put16(w);
+	put16(h);
+	fputc(local_palette ? 0x87 : 0, file);
+	if (local_palette) {
+		fwrite(pending_palette, 1, PALETTE_SIZE, file);
+	}
+	compress(x0, y0, w, h);
+
+	for (uint16_t y = y0; y < y0 + h; y++) {
+		memcpy(shown + y * width + x0, pending + y * width + x0, w);
+	}
+	memcpy(shown_palette, pending_palette, PALETTE_SIZE);
+	if (ferror(file)) {
+		failed = true;
+	}
+}
+
+// in 1/100 s, at 60 frames per second
+static uint32_t
+frame_time(uint32_t number)
+{
+	return number * 5 / 3;
+}
+
+static void
+record(struct queued_frame *frame)
+{
+	const uint32_t size = width * height;
+	if (pending_valid && !memcmp(frame->pixels, pending, size) && !memcmp(frame->palette, pending_palette, PALETTE_SIZE)) {
+		// the pending frame is shown for longer
+		return;
+	}
+	if (pending_valid && frame_time(frame->number) - frame_time(pending_number) >= MIN_DELAY) {
+		write_frame(frame_time(frame->number) - frame_time(pending_number));
+		pending_valid = false;
+	}
+	if (!pending_valid) {
+		pending_number = frame->number;
+		pending_valid = true;
+	}
+	// the pixels change hands instead of being copied
+	uint8_t *pixels = pending;
+	pending = frame->pixels;
+	frame->pixels = pixels;
+	memcpy(pending_palette, frame->palette, PALETTE_SIZE);
+}
+
+#if ESP_PLATFORM
+static void
+gif_worker(void *arg)
+#else
+static int
+gif_worker(void *arg)
+#endif
+{
+	for (;;) {
+		gif_sem_wait(ready_frames);
+		record(&queue[next_record]);
+		next_record = (next_record + 1) % QUEUE_FRAMES;
+		gif_sem_post(free_frames);
+	}
+#if !ESP_PLATFORM
+	return 0;
+#endif
+}
+
+bool
+gif_recorder_begin(const char *path, uint16_t w, uint16_t h)
+{
+	file = fopen(path, "wb");
+	if (!file) {
+		printf("Cannot create %s\n", path);
+		return false;
+	}
+	width = w;
+	height = h;
+	for (int i = 0; i < QUEUE_FRAMES; i++) {
+		queue[i].pixels = malloc(width * height);
+	}
+	shown = malloc(width * height);
+	pending = malloc(width * height);
+
+	if (!free_frames) {
+		free_frames = gif_sem_create(QUEUE_FRAMES);
+		ready_frames = gif_sem_create(0);
+		if (free_frames && ready_frames) {
+#if ESP_PLATFORM
+			threaded = xTaskCreatePinnedToCore(gif_worker, "gif_recorder", 4096, NULL, 1, NULL, 0) == pdPASS;
+#else
+			threaded = SDL_CreateThread(gif_worker, "gif_recorder", NULL) != NULL;
+#endif
+		}
+	}
+	return true;
+}
+
+bool
+gif_recorder_frame(const uint8_t *pixels, const uint8_t *palette)
+{
+	const uint32_t number = frame_number++;
+	if (threaded && !gif_sem_trywait(free_frames)) {
+		dropped_frames++;
+		return !failed;
+	}
+
+	struct queued_frame *frame = &queue[next_fill];
+	memcpy(frame->pixels, pixels, width * height);
+	memcpy(frame->palette, palette, PALETTE_SIZE);
+	frame->number = number;
+	next_fill = (next_fill + 1) % QUEUE_FRAMES;
+
+	if (threaded) {
+		gif_sem_post(ready_frames);
+	} else {
+		record(frame);
+		next_record = next_fill;
+	}
+	return !failed;
+}
+
+void
+gif_recorder_end()
+{
+	if (!file) {
+		return;
+	}
+	if (threaded) {
+		for (int i = 0; i < QUEUE_FRAMES; i++) {
+			gif_sem_wait(free_frames);
+		}
+	}
+
+	if (pending_valid) {
+		const uint32_t delay = frame_time(frame_number) - frame_time(pending_number);
+		write_frame(delay > MIN_DELAY ? delay : MIN_DELAY);
+		pending_valid = false;
+	}
+	if (header_written) {
+		fputc(0x3B, file);
+	}
+	fclose(file);
+	file = NULL;
+	if (dropped_frames) {
+		printf("GIF: %u frames dropped\n", dropped_frames);
+	}
+
+	if (threaded) {
+		for (int i = 0; i < QUEUE_FRAMES; i++) {
+			gif_sem_post(free_frames);
+		}
+	}
+}
@@ -0,0 +1,27 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#ifndef _GIF_RECORDER_H_
+#define _GIF_RECORDER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// GIF recording of the 8 bit indexed framebuffer (-gif): frames are
+// copied into a small queue, and a worker compares them with what is
+// in the file so far, and compresses the rectangle that changed with
+// VERA's palette as it is. If the worker falls behind, frames are
+// dropped; the emulation never waits for it.
+
+bool gif_recorder_begin(const char *path, uint16_t width, uint16_t height);
+
+// Records a frame, which is shown for one VGA frame unless the next
+// ones are the same. palette is 256 RGB triples. Returns false if
+// writing the file failed.
+bool gif_recorder_frame(const uint8_t *pixels, const uint8_t *palette);
+
+// Waits for the worker, and finishes the file
+void gif_recorder_end(void);
+
+#endif
@@ -50,6 +50,17 @@ typedef enum {
 	RECORD_GIF_ACTIVE
 } gif_recorder_state_t;
 
+typedef enum {
+	EVE_MOCK_OFF,
+	EVE_MOCK_RAW,
+	EVE_MOCK_INFLATE,
+} eve_mock_t;
+
+// -frameskip auto: skip frames while the emulation is behind real time
+#define FRAMESKIP_AUTO (-1)
+// ... but still show at least every this many frames
+#define FRAMESKIP_AUTO_MAX 4
+
 extern uint8_t a, x, y, sp, status;
 extern uint16_t pc;
 extern uint8_t *RAM;
@@ -62,11 +73,14 @@ extern bool debugger_enabled;
 extern bool log_video;
 extern bool log_keyboard;
 extern bool log_speed;
+extern bool log_audio;
 extern echo_mode_t echo_mode;
 extern bool save_on_exit;
 extern bool disable_emu_cmd_keys;
 extern gif_recorder_state_t record_gif;
 extern char gif_path[];
+extern const char *capture_path;
+extern const char *shm_name;
 extern uint8_t *fsroot_path;
 extern uint8_t *startin_path;
 extern uint8_t keymap;
@@ -75,6 +89,11 @@ extern bool testbench;
 extern bool has_via2;
 extern uint32_t host_sample_rate;
 extern bool enable_midline;
+extern int frameskip;
+extern eve_mock_t eve_mock;
+extern bool stream_lines;
+extern bool stream_lines_check;
+extern bool eve_layers;
 
 extern void machine_dump(const char* reason);
 extern void machine_reset();
@@ -28,7 +28,7 @@ void
 j2c_start_audio(bool start)
 {
 	if (start)
-		audio_init(NULL, 8);
+		audio_init(NULL, 8, RESAMPLER_DEFAULT);
 	else
 		audio_close();
 }
@@ -37,10 +37,10 @@
 #include "joystick.h"
 #include "utf8_encode.h"
 #include "rom_symbols.h"
-#include "ymglue.h"
 #include "audio.h"
 #include "version.h"
 #include "wav_recorder.h"
+#include "sound_log.h"
 #include "testbench.h"
 #include "cartridge.h"
 
@@ -98,6 +98,7 @@ uint16_t num_ram_banks = 64; // 512 KB default
 
 bool log_video = false;
 bool log_speed = false;
+bool log_audio = false;
 bool log_keyboard = false;
 bool dump_cpu = false;
 bool dump_ram = true;
@@ -114,6 +115,9 @@ bool has_via2 = false;
 gif_recorder_state_t record_gif = RECORD_GIF_DISABLED;
 char gif_path[PATH_MAX];
 const char *wav_path = NULL;
+const char *capture_path = NULL;
+const char *shm_name = NULL;
+const char *sound_log_path = NULL;
 uint8_t *fsroot_path = NULL;
 uint8_t *startin_path = NULL;
 uint8_t keymap = 0; // KERNAL's default
@@ -126,6 +130,11 @@ bool headless = false;
 bool fullscreen = false;
 bool testbench = false;
 bool enable_midline = false;
+int frameskip = 0;
+eve_mock_t eve_mock = EVE_MOCK_OFF;
+bool stream_lines = false;
+bool stream_lines_check = false;
+bool eve_layers = false;
 bool ym2151_irq_support = false;
 const char *cartridge_path = NULL;
 
@@ -402,6 +411,11 @@ usage()
 	printf("\tStart the -prg/-bas program using RUN\n");
 	printf("-warp\n");
 	printf("\tEnable warp mode, run emulator as fast as possible.\n");
+	printf("-frameskip {off|auto|<n>}\n");
+	printf("\tSkip rendering frames to save host time: \"auto\" skips while\n");
+	printf("\tthe emulation is behind real time, <n> renders one frame out of\n");
+	printf("\tevery n+1. IRQs and sprite collisions are not affected.\n");
+	printf("\tThe default is \"off\" (in warp mode, every 4th frame is shown).\n");
 	printf("-echo [{iso|raw}]\n");
 	printf("\tPrint all KERNAL output to the host's stdout.\n");
 	printf("\tBy default, everything but printable ASCII characters get\n");
@@ -410,8 +424,8 @@ usage()
 	printf("\t\"raw\" will not do any substitutions.\n");
 	printf("\tWith the BASIC statement \"LIST\", this can be used\n");
 	printf("\tto detokenize a BASIC program.\n");
-	printf("-log {K|S|V}...\n");
-	printf("\tEnable logging of (K)eyboard, (S)peed, (V)ideo.\n");
+	printf("-log {K|S|V|A}...\n");
+	printf("\tEnable logging of (K)eyboard, (S)peed, (V)ideo, (A)udio.\n");
 	printf("\tMultiple characters are possible, e.g. -log KS\n");
 	printf("-gif <file.gif>[,wait]\n");
 	printf("\tRecord a gif for the video output.\n");
@@ -425,6 +439,18 @@ usage()
 	printf("\tPOKE $9FB6,2 to automatically begin recording on the first non-zero audio signal.\n");
 	printf("\tPOKE $9FB6,1 to begin recording immediately.\n");
 	printf("\tPOKE $9FB6,0 to pause.\n");
+	printf("-capture <file>\n");
+	printf("\tWrite every frame as indexed pixels with its palette, and the\n");
+	printf("\taudio, to a file or a named pipe, for an external encoder.\n");
+	printf("\tThe format is described in src/capture.h.\n");
+	printf("-shm <name>\n");
+	printf("\tPublish the last frames and the audio in POSIX shared memory\n");
+	printf("\t(/dev/shm/<name> on Linux) for other processes.\n");
+	printf("\tThe layout is described in src/shm_export.h.\n");
+	printf("-soundlog <file>\n");
+	printf("\tLog every write to the YM2151, the PSG and the PCM FIFO with\n");
+	printf("\tits CPU clock, for testbench/audiobench.c to replay.\n");
+	printf("\tThe format is described in src/sound_log.h.\n");
 	printf("-scale {1|2|3|4}\n");
 	printf("\tScale output to an integer multiple of 640x480\n");
 	printf("-quality {nearest|linear|best}\n");
@@ -456,17 +482,27 @@ usage()
 	printf("\tEnable binding a gamepad to SNES controller port 4\n");
 	printf("-sound <output device>\n");
 	printf("\tSet the output device used for audio emulation\n");
-	printf("\tIf output device is 'none', no audio is generated\n");
+	printf("\tIf output device is 'none', no audio is played; with -wav, -capture\n");
+	printf("\tor -shm it is still generated for the recording.\n");
 	printf("-abufs <number of audio buffers>\n");
 	printf("\tSet the number of audio buffers used for playback. (default: 8)\n");
+	printf("\tThe emulator keeps half of them filled, at least 2 are needed.\n");
 	printf("\tIncreasing this will reduce stutter on slower computers,\n");
 	printf("\tbut will increase audio latency.\n");
+	printf("-resample {nearest|normal|high}\n");
+	printf("\tSet how the audio is converted to the sample rate of the output\n");
+	printf("\tdevice: the nearest sample, a 4 tap filter (default) or a\n");
+	printf("\t32 tap filter that also suits recordings with -wav or -capture.\n");
 	printf("-rtc\n");
 	printf("\tSet the real-time-clock to the current system time and date.\n");
 	printf("-via2\n");
 	printf("\tInstall the second VIA chip expansion at $9F10\n");
 	printf("-testbench\n");
 	printf("\tHeadless mode for unit testing with an external test runner\n");
+	printf("-headless\n");
+	printf("\tRun without a window or sound output, as fast as possible.\n");
+	printf("\tWith -wav, the audio is still recorded, in step with emulated time.\n");
+	printf("\tVERA still generates its timing and interrupts, but no picture.\n");
 	printf("-mhz <integer>\n");
 	printf("\tRun the emulator with a system clock speed other than the default of\n");
 	printf("\t8 MHz. Valid values are in the range of 1-40, inclusive. This option\n");
@@ -475,9 +511,25 @@ usage()
 	printf("-midline-effects\n");
 	printf("\tApproximate mid-line raster effects when changing tile, sprite,\n");
 	printf("\tand palette data. Requires a fast host CPU.\n");
+	printf("-eve-mock [raw]\n");
+	printf("\tAlso send every frame to a simulated EVE display, like on the\n");
+	printf("\tESP32, and print the amount of data per frame on exit.\n");
+	printf("\tChanged lines are sent compressed where that is smaller,\n");
+	printf("\t\"raw\" always sends them uncompressed.\n");
+	printf("-stream-lines [check]\n");
+	printf("\tDon't keep a framebuffer: every line goes to the EVE display as\n");
+	printf("\tsoon as it is complete, into the buffer that is shown. Saves\n");
+	printf("\t300 KB, but screenshots and GIF recording are not available.\n");
+	printf("\tOn the host, this implies -eve-mock. \"check\" keeps a framebuffer\n");
+	printf("\tanyway and compares every line of the EVE's screen with it after\n");
+	printf("\teach frame.\n");
+	printf("-eve-layers\n");
+	printf("\t(Experimental) Have the EVE display draw the tile layers and\n");
+	printf("\tsprites itself from a display list, for frames without raster\n");
+	printf("\teffects. On the host, this implies -eve-mock, and every display\n");
+	printf("\tlist is checked against the framebuffer.\n");
 	printf("-enable-ym2151-irq\n");
-	printf("\tConnect the YM2151 IRQ source to the emulated CPU. This option increases\n");
-	printf("\tCPU usage as audio render is triggered for every CPU instruction.\n");
+	printf("\tConnect the YM2151 IRQ source to the emulated CPU.\n");
 #ifdef TRACE
 	printf("-trace [<address>]\n");
 	printf("\tPrint instruction trace. Optionally, a trigger address\n");
@@ -511,9 +563,11 @@ main(int argc, const char *argv[])
 	bool run_test = false;
 	int test_number = 0;
 	int audio_buffers = 8;
+	resampler_quality_t audio_quality = RESAMPLER_DEFAULT;
 	bool zeroram = false;
 
 	const char *audio_dev_name = NULL;
+	bool sound = false;
 
 	run_after_load = false;
 
@@ -648,6 +702,25 @@ main(int argc, const char *argv[])
 			argc--;
 			argv++;
 			warp_mode = true;
+		} else if (!strcmp(argv[0], "-frameskip")) {
+			argc--;
+			argv++;
+			if (!argc || argv[0][0] == '-') {
+				usage();
+			}
+			if (!strcmp(argv[0], "off")) {
+				frameskip = 0;
+			} else if (!strcmp(argv[0], "auto")) {
+				frameskip = FRAMESKIP_AUTO;
+			} else {
+				char *end;
+				frameskip = (int)strtol(argv[0], &end, 10);
+				if (*end || frameskip < 0 || frameskip > 59) {
+					usage();
+				}
+			}
+			argc--;
+			argv++;
 		} else if (!strcmp(argv[0], "-echo")) {
 			argc--;
 			argv++;
@@ -681,6 +754,9 @@ main(int argc, const char *argv[])
 					case 'v':
 						log_video = true;
 						break;
+					case 'a':
+						log_audio = true;
+						break;
 					default:
 						usage();
 				}
@@ -739,6 +815,33 @@ main(int argc, const char *argv[])
 			wav_path = argv[0];
 			argv++;
 			argc--;
+		} else if (!strcmp(argv[0], "-capture")) {
+			argc--;
+			argv++;
+			if (!argc || argv[0][0] == '-') {
+				usage();
+			}
+			capture_path = argv[0];
+			argv++;
+			argc--;
+		} else if (!strcmp(argv[0], "-shm")) {
+			argc--;
+			argv++;
+			if (!argc || argv[0][0] == '-') {
+				usage();
+			}
+			shm_name = argv[0];
+			argv++;
+			argc--;
+		} else if (!strcmp(argv[0], "-soundlog")) {
+			argc--;
+			argv++;
+			if (!argc || argv[0][0] == '-') {
+				usage();
+			}
+			sound_log_path = argv[0];
+			argv++;
+			argc--;
 		} else if (!strcmp(argv[0], "-debug")) {
 			argc--;
 			argv++;
@@ -876,6 +979,14 @@ main(int argc, const char *argv[])
 			audio_buffers = (int)strtol(argv[0], NULL, 10);
 			argc--;
 			argv++;
+		} else if (!strcmp(argv[0], "-resample")) {
+			argc--;
+			argv++;
+			if (!argc || !resampler_parse_quality(argv[0], &audio_quality)) {
+				usage();
+			}
+			argc--;
+			argv++;
 		} else if (!strcmp(argv[0], "-rtc")) {
 			argc--;
 			argv++;
@@ -931,6 +1042,10 @@ main(int argc, const char *argv[])
 			argv++;
 			testbench=true;
 			headless=true;
+		} else if (!strcmp(argv[0], "-headless")){
+			argc--;
+			argv++;
+			headless=true;
 		} else if (!strcmp(argv[0], "-mhz")){
 			argc--;
 			argv++;
@@ -943,6 +1058,36 @@ main(int argc, const char *argv[])
 			}
 			argc--;
 			argv++;
+		} else if (!strcmp(argv[0], "-stream-lines")){
+			argc--;
+			argv++;
+			stream_lines = true;
+			if (argc && argv[0][0] != '-') {
+				if (!strcmp(argv[0], "check")) {
+					stream_lines_check = true;
+				} else {
+					usage();
+				}
+				argc--;
+				argv++;
+			}
+		} else if (!strcmp(argv[0], "-eve-layers")){
+			argc--;
+			argv++;
+			eve_layers = true;
+		} else if (!strcmp(argv[0], "-eve-mock")){
+			argc--;
+			argv++;
+			eve_mock = EVE_MOCK_INFLATE;
+			if (argc && argv[0][0] != '-') {
+				if (!strcmp(argv[0], "raw")) {
+					eve_mock = EVE_MOCK_RAW;
+				} else {
+					usage();
+				}
+				argc--;
+				argv++;
+			}
 		} else if (!strcmp(argv[0], "-midline-effects")){
 			argc--;
 			argv++;
@@ -1042,11 +1187,22 @@ printf("ROM loaded %u (%02X %02X ... %02X %02X)\n\n", rom_size, ROM[0], ROM[1],
 			fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
 			exit(-1);
 		}
-		audio_init(audio_dev_name, audio_buffers);
+		sound = audio_init(audio_dev_name, audio_buffers, audio_quality);
+	}
+	if (!sound && (wav_path || capture_path || shm_name)) {
+		// nothing to play it on, but there is a recording
+		audio_init_offline(audio_quality);
+	}
+	if (!headless) {
 		video_init(window_scale, screen_x_scale, scale_quality, fullscreen, window_opacity);
+	} else {
+		video_init_headless();
 	}
 
 	wav_recorder_set_path(wav_path);
+	if (sound_log_path) {
+		sound_log_begin(sound_log_path, MHZ);
+	}
 
 	joystick_init();
 
@@ -1072,9 +1228,11 @@ printf("ROM loaded %u (%02X %02X ... %02X %02X)\n\n", rom_size, ROM[0], ROM[1],
 }
 
 void main_shutdown() {
+	// the end of the audio goes to the recorders first
+	audio_close();
+	wav_recorder_shutdown();
+	sound_log_end();
 	if (!headless){
-		wav_recorder_shutdown();
-		audio_close();
 		video_end();
 		SDL_Quit();
 	}
@@ -1401,7 +1559,7 @@ emulator_loop(void *param)
 		if (has_via2) {
 			via2_step(clocks);
 		}
-		if (!headless) {
+		if (!testbench) {
 			new_frame |= video_step(MHZ, clocks, false);
 		}
 
@@ -1410,7 +1568,7 @@ emulator_loop(void *param)
 		}
 		rtc_step(clocks);
 
-		if (!headless) {
+		if (!testbench) {
 			audio_step(clocks);
 		}
 
@@ -1438,12 +1596,10 @@ emulator_loop(void *param)
 #endif
 		}
 
-		// The optimization from the opportunistic batching of audio rendering 
-		// is lost if we need to track the YM2151 IRQ, so it has been made a
-		// command-line switch that's disabled by default.
-		if (ym2151_irq_support) {
-			audio_render();
-			if (YM_irq()) irq6502();
+		// The YM2151's timers are computed, not rendered, so this
+		// doesn't cost any audio batching
+		if (ym2151_irq_support && audio_ym_irq()) {
+			irq6502();
 		}
 
 		if (video_get_irq_out() || via1_irq() || (has_via2 && via2_irq())) {
@@ -11,7 +11,6 @@
 #include "via.h"
 #include "memory.h"
 #include "video.h"
-#include "ymglue.h"
 #include "cpu/fake6502.h"
 #include "wav_recorder.h"
 #include "audio.h"
@@ -155,8 +154,7 @@ real_read6502(uint16_t address, bool debugOn, uint8_t bank)
 				clockticks6502 += 3;
 			}
 			if (address == 0x9f41) {
-				audio_render();
-				return YM_read_status();
+				return audio_read_ym_status();
 			}
 			return 0x9f; // open bus read
 		} else if (address >= 0x9fb0 && address < 0x9fc0) {
@@ -224,8 +222,7 @@ write6502(uint16_t address, uint8_t value)
 			if (address == 0x9f40) {        // YM address
 				addr_ym = value;
 			} else if (address == 0x9f41) { // YM data
-				audio_render();
-				YM_write_reg(addr_ym, value);
+				audio_write_ym(addr_ym, value);
 			}
 			// TODO:
 			//   $9F42 & $9F43: SAA1099P
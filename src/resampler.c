@@ -0,0 +1,329 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#include "resampler.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define PI 3.14159265358979323846
+#define PHASE_BITS 8
+#define PHASES (1 << PHASE_BITS)
+
+// at least, for an output rate that is not lower than the source's
+#define HIGH_TAPS 32
+// of the lower of the two Nyquist frequencies, where the response is
+// down by 6 dB; the Kaiser window's beta sets the stopband's attenuation
+// against the width of the transition
+#define HIGH_CUTOFF 0.88
+#define HIGH_BETA 7.0
+
+// windowed sinc, the 4 tap filter: phase p has the coefficients
+// filter[256 + p], filter[p], filter[255 - p] and filter[511 - p]
+static const int16_t filter[512] = {
+	32767,32765,32761,32755,32746,32736,32723,32707,32690,32670,32649,32625,32598,32570,32539,32507,
+	32472,32435,32395,32354,32310,32265,32217,32167,32115,32061,32004,31946,31885,31823,31758,31691,
+	31623,31552,31479,31404,31327,31248,31168,31085,31000,30913,30825,30734,30642,30547,30451,30353,
+	30253,30151,30048,29943,29835,29726,29616,29503,29389,29273,29156,29037,28916,28793,28669,28544,
+	28416,28288,28157,28025,27892,27757,27621,27483,27344,27204,27062,26918,26774,26628,26481,26332,
+	26182,26031,25879,25726,25571,25416,25259,25101,24942,24782,24621,24459,24296,24132,23967,23801,
+	23634,23466,23298,23129,22959,22788,22616,22444,22271,22097,21923,21748,21572,21396,21219,21042,
+	20864,20686,20507,20328,20148,19968,19788,19607,19426,19245,19063,18881,18699,18517,18334,18152,
+	17969,17786,17603,17420,17237,17054,16871,16688,16505,16322,16139,15957,15774,15592,15409,15227,
+	15046,14864,14683,14502,14321,14141,13961,13781,13602,13423,13245,13067,12890,12713,12536,12360,
+	12185,12010,11836,11663,11490,11317,11146,10975,10804,10635,10466,10298,10131, 9964, 9799, 9634,
+	 9470, 9306, 9144, 8983, 8822, 8662, 8504, 8346, 8189, 8033, 7878, 7724, 7571, 7419, 7268, 7118,
+	 6969, 6822, 6675, 6529, 6385, 6241, 6099, 5958, 5818, 5679, 5541, 5405, 5269, 5135, 5002, 4870,
+	 4739, 4610, 4482, 4355, 4229, 4104, 3981, 3859, 3738, 3619, 3500, 3383, 3268, 3153, 3040, 2928,
+	 2817, 2708, 2600, 2493, 2388, 2284, 2181, 2079, 1979, 1880, 1783, 1686, 1591, 1498, 1405, 1314,
+	 1225, 1136, 1049,  963,  879,  795,  714,  633,  554,  476,  399,  323,  249,  176,  105,   34,
+	  -34, -102, -168, -234, -298, -361, -422, -482, -542, -599, -656, -712, -766, -819, -871, -922,
+	 -971,-1020,-1067,-1113,-1158,-1202,-1244,-1286,-1326,-1366,-1404,-1441,-1477,-1512,-1546,-1579,
+	-1611,-1642,-1671,-1700,-1728,-1755,-1781,-1806,-1830,-1852,-1874,-1896,-1916,-1935,-1953,-1971,
+	-1987,-2003,-2018,-2032,-2045,-2058,-2069,-2080,-2090,-2099,-2108,-2116,-2123,-2129,-2134,-2139,
+	-2143,-2147,-2150,-2152,-2153,-2154,-2154,-2154,-2153,-2151,-2149,-2146,-2143,-2139,-2135,-2130,
+	-2124,-2118,-2112,-2105,-2098,-2090,-2082,-2073,-2064,-2054,-2045,-2034,-2024,-2012,-2001,-1989,
+	-1977,-1965,-1952,-1939,-1926,-1912,-1898,-1884,-1870,-1855,-1840,-1825,-1810,-1794,-1778,-1762,
+	-1746,-1730,-1714,-1697,-1680,-1663,-1646,-1629,-1612,-1595,-1577,-1560,-1542,-1525,-1507,-1489, 
+	-1471,-1453,-1435,-1418,-1400,-1382,-1364,-1346,-1328,-1310,-1292,-1274,-1256,-1238,-1220,-1203,
+	-1185,-1167,-1150,-1132,-1115,-1097,-1080,-1063,-1046,-1029,-1012, -995, -978, -962, -945, -929,
+     -912, -896, -880, -864, -849, -833, -817, -802, -787, -772, -757, -742, -727, -713, -699, -684,
+	 -670, -656, -643, -629, -616, -603, -589, -577, -564, -551, -539, -526, -514, -502, -491, -479,
+	 -468, -456, -445, -434, -423, -413, -402, -392, -381, -371, -361, -352, -342, -333, -323, -314,
+	 -305, -296, -288, -279, -270, -262, -254, -246, -238, -230, -222, -215, -207, -200, -193, -186,
+	 -179, -172, -165, -158, -152, -145, -139, -133, -127, -120, -114, -108, -103,  -97,  -91,  -85,
+	  -80,  -74,  -69,  -63,  -58,  -53,  -47,  -42,  -37,  -32,  -27,  -22,  -17,  -12,   -7,   -2
+};
+
+// Zeroth order modified Bessel function of the first kind, for the
+// Kaiser window
+static double
+bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+static void
+init_normal(struct resampler *r)
+{
+	for (int p = 0; p < PHASES; p++) {
+		int16_t *c = &r->coefs[p * 4];
+		c[0] = filter[256 + p];
+		c[1] = filter[p];
+		c[2] = filter[255 - p];
+		c[3] = filter[511 - p];
+	}
+}
+
+static void
+init_high(struct resampler *r)
+{
+	// cutoff relative to the source's Nyquist frequency
+	double ratio = (double)(1 << r->frac_bits) / r->step;
+	double fc = HIGH_CUTOFF * (ratio < 1.0 ? ratio : 1.0);
+	const int taps = r->taps;
+	const int center = taps / 2 - 1;
+	for (int p = 0; p < PHASES; p++) {
+		int16_t *c = &r->coefs[p * taps];
+		double h[RESAMPLER_MAX_TAPS];
+		double sum = 0;
+		for (int t = 0; t < taps; t++) {
+			// distance of the output sample from tap t
+			double x = t - center - (double)p / PHASES;
+			double u = x / (taps / 2);
+			double w = u * u < 1.0 ? bessel_i0(HIGH_BETA * sqrt(1.0 - u * u)) / bessel_i0(HIGH_BETA) : 0.0;
+			h[t] = w * (x == 0 ? 1.0 : sin(PI * fc * x) / (PI * fc * x));
+			sum += h[t];
+		}
+		// a gain of 1, the rounding goes to the largest coefficient
+		int32_t total = 0;
+		int largest = 0;
+		for (int t = 0; t < taps; t++) {
+			c[t] = (int16_t)lrint(h[t] * 32768 / sum);
+			total += c[t];
+			if (abs(c[t]) > abs(c[largest])) {
+				largest = t;
+			}
+		}
+		c[largest] += 32768 - total;
+	}
+}
+
+bool
+resampler_init(struct resampler *r, resampler_quality_t quality, uint32_t step, uint8_t frac_bits)
+{
+	memset(r, 0, sizeof(*r));
+	r->quality = quality;
+	r->step = step;
+	r->nominal_step = step;
+	r->frac_bits = frac_bits;
+
+	// The sample rates are only known to the Hz, so a ratio that is
+	// off by less than one in 65536 is a whole number
+	uint32_t one = 1 << frac_bits;
+	uint32_t whole = (step + one / 2) >> frac_bits;
+	uint32_t off = step > whole << frac_bits ? step - (whole << frac_bits) : (whole << frac_bits) - step;
+	if (whole > 0 && off < (one >> 16)) {
+		r->ratio = whole;
+	}
+
+	switch (quality) {
+		case RESAMPLER_NEAREST:
+			// the closest sample is one of the middle two
+			r->taps = 4;
+			return true;
+		case RESAMPLER_NORMAL:
+			r->taps = 4;
+			break;
+		case RESAMPLER_HIGH:
+			// the transition band is as wide at the output's rate
+			// if that is the lower one, in multiples of 8
+			r->taps = ((uint64_t)HIGH_TAPS * step + (8ULL << frac_bits) - 1) / (8ULL << frac_bits) * 8;
+			if (r->taps < HIGH_TAPS) {
+				r->taps = HIGH_TAPS;
+			}
+			if (r->taps > RESAMPLER_MAX_TAPS) {
+				r->taps = RESAMPLER_MAX_TAPS;
+			}
+			break;
+	}
+	r->coefs = malloc(PHASES * r->taps * sizeof(int16_t));
+	if (!r->coefs) {
+		return false;
+	}
+	if (quality == RESAMPLER_NORMAL) {
+		init_normal(r);
+	} else {
+		init_high(r);
+	}
+	return true;
+}
+
+void
+resampler_free(struct resampler *r)
+{
+	free(r->coefs);
+	r->coefs = NULL;
+}
+
+// Whether every output sample is at the same phase, which is only true
+// for a whole ratio as long as the step hasn't been adjusted
+static bool
+at_ratio(const struct resampler *r)
+{
+	return r->ratio && r->step == r->nominal_step;
+}
+
+// Same rate: the samples as they are, at the filters' middle tap, so
+// that nothing moves when the step is adjusted
+static void
+run_copy(const struct resampler *r, const int16_t *src_l, const int16_t *src_r, uint32_t pos, uint32_t count, int32_t *out_l, int32_t *out_r)
+{
+	src_l += r->taps / 2 - 1;
+	src_r += r->taps / 2 - 1;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t j = pos >> r->frac_bits;
+		out_l[i] = src_l[j] * 32768;
+		out_r[i] = src_r[j] * 32768;
+		pos += r->step;
+	}
+}
+
+static void
+run_nearest(const struct resampler *r, const int16_t *src_l, const int16_t *src_r, uint32_t pos, uint32_t count, int32_t *out_l, int32_t *out_r)
+{
+	// between taps 1 and 2, like the 4 tap filter
+	pos += (1 << r->frac_bits) + (1 << (r->frac_bits - 1));
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t j = pos >> r->frac_bits;
+		out_l[i] = src_l[j] * 32768;
+		out_r[i] = src_r[j] * 32768;
+		pos += r->step;
+	}
+}
+
+static void
+run_4_taps(const struct resampler *r, const int16_t *src_l, const int16_t *src_r, uint32_t pos, uint32_t count, int32_t *out_l, int32_t *out_r)
+{
+	const uint32_t phase_mask = at_ratio(r) ? 0 : PHASES - 1;
+	const uint8_t phase_shift = r->frac_bits - PHASE_BITS;
+	for (uint32_t i = 0; i < count; i++) {
+		const int16_t *c = &r->coefs[((pos >> phase_shift) & phase_mask) * 4];
+		const int16_t *l = &src_l[pos >> r->frac_bits];
+		const int16_t *s = &src_r[pos >> r->frac_bits];
+#if defined(__SSE2__)
+		// both channels in one vector: l0..l3 r0..r3
+		__m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)l), _mm_loadl_epi64((const __m128i *)s));
+		__m128i k = _mm_loadl_epi64((const __m128i *)c);
+		__m128i sum = _mm_madd_epi16(v, _mm_unpacklo_epi64(k, k));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		out_l[i] = _mm_cvtsi128_si32(sum);
+		out_r[i] = _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+#elif HAVE_NEON
+		int16x4_t k = vld1_s16(c);
+		int32x4_t sum_l = vmull_s16(vld1_s16(l), k);
+		int32x4_t sum_r = vmull_s16(vld1_s16(s), k);
+		int32x2_t sum = vpadd_s32(vadd_s32(vget_low_s32(sum_l), vget_high_s32(sum_l)),
+		                          vadd_s32(vget_low_s32(sum_r), vget_high_s32(sum_r)));
+		out_l[i] = vget_lane_s32(sum, 0);
+		out_r[i] = vget_lane_s32(sum, 1);
+#else
+		out_l[i] = l[0] * c[0] + l[1] * c[1] + l[2] * c[2] + l[3] * c[3];
+		out_r[i] = s[0] * c[0] + s[1] * c[1] + s[2] * c[2] + s[3] * c[3];
+#endif
+		pos += r->step;
+	}
+}
+
+// Any multiple of 8 taps
+static void
+run_taps(const struct resampler *r, const int16_t *src_l, const int16_t *src_r, uint32_t pos, uint32_t count, int32_t *out_l, int32_t *out_r)
+{
+	const uint32_t taps = r->taps;
+	const uint32_t phase_mask = at_ratio(r) ? 0 : PHASES - 1;
+	const uint8_t phase_shift = r->frac_bits - PHASE_BITS;
+	for (uint32_t i = 0; i < count; i++) {
+		const int16_t *c = &r->coefs[((pos >> phase_shift) & phase_mask) * taps];
+		const int16_t *l = &src_l[pos >> r->frac_bits];
+		const int16_t *s = &src_r[pos >> r->frac_bits];
+#if defined(__SSE2__)
+		__m128i sum_l = _mm_setzero_si128();
+		__m128i sum_r = _mm_setzero_si128();
+		for (uint32_t t = 0; t < taps; t += 8) {
+			__m128i k = _mm_loadu_si128((const __m128i *)&c[t]);
+			sum_l = _mm_add_epi32(sum_l, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)&l[t]), k));
+			sum_r = _mm_add_epi32(sum_r, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)&s[t]), k));
+		}
+		// l0+l2 r0+r2 l1+l3 r1+r3, then the halves
+		__m128i sum = _mm_add_epi32(_mm_unpacklo_epi32(sum_l, sum_r), _mm_unpackhi_epi32(sum_l, sum_r));
+		sum = _mm_add_epi32(sum, _mm_unpackhi_epi64(sum, sum));
+		out_l[i] = _mm_cvtsi128_si32(sum);
+		out_r[i] = _mm_cvtsi128_si32(_mm_srli_si128(sum, 4));
+#elif HAVE_NEON
+		int32x4_t sum_l = vdupq_n_s32(0);
+		int32x4_t sum_r = vdupq_n_s32(0);
+		for (uint32_t t = 0; t < taps; t += 4) {
+			int16x4_t k = vld1_s16(&c[t]);
+			sum_l = vmlal_s16(sum_l, vld1_s16(&l[t]), k);
+			sum_r = vmlal_s16(sum_r, vld1_s16(&s[t]), k);
+		}
+		int32x2_t sum = vpadd_s32(vadd_s32(vget_low_s32(sum_l), vget_high_s32(sum_l)),
+		                          vadd_s32(vget_low_s32(sum_r), vget_high_s32(sum_r)));
+		out_l[i] = vget_lane_s32(sum, 0);
+		out_r[i] = vget_lane_s32(sum, 1);
+#else
+		int32_t sum_l = 0;
+		int32_t sum_r = 0;
+		for (uint32_t t = 0; t < taps; t++) {
+			sum_l += l[t] * c[t];
+			sum_r += s[t] * c[t];
+		}
+		out_l[i] = sum_l;
+		out_r[i] = sum_r;
+#endif
+		pos += r->step;
+	}
+}
+
+void
+resampler_run(const struct resampler *r, const int16_t *src_l, const int16_t *src_r, uint32_t pos, uint32_t count, int32_t *out_l, int32_t *out_r)
+{
+	if (r->ratio == 1 && at_ratio(r)) {
+		run_copy(r, src_l, src_r, pos, count, out_l, out_r);
+	} else if (r->quality == RESAMPLER_NEAREST) {
+		run_nearest(r, src_l, src_r, pos, count, out_l, out_r);
+	} else if (r->taps == 4) {
+		run_4_taps(r, src_l, src_r, pos, count, out_l, out_r);
+	} else {
+		run_taps(r, src_l, src_r, pos, count, out_l, out_r);
+	}
+}
+
+bool
+resampler_parse_quality(const char *name, resampler_quality_t *quality)
+{
+	if (!strcmp(name, "nearest")) {
+		*quality = RESAMPLER_NEAREST;
+	} else if (!strcmp(name, "normal")) {
+		*quality = RESAMPLER_NORMAL;
+	} else if (!strcmp(name, "high")) {
+		*quality = RESAMPLER_HIGH;
+	} else {
+		return false;
+	}
+	return true;
+}
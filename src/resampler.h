@@ -0,0 +1,52 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Polyphase resampling of a source to the host's sample rate, for a
+// block of output samples at a time. An output sample is made of
+// "taps" consecutive source samples, weighted with one of 256 sets of
+// coefficients (phases) picked by the fraction of its position.
+typedef enum {
+	RESAMPLER_NEAREST, // the closest source sample, no filter
+	RESAMPLER_NORMAL,  // 4 tap windowed sinc
+	RESAMPLER_HIGH,    // 32 to 64 tap windowed sinc, low pass below both Nyquist frequencies
+} resampler_quality_t;
+
+#if ESP_PLATFORM
+#define RESAMPLER_DEFAULT RESAMPLER_NEAREST
+#else
+#define RESAMPLER_DEFAULT RESAMPLER_NORMAL
+#endif
+
+#define RESAMPLER_MAX_TAPS 64
+
+struct resampler {
+	resampler_quality_t quality;
+	uint32_t taps;       // source samples needed from an output sample's position on
+	uint32_t step;       // source samples per output sample, in frac_bits fixed point
+	uint8_t frac_bits;
+	uint32_t nominal_step; // the step given to resampler_init(), which ratio is of
+	uint32_t ratio;      // source samples per output sample if that is a whole number, otherwise 0
+	int16_t *coefs;      // taps coefficients per phase, 1.0 is 32768
+};
+
+// step and frac_bits as above. The step may be changed between runs to
+// follow the host's rate; the whole ratio's shortcuts are only taken
+// while it is the nominal one.
+bool resampler_init(struct resampler *r, resampler_quality_t quality, uint32_t step, uint8_t frac_bits);
+void resampler_free(struct resampler *r);
+
+// Renders count output samples, the first one at pos in the planar
+// source channels src_l and src_r, which have the taps' samples from
+// the last position on. Positions are 32 bits, so all of them have to be
+// less than 1 << (32 - frac_bits) source samples. Output samples are
+// 1.0 = 32768 times the source's scale.
+void resampler_run(const struct resampler *r, const int16_t *src_l, const int16_t *src_r, uint32_t pos, uint32_t count, int32_t *out_l, int32_t *out_r);
+
+// "nearest", "normal" or "high"; false for anything else
+bool resampler_parse_quality(const char *name, resampler_quality_t *quality);
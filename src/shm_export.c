@@ -0,0 +1,162 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#ifndef __APPLE__
+#define _XOPEN_SOURCE   600
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "shm_export.h"
+
+#if !ESP_PLATFORM && !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define HAVE_SHM 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define ALIGNMENT 64
+
+#if HAVE_SHM
+static char object_name[256];
+static uint8_t *shm;
+static size_t shm_size;
+static struct shm_export_header *header;
+
+static uint32_t
+align(uint32_t size)
+{
+	return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+static struct shm_export_frame *
+frame_at(uint32_t index)
+{
+	return (struct shm_export_frame *)(shm + header->frames_offset + index * header->frame_size);
+}
+#endif
+
+bool
+shm_export_begin(const char *name, uint16_t width, uint16_t height, uint32_t frame_rate_num, uint32_t frame_rate_den, uint32_t sample_rate)
+{
+#if HAVE_SHM
+	// the name of a shared memory object starts with a slash
+	snprintf(object_name, sizeof(object_name), "%s%s", name[0] == '/' ? "" : "/", name);
+
+	// a second of audio at least
+	uint32_t audio_capacity = 0;
+	if (sample_rate) {
+		audio_capacity = 1;
+		while (audio_capacity < sample_rate) {
+			audio_capacity <<= 1;
+		}
+	}
+	const uint32_t frame_size = align(sizeof(struct shm_export_frame) + width * height);
+	const uint32_t frames_offset = align(sizeof(struct shm_export_header));
+	const uint32_t audio_offset = frames_offset + SHM_EXPORT_FRAMES * frame_size;
+	shm_size = audio_offset + audio_capacity * 2 * sizeof(int16_t);
+
+	const int fd = shm_open(object_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Cannot create shared memory %s\n", object_name);
+		return false;
+	}
+	if (ftruncate(fd, shm_size) < 0) {
+		printf("Cannot resize shared memory %s\n", object_name);
+		close(fd);
+		shm_unlink(object_name);
+		return false;
+	}
+	shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		printf("Cannot map shared memory %s\n", object_name);
+		shm = NULL;
+		shm_unlink(object_name);
+		return false;
+	}
+
+	// a new object is zeroed
+	header = (struct shm_export_header *)shm;
+	header->width = width;
+	header->height = height;
+	header->frame_rate_num = frame_rate_num;
+	header->frame_rate_den = frame_rate_den;
+	header->sample_rate = sample_rate;
+	header->frame_size = frame_size;
+	header->frames_offset = frames_offset;
+	header->audio_offset = audio_offset;
+	header->audio_capacity = audio_capacity;
+	header->latest = SHM_EXPORT_NO_FRAME;
+	// readers wait for the magic
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(header->magic, SHM_EXPORT_MAGIC, sizeof(header->magic));
+	return true;
+#else
+	printf("-shm is not available on this platform\n");
+	return false;
+#endif
+}
+
+void
+shm_export_frame(const uint8_t *pixels, const uint8_t *palette, uint32_t number)
+{
+#if HAVE_SHM
+	if (!shm) {
+		return;
+	}
+	const uint32_t index = header->latest == SHM_EXPORT_NO_FRAME ? 0 : (header->latest + 1) % SHM_EXPORT_FRAMES;
+	struct shm_export_frame *frame = frame_at(index);
+
+	// odd while it is written
+	const uint32_t sequence = frame->sequence + 1;
+	__atomic_store_n(&frame->sequence, sequence, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	frame->number = number;
+	memcpy(frame->palette, palette, sizeof(frame->palette));
+	memcpy(frame->pixels, pixels, header->width * header->height);
+	__atomic_store_n(&frame->sequence, sequence + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&header->latest, index, __ATOMIC_RELEASE);
+#endif
+}
+
+void
+shm_export_audio(const int16_t *samples, uint32_t count)
+{
+#if HAVE_SHM
+	if (!shm || !header->audio_capacity) {
+		return;
+	}
+	const uint32_t capacity = header->audio_capacity;
+	int16_t *ring = (int16_t *)(shm + header->audio_offset);
+	uint64_t written = header->audio_written;
+	if (count > capacity) {
+		// only the end fits
+		written += count - capacity;
+		samples += (count - capacity) * 2;
+		count = capacity;
+	}
+	__atomic_store_n(&header->audio_writing, written + count, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	const uint32_t pos = written & (capacity - 1);
+	const uint32_t n = capacity - pos < count ? capacity - pos : count;
+	memcpy(ring + pos * 2, samples, n * 2 * sizeof(int16_t));
+	memcpy(ring, samples + n * 2, (count - n) * 2 * sizeof(int16_t));
+	__atomic_store_n(&header->audio_written, written + count, __ATOMIC_RELEASE);
+#endif
+}
+
+void
+shm_export_end()
+{
+#if HAVE_SHM
+	if (!shm) {
+		return;
+	}
+	munmap(shm, shm_size);
+	shm_unlink(object_name);
+	shm = NULL;
+	header = NULL;
+#endif
+}
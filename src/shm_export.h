@@ -0,0 +1,74 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#ifndef _SHM_EXPORT_H_
+#define _SHM_EXPORT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Live frames and audio for other processes (-shm <name>): a POSIX
+// shared memory object (/dev/shm/<name> on Linux) holds the last three
+// frames, as 8 bit indexed pixels with their palette, and a ring of the
+// mixed audio. The emulator never waits for a reader; readers check
+// that what they used was not overwritten in the meantime.
+//
+// Frames: the emulator writes the frame after the one in "latest",
+// then stores its index in "latest". Every frame has a sequence that is
+// odd while it is being written. A reader loads "latest", then the
+// sequence of that frame, uses the frame in place if the sequence is
+// even, and only trusts what it read if the sequence is still the same
+// afterwards. There are two more frames until the frame is written
+// again.
+//
+// Audio: "audio_written" counts the stereo samples written so far, and
+// "audio_writing" the ones that are written or about to be; sample n is
+// at (n % audio_capacity) in the ring. A reader can read the samples up
+// to audio_written, and the ones from before audio_writing -
+// audio_capacity, loaded after reading them, may have been overwritten
+// while it read them.
+//
+// All numbers are in the byte order of the host. testbench/shm_reader.py
+// is a reader.
+
+#define SHM_EXPORT_MAGIC "X16SHM1"
+#define SHM_EXPORT_FRAMES 3
+#define SHM_EXPORT_NO_FRAME 0xFFFFFFFF
+
+struct shm_export_header {
+	char magic[8];
+	uint16_t width;
+	uint16_t height;
+	uint32_t frame_rate_num;    // frames per second, as a fraction
+	uint32_t frame_rate_den;
+	uint32_t sample_rate;       // 0 without audio
+	uint32_t frame_size;        // of a frame, with its header
+	uint32_t frames_offset;     // of the first frame, from the start
+	uint32_t audio_offset;
+	uint32_t audio_capacity;    // stereo samples, a power of 2
+	uint32_t latest;            // the newest frame, or SHM_EXPORT_NO_FRAME
+	uint32_t reserved;
+	uint64_t audio_written;
+	uint64_t audio_writing;
+};
+
+struct shm_export_frame {
+	uint32_t sequence;
+	uint32_t number;            // as in -capture, frames that were skipped are missing
+	uint8_t palette[256 * 3];   // RGB
+	uint8_t pixels[];           // width * height
+};
+
+bool shm_export_begin(const char *name, uint16_t width, uint16_t height, uint32_t frame_rate_num, uint32_t frame_rate_den, uint32_t sample_rate);
+
+// palette is 256 RGB triples
+void shm_export_frame(const uint8_t *pixels, const uint8_t *palette, uint32_t number);
+
+// Stereo samples
+void shm_export_audio(const int16_t *samples, uint32_t count);
+
+// Removes the object; readers that have it mapped keep it
+void shm_export_end(void);
+
+#endif
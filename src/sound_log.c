@@ -0,0 +1,92 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#include <stdio.h>
+#include <string.h>
+#include "sound_log.h"
+
+static FILE *file;
+static uint32_t pending; // clocks since the last write
+
+bool
+sound_log_begin(const char *path, uint8_t mhz)
+{
+	file = fopen(path, "wb");
+	if (!file) {
+		printf("Cannot open %s for the sound log\n", path);
+		return false;
+	}
+	const uint8_t header[] = {SOUND_LOG_VERSION, mhz};
+	fwrite(SOUND_LOG_MAGIC, 1, strlen(SOUND_LOG_MAGIC), file);
+	fwrite(header, 1, sizeof(header), file);
+	pending = 0;
+	return true;
+}
+
+static void
+write_wait(void)
+{
+	if (pending == 0) {
+		return;
+	}
+	if (pending < 0x100) {
+		const uint8_t wait[] = {SOUND_LOG_WAIT8, pending};
+		fwrite(wait, 1, sizeof(wait), file);
+	} else {
+		const uint8_t wait[] = {SOUND_LOG_WAIT32, pending, pending >> 8, pending >> 16, pending >> 24};
+		fwrite(wait, 1, sizeof(wait), file);
+	}
+	pending = 0;
+}
+
+void
+sound_log_step(uint32_t cpu_clocks)
+{
+	if (!file) {
+		return;
+	}
+	if (pending > UINT32_MAX - cpu_clocks) {
+		// the longest wait there is
+		write_wait();
+	}
+	pending += cpu_clocks;
+}
+
+void
+sound_log_write(sound_log_command_t command, uint8_t reg, uint8_t value)
+{
+	if (!file) {
+		return;
+	}
+	write_wait();
+	uint8_t bytes[] = {command, reg, value};
+	size_t len = 1;
+	switch (command) {
+		case SOUND_LOG_YM:
+		case SOUND_LOG_PSG:
+			len = 3;
+			break;
+		case SOUND_LOG_PCM_CTRL:
+		case SOUND_LOG_PCM_RATE:
+		case SOUND_LOG_PCM_FIFO:
+			bytes[1] = value;
+			len = 2;
+			break;
+		default:
+			break;
+	}
+	fwrite(bytes, 1, len, file);
+}
+
+void
+sound_log_end(void)
+{
+	if (!file) {
+		return;
+	}
+	write_wait();
+	fputc(SOUND_LOG_END, file);
+	fclose(file);
+	file = NULL;
+}
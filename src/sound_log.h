@@ -0,0 +1,50 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+#ifndef _SOUND_LOG_H_
+#define _SOUND_LOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sound register log (-soundlog): every write to the YM2151, the PSG
+// and the PCM FIFO's registers, with the CPU clocks in between, so that
+// the sound of a program can be replayed without the CPU. The clocks
+// are the ones the audio has been stepped by, so a replay puts every
+// write at the same sample. testbench/audiobench.c replays it.
+//
+// Like VGM and ZSM, the file is a stream of commands, each a byte with
+// its arguments, after "X16SND", the version (1) and the CPU's clock in
+// MHz (8 bit each). The log starts with the machine's power on state.
+// Numbers are little endian.
+
+#define SOUND_LOG_MAGIC "X16SND"
+#define SOUND_LOG_VERSION 1
+
+typedef enum {
+	SOUND_LOG_WAIT8     = 0x01, // 8 bit: that many CPU clocks pass
+	SOUND_LOG_WAIT32    = 0x02, // 32 bit
+	SOUND_LOG_YM        = 0x10, // register, value
+	SOUND_LOG_PSG       = 0x20, // register (0-63), value
+	SOUND_LOG_PSG_RESET = 0x21,
+	SOUND_LOG_PCM_CTRL  = 0x30, // value, as written to AUDIO_CTRL
+	SOUND_LOG_PCM_RATE  = 0x31, // value
+	SOUND_LOG_PCM_FIFO  = 0x32, // value
+	SOUND_LOG_PCM_RESET = 0x33,
+	SOUND_LOG_END       = 0xFF,
+} sound_log_command_t;
+
+bool sound_log_begin(const char *path, uint8_t mhz);
+
+// The CPU clocks the audio is stepped by
+void sound_log_step(uint32_t cpu_clocks);
+
+// A write, at the clock it is stepped to; commands without a register
+// or a value ignore them
+void sound_log_write(sound_log_command_t command, uint8_t reg, uint8_t value);
+
+// Writes the clocks since the last write, and closes the file
+void sound_log_end(void);
+
+#endif
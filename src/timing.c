@@ -23,6 +23,7 @@ uint32_t clockticks6502_old;
 int64_t cpu_ticks;
 int64_t last_perf_cpu_ticks;
 char window_title[255];
+static bool behind;
 
 void
 timing_init() {
@@ -42,6 +43,7 @@ timing_update()
 	clockticks6502_old = clockticks6502;
 	uint32_t sdlTicks = SDL_GetTicks() - sdlTicks_base;
 	int64_t diff_time = cpu_ticks / MHZ - sdlTicks * 1000LL;
+	behind = diff_time < -1000000LL / 60;
 	if (!warp_mode && diff_time > 0) {
 		if (diff_time >= 1000000) {
 			sleep(diff_time / 1000000);
@@ -78,3 +80,9 @@ timing_update()
 	}
 }
 
+// More than a frame behind real time at the last VSYNC
+bool
+timing_is_behind()
+{
+	return behind;
+}
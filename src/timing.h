@@ -1,7 +1,10 @@
 #ifndef TIMING_H
 #define TIMING_H
 
+#include <stdbool.h>
+
 void timing_init();
 void timing_update();
+bool timing_is_behind();
 
 #endif
@@ -4,6 +4,7 @@
 
 #include "vera_pcm.h"
 #include <stdio.h>
+#include <string.h>
 
 static uint8_t  fifo[4096];
 static unsigned fifo_wridx;
@@ -120,63 +121,118 @@ pcm_is_fifo_almost_empty(void)
 	return fifo_cnt < 1024;
 }
 
-void
-pcm_render(int32_t *buf, unsigned num_samples)
+// Takes the next sample from the FIFO, when the phase overflows
+static void
+fetch(void)
 {
-	while (num_samples--) {
-		uint8_t old_phase = phase;
-		phase += rate;
-		if ((old_phase & 0x80) != (phase & 0x80)) {
-			if (fifo_cnt == 0) {
-				cur_l = 0;
-				cur_r = 0;
-			} else {
-				switch ((ctrl >> 4) & 3) {
-					case 0: { // mono 8-bit
-						cur_l = (int16_t)read_fifo() << 8;
-						cur_r = cur_l;
-						break;
-					}
-					case 1: { // stereo 8-bit
-						if (fifo_cnt < 2) {
-							fifo_cnt = 0;
-							fifo_rdidx = fifo_wridx;
-						} else {
-							cur_l = read_fifo() << 8;
-							cur_r = read_fifo() << 8;
-						}
-						break;
-					}
-					case 2: { // mono 16-bit
-						if (fifo_cnt < 2) {
-							fifo_cnt = 0;
-							fifo_rdidx = fifo_wridx;
-						} else {
-							cur_l = read_fifo();
-							cur_l |= read_fifo() << 8;
-							cur_r = cur_l;
-						}
-						break;
-					}
-					case 3: { // stereo 16-bit
-						if (fifo_cnt < 4) {
-							fifo_cnt = 0;
-							fifo_rdidx = fifo_wridx;
-						} else {
-							cur_l = read_fifo();
-							cur_l |= read_fifo() << 8;
-							cur_r = read_fifo();
-							cur_r |= read_fifo() << 8;
-						}
-						break;
-					}
+	if (fifo_cnt == 0) {
+		cur_l = 0;
+		cur_r = 0;
+	} else {
+		switch ((ctrl >> 4) & 3) {
+			case 0: { // mono 8-bit
+				cur_l = (int16_t)read_fifo() << 8;
+				cur_r = cur_l;
+				break;
+			}
+			case 1: { // stereo 8-bit
+				if (fifo_cnt < 2) {
+					fifo_cnt = 0;
+					fifo_rdidx = fifo_wridx;
+				} else {
+					cur_l = read_fifo() << 8;
+					cur_r = read_fifo() << 8;
 				}
-				if (loop && fifo_cnt == 0) {
-					fifo_restart();
+				break;
+			}
+			case 2: { // mono 16-bit
+				if (fifo_cnt < 2) {
+					fifo_cnt = 0;
+					fifo_rdidx = fifo_wridx;
+				} else {
+					cur_l = read_fifo();
+					cur_l |= read_fifo() << 8;
+					cur_r = cur_l;
 				}
+				break;
 			}
+			case 3: { // stereo 16-bit
+				if (fifo_cnt < 4) {
+					fifo_cnt = 0;
+					fifo_rdidx = fifo_wridx;
+				} else {
+					cur_l = read_fifo();
+					cur_l |= read_fifo() << 8;
+					cur_r = read_fifo();
+					cur_r |= read_fifo() << 8;
+				}
+				break;
+			}
+		}
+		if (loop && fifo_cnt == 0) {
+			fifo_restart();
+		}
+	}
+}
+
+static void
+fill(int32_t *buf, unsigned num_samples, int32_t l, int32_t r)
+{
+	for (unsigned i = 0; i < num_samples; i++) {
+		buf[i * 2] = l;
+		buf[i * 2 + 1] = r;
+	}
+}
+
+void
+pcm_render(int32_t *buf, unsigned num_samples)
+{
+	const int32_t volume = volume_lut[ctrl & 0xF];
+
+	if (volume == 0 || (fifo_cnt == 0 && cur_l == 0 && cur_r == 0)) {
+		// silent, but the FIFO drains all the same
+		memset(buf, 0, num_samples * 2 * sizeof(int32_t));
+		unsigned overflows = (phase + num_samples * rate) / 128 - phase / 128;
+		phase += num_samples * rate;
+		while (overflows-- > 0 && (fifo_cnt > 0 || cur_l != 0 || cur_r != 0)) {
+			fetch();
+		}
+		return;
+	}
+
+	if (rate > 32) {
+		// a FIFO sample lasts for less than four samples, stepping the
+		// phase is cheaper than computing when it overflows
+		while (num_samples--) {
+			uint8_t old_phase = phase;
+			phase += rate;
+			if ((old_phase & 0x80) != (phase & 0x80)) {
+				fetch();
+			}
+			*(buf++) = (int32_t)cur_l * volume;
+			*(buf++) = (int32_t)cur_r * volume;
+		}
+		return;
+	}
+
+	// Runs of the same FIFO sample. x / rate is (x * reciprocal) >> 16
+	// for x < 128.
+	const uint32_t reciprocal = rate ? (0x10000 + rate - 1) / rate : 0;
+	while (num_samples > 0 && rate > 0) {
+		// the phase overflows, and the next value is taken from the FIFO,
+		// in this sample, counting from 1
+		unsigned overflow = (((127 - (phase & 0x7F)) * reciprocal) >> 16) + 1;
+		if (overflow > num_samples) {
+			break;
 		}
-		*(buf++) = (int32_t)cur_l * volume_lut[ctrl & 0xF];
-		*(buf++) = (int32_t)cur_r * volume_lut[ctrl & 0xF];
+		fill(buf, overflow - 1, (int32_t)cur_l * volume, (int32_t)cur_r * volume);
+		buf += (overflow - 1) * 2;
+		phase += overflow * rate;
+		num_samples -= overflow;
+		fetch();
+		*(buf++) = (int32_t)cur_l * volume;
+		*(buf++) = (int32_t)cur_r * volume;
 	}
+	phase += num_samples * rate;
+	fill(buf, num_samples, (int32_t)cur_l * volume, (int32_t)cur_r * volume);
 }
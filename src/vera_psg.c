@@ -71,58 +71,167 @@ psg_writereg(uint8_t reg, uint8_t val)
 	}
 }
 
+// Samples are rendered in blocks: the noise for the whole block first,
+// then channel by channel
+#define BLOCK 64
+
+// The 16 noise bits of each sample of the block, the first one highest;
+// [0] has the ones before the block
+static uint16_t noise_bits[BLOCK + 1];
+static int32_t wave[BLOCK];
+static int32_t out_l[BLOCK];
+static int32_t out_r[BLOCK];
+
 static void
-render(int32_t *left, int32_t *right)
+render_noise(unsigned num_samples)
 {
-	int32_t l = 0;
-	int32_t r = 0;
+	// In FPGA implementation, noise values are generated every system clock and
+	// the channel update is run sequentially. So, even if both two channels are
+	// fetching a noise value in the same sample, they should have different values
+	//
+	// Bit j of the state is the bit that comes out j steps before its bit
+	// 0, so the feedback is a recurrence over the bits that come out:
+	// two at a time, as the feedback of the next step doesn't need the
+	// bit from the step before. After 16 steps, bits 16 to 1 are the ones
+	// that came out in the sample.
+	uint32_t state = noise_state;
+	noise_bits[0] = noise_out;
+	for (unsigned j = 1; j <= num_samples; j++) {
+		for (int i = 0; i < 8; i++) {
+			uint32_t feedback = state ^ (state >> 1) ^ (state >> 3) ^ (state >> 14);
+			state = (state << 2) | (feedback & 3);
+		}
+		noise_bits[j] = state >> 1;
+	}
+	noise_state = state;
+	noise_out = noise_bits[num_samples] & 0x3FF;
+}
 
-	for (int i = 0; i < 16; i++) {
-		// In FPGA implementation, noise values are generated every system clock and
-		// the channel update is run sequentially. So, even if both two channels are
-		// fetching a noise value in the same sample, they should have different values
-		noise_out = ((noise_out << 1) | (noise_state & 1)) & 0x3FF;
-		noise_state = (noise_state << 1) | (((noise_state >> 1) ^ (noise_state >> 2) ^ (noise_state >> 4) ^ (noise_state >> 15)) & 1);
+// The noise channel i gets in sample j of the block: the 10 bits up to
+// its step
+static uint16_t
+noise_at(unsigned j, int i)
+{
+	uint32_t bits = ((uint32_t)noise_bits[j] << 16) | noise_bits[j + 1];
+	return (bits >> (15 - i)) & 0x3FF;
+}
 
-		struct channel *ch = &channels[i];
+// The sample of the block in which the phase last crossed bit 16, or -1
+static int
+last_toggle(uint32_t phase, uint16_t freq, unsigned num_samples)
+{
+	uint32_t end = phase + freq * num_samples;
+	if ((end >> 16) == (phase >> 16)) {
+		return -1;
+	}
+	uint32_t crossing = end & ~0xFFFF;
+	return (crossing - phase + freq - 1) / freq - 1;
+}
 
-		uint32_t new_phase = (ch->left || ch->right) ? ((ch->phase + ch->freq) & 0x1FFFF) : 0;
-		if ((ch->phase & 0x10000) != (new_phase & 0x10000)) {
-			ch->noiseval = noise_out;
-		}
-		ch->phase = new_phase;
-
-		uint32_t v = 0;
-		switch (ch->waveform) {
-			case WF_PULSE: v = ((ch->phase >> 10) > ch->pw) ? 0 : 0x3FF; break;
-			case WF_SAWTOOTH: v = ch->phase >> 7; break;
-			case WF_TRIANGLE: v = (ch->phase & 0x10000) ? (~(ch->phase >> 6) & 0x3FF) : ((ch->phase >> 6) & 0x3FF); break;
-			case WF_NOISE: v = ch->noiseval; break;
+// The waveform as signed values, (v ^ 0x200) sign extended from 10 bits
+// is v - 0x200. These loops don't depend on the previous sample, so the
+// compiler can vectorize them.
+static void
+render_wave(const struct channel *ch, unsigned num_samples)
+{
+	const uint32_t phase = ch->phase;
+	const uint32_t freq = ch->freq;
+	const int32_t volume = ch->volume;
+	switch (ch->waveform) {
+		case WF_PULSE: {
+			const uint32_t pw = ch->pw;
+			for (unsigned j = 0; j < num_samples; j++) {
+				uint32_t p = (phase + (j + 1) * freq) & 0x1FFFF;
+				wave[j] = (((p >> 10) > pw) ? -0x200 : 0x1FF) * volume;
+			}
+			break;
 		}
-		int32_t sv = (v ^ 0x200);
-		if (sv & 0x200) {
-			sv |= 0xFFFFFC00;
+		case WF_SAWTOOTH:
+			for (unsigned j = 0; j < num_samples; j++) {
+				uint32_t p = (phase + (j + 1) * freq) & 0x1FFFF;
+				wave[j] = ((int32_t)(p >> 7) - 0x200) * volume;
+			}
+			break;
+		case WF_TRIANGLE:
+			for (unsigned j = 0; j < num_samples; j++) {
+				uint32_t p = (phase + (j + 1) * freq) & 0x1FFFF;
+				uint32_t v = ((p & 0x10000) ? ~(p >> 6) : (p >> 6)) & 0x3FF;
+				wave[j] = ((int32_t)v - 0x200) * volume;
+			}
+			break;
+	}
+}
+
+static void
+render_block(unsigned num_samples)
+{
+	render_noise(num_samples);
+	memset(out_l, 0, num_samples * sizeof(int32_t));
+	memset(out_r, 0, num_samples * sizeof(int32_t));
+
+	for (int i = 0; i < 16; i++) {
+		struct channel *ch = &channels[i];
+
+		if (!ch->left && !ch->right) {
+			// silent, the phase stays 0
+			if (ch->phase & 0x10000) {
+				ch->noiseval = noise_at(0, i);
+			}
+			ch->phase = 0;
+			continue;
 		}
 
-		int32_t val = sv * ch->volume;
+		if (ch->waveform == WF_NOISE && ch->volume) {
+			// the value changes within the block
+			uint32_t phase = ch->phase;
+			for (unsigned j = 0; j < num_samples; j++) {
+				uint32_t new_phase = (phase + ch->freq) & 0x1FFFF;
+				if ((phase & 0x10000) != (new_phase & 0x10000)) {
+					ch->noiseval = noise_at(j, i);
+				}
+				phase = new_phase;
+				wave[j] = ((int32_t)ch->noiseval - 0x200) * ch->volume;
+			}
+			ch->phase = phase;
+		} else {
+			if (ch->volume) {
+				render_wave(ch, num_samples);
+			}
+			// the noise the channel would have at the end of the block
+			int j = last_toggle(ch->phase, ch->freq, num_samples);
+			if (j >= 0) {
+				ch->noiseval = noise_at(j, i);
+			}
+			ch->phase = (ch->phase + ch->freq * num_samples) & 0x1FFFF;
+			if (!ch->volume) {
+				continue;
+			}
+		}
 
 		if (ch->left) {
-			l += val;
+			for (unsigned j = 0; j < num_samples; j++) {
+				out_l[j] += wave[j];
+			}
 		}
 		if (ch->right) {
-			r += val;
+			for (unsigned j = 0; j < num_samples; j++) {
+				out_r[j] += wave[j];
+			}
 		}
 	}
-
-	*left  = l;
-	*right = r;
 }
 
 void
 psg_render(int32_t *buf, unsigned num_samples)
 {
-	while (num_samples--) {
-		render(&buf[0], &buf[1]);
-		buf += 2;
+	while (num_samples > 0) {
+		unsigned n = num_samples < BLOCK ? num_samples : BLOCK;
+		render_block(n);
+		for (unsigned j = 0; j < n; j++) {
+			buf[j * 2] = out_l[j];
+			buf[j * 2 + 1] = out_r[j];
+		}
+		buf += n * 2;
+		num_samples -= n;
 	}
 }
@@ -8,15 +8,21 @@
 #include "glue.h"
 #include "debugger.h"
 #include "keyboard.h"
-#include "gif.h"
+#include "gif_recorder.h"
+#include "capture.h"
+#include "shm_export.h"
 #include "joystick.h"
 #include "vera_spi.h"
-#include "vera_psg.h"
 #include "vera_pcm.h"
+#include "sound_log.h"
 #include "icon.h"
 #include "sdcard.h"
 #include "i2c.h"
 #include "audio.h"
+#include "timing.h"
+#include "eve_present.h"
+#include "eve_layers.h"
+#include "eve_mock.h"
 
 #include <unistd.h>
 #include <limits.h>
@@ -84,8 +90,7 @@
 
 static SDL_Window *window;
 static SDL_Renderer *renderer;
-static SDL_Surface *surface;
-//static SDL_Texture *sdlTexture;
+static SDL_Texture *sdlTexture;
 static bool is_fullscreen = false;
 bool mouse_grabbed = false;
 bool kernal_mouse_enabled = false;
@@ -112,6 +117,111 @@ static uint8_t reg_layer[2][7];
 static uint8_t reg_composer[COMPOSER_SLOTS];
 static uint8_t prev_reg_composer[2][COMPOSER_SLOTS];
 
+// The renderer works on its own copy of the composer and layer registers.
+// The CPU-visible registers above change immediately, these follow along
+// as the render journal gets replayed.
+static uint8_t render_reg_composer[COMPOSER_SLOTS];
+static uint8_t render_reg_layer[2][7];
+
+// Render journal: line renders and the register writes between them are
+// queued with their beam position and replayed in order by video_flush().
+// A frame without mid-frame changes is then rendered in one pass at VSYNC.
+#define JOURNAL_SIZE 1024
+
+enum journal_type {
+	JOURNAL_LINE,     // a = y, b = scan_pos_x
+	JOURNAL_COMPOSER, // a = composer slot
+	JOURNAL_LAYER,    // a = layer, b = layer register
+	JOURNAL_FRAME,    // value = skip the frame
+};
+
+struct journal_entry {
+	uint8_t type;
+	uint8_t value;
+	uint16_t a;
+	uint16_t b;
+};
+
+static struct journal_entry journal[JOURNAL_SIZE];
+static uint16_t journal_len;
+
+// Bumped whenever video RAM or a layer's render-side properties change,
+// so that a rendered line can be reused for the next output line when the
+// display is scaled vertically.
+static uint32_t vram_gen;
+static uint32_t render_layer_gen[2];
+static uint32_t prev_layer_gen[2][2];
+
+struct line_cache {
+	bool valid;
+	uint16_t eff_y;
+	uint16_t width;
+	uint32_t vram_gen;
+	uint32_t layer_gen[3];
+	uint64_t pages;
+	uint8_t collisions;
+	bool drawn; // sprites: the pixels are in sprite_line_col, too
+};
+
+static struct line_cache layer_line_cache[2];
+static struct line_cache sprite_line_cache;
+
+// Frame skipping: the renderer only keeps the sprite collisions
+// up to date, and nothing gets output.
+static bool render_skip_frame;
+static bool last_frame_skipped;
+
+// Dirty scanline tracking: every framebuffer line remembers what it was
+// rendered from. Video RAM is tracked in 2 KB pages; a page stores the
+// vram_gen of its last write, a line the vram_gen it was rendered at.
+#define VRAM_PAGE_SHIFT 11
+#define VRAM_PAGES (0x20000 >> VRAM_PAGE_SHIFT)
+
+static uint32_t vram_page_gen[VRAM_PAGES];
+static uint32_t sprite_gen;
+static uint64_t render_pages; // pages read for the current line
+static uint8_t prev_reg_layer[2][2][7];
+
+struct line_inputs {
+	uint8_t composer[8];
+	uint8_t layer[3][2][7]; // now, one and two lines ago
+	uint16_t eff_y;
+};
+
+struct line_signature {
+	bool valid;
+	uint8_t collisions;
+	struct line_inputs inputs;
+	uint64_t pages;
+	uint32_t vram_gen;
+	uint32_t sprite_gen;
+};
+
+static struct line_signature *line_signatures;
+static uint32_t dirty_lines[SCREEN_HEIGHT / 32];
+static bool palette_changed;
+// whether all lines since the last video_update() were composed at
+// HSCALE=VSCALE=64, so the frame is likely 320x240 pixels doubled
+static bool frame_scaled_2x = true;
+static uint32_t lines_rendered;
+static uint32_t lines_skipped;
+
+// -eve-layers: frames without raster effects are drawn by the EVE from a
+// display list. Whether a frame qualifies is only known at its end, so
+// the one before decides whether it gets rendered.
+static struct eve_layers_frame *layers;
+static bool layers_frame; // the current frame is drawn from a display list
+static bool layers_next;  // the last frame could have been
+static bool layers_sent;  // the last frame went out as a display list
+// the registers, the palette or the sprites changed while the beam was
+// on the screen
+static bool layers_raster;
+// video RAM changed while the beam was on the screen
+static bool layers_vram;
+static uint32_t layers_frames;
+static uint32_t layers_raster_frames;
+static uint32_t layers_fallbacks[EVE_LAYERS_RESULTS];
+
 static uint8_t layer_line[2][SCREEN_WIDTH];
 static uint8_t sprite_line_col[SCREEN_WIDTH];
 static uint8_t sprite_line_z[SCREEN_WIDTH];
@@ -202,18 +312,37 @@ struct video_palette
 	pixel_t entries[256];
 #else
 	SDL_Color entries[256];
+	uint32_t argb[256]; // the same, as SDL_PIXELFORMAT_ARGB8888
 #endif
 	bool dirty;
+	uint32_t dirty_entries[256 / 32];
 };
 
 struct video_palette video_palette;
 
 static uint8_t *framebuffer = NULL;
+// instead of the framebuffer, with -stream-lines
+static const struct video_line_sink *line_sink = NULL;
+// the line for the sink, put together like a framebuffer line: line
+// sink_y, from sink_x0 up to sink_x (0 if there is none)
+static uint8_t sink_line[SCREEN_WIDTH];
+static uint16_t sink_y;
+static uint16_t sink_x0;
+static uint16_t sink_x;
+// -stream-lines check: what the framebuffer would be
+static uint8_t *sink_check = NULL;
+// -capture is writing
+static bool capturing = false;
+// -shm is publishing
+static bool shm_exporting = false;
+
+// Headless: the beam, the IRQs and the sprite collisions are emulated,
+// but no pixels are generated.
+static bool timing_only = false;
 #ifndef __EMSCRIPTEN__
 static uint8_t *png_buffer = NULL;
 #endif
 
-static GifWriter gif_writer;
 
 static const uint16_t default_palette[] = {
 0x000,0xfff,0x800,0xafe,0xc4c,0x0c5,0x00a,0xee7,0xd85,0x640,0xf77,0x333,0x777,0xaf6,0x08f,0xbbb,0x000,0x111,0x222,0x333,0x444,0x555,0x666,0x777,0x888,0x999,0xaaa,0xbbb,0xccc,0xddd,0xeee,0xfff,0x211,0x433,0x644,0x866,0xa88,0xc99,0xfbb,0x211,0x422,0x633,0x844,0xa55,0xc66,0xf77,0x200,0x411,0x611,0x822,0xa22,0xc33,0xf33,0x200,0x400,0x600,0x800,0xa00,0xc00,0xf00,0x221,0x443,0x664,0x886,0xaa8,0xcc9,0xfeb,0x211,0x432,0x653,0x874,0xa95,0xcb6,0xfd7,0x210,0x431,0x651,0x862,0xa82,0xca3,0xfc3,0x210,0x430,0x640,0x860,0xa80,0xc90,0xfb0,0x121,0x343,0x564,0x786,0x9a8,0xbc9,0xdfb,0x121,0x342,0x463,0x684,0x8a5,0x9c6,0xbf7,0x120,0x241,0x461,0x582,0x6a2,0x8c3,0x9f3,0x120,0x240,0x360,0x480,0x5a0,0x6c0,0x7f0,0x121,0x343,0x465,0x686,0x8a8,0x9ca,0xbfc,0x121,0x242,0x364,0x485,0x5a6,0x6c8,0x7f9,0x020,0x141,0x162,0x283,0x2a4,0x3c5,0x3f6,0x020,0x041,0x061,0x082,0x0a2,0x0c3,0x0f3,0x122,0x344,0x466,0x688,0x8aa,0x9cc,0xbff,0x122,0x244,0x366,0x488,0x5aa,0x6cc,0x7ff,0x022,0x144,0x166,0x288,0x2aa,0x3cc,0x3ff,0x022,0x044,0x066,0x088,0x0aa,0x0cc,0x0ff,0x112,0x334,0x456,0x668,0x88a,0x9ac,0xbcf,0x112,0x224,0x346,0x458,0x56a,0x68c,0x79f,0x002,0x114,0x126,0x238,0x24a,0x35c,0x36f,0x002,0x014,0x016,0x028,0x02a,0x03c,0x03f,0x112,0x334,0x546,0x768,0x98a,0xb9c,0xdbf,0x112,0x324,0x436,0x648,0x85a,0x96c,0xb7f,0x102,0x214,0x416,0x528,0x62a,0x83c,0x93f,0x102,0x204,0x306,0x408,0x50a,0x60c,0x70f,0x212,0x434,0x646,0x868,0xa8a,0xc9c,0xfbe,0x211,0x423,0x635,0x847,0xa59,0xc6b,0xf7d,0x201,0x413,0x615,0x826,0xa28,0xc3a,0xf3c,0x201,0x403,0x604,0x806,0xa08,0xc09,0xf0b
@@ -223,10 +352,15 @@ uint8_t video_space_read(uint32_t address);
 static void video_space_read_range(uint8_t* dest, uint32_t address, uint32_t size);
 
 static void refresh_palette();
+static void video_flush(void);
+static void invalidate_lines(void);
 
 void
 video_reset()
 {
+	// finish everything the beam has passed before the state goes away
+	video_flush();
+
 	// init I/O registers
 	memset(io_addr, 0, sizeof(io_addr));
 	memset(io_inc, 0, sizeof(io_inc));
@@ -249,6 +383,9 @@ video_reset()
 	reg_composer[5] = 640 >> 2;
 	reg_composer[7] = 480 >> 1;
 
+	memcpy(render_reg_composer, reg_composer, sizeof(render_reg_composer));
+	memset(render_reg_layer, 0, sizeof(render_reg_layer));
+
 	// Initialize FX registers
 	fx_addr1_mode = 0;
 	fx_x_pixel_position = 0x8000;
@@ -302,12 +439,15 @@ video_reset()
 		palette[i * 2 + 1] = default_palette[i] >> 8;
 	}
 
+	memset(video_palette.dirty_entries, 0xff, sizeof(video_palette.dirty_entries));
 	refresh_palette();
 
 	// fill video RAM with random data
 	for (int i = 0; i < 128 * 1024; i++) {
 		video_ram[i] = rand();
 	}
+	vram_gen++;
+	invalidate_lines();
 
 	sprite_line_collisions = 0;
 
@@ -316,22 +456,87 @@ video_reset()
 	ntsc_half_cnt = 0;
 	ntsc_scan_pos_y = 0;
 
-	psg_reset();
+	// the sound until now is played with the old state
+	audio_reset_psg();
+	audio_render_pcm();
+	sound_log_write(SOUND_LOG_PCM_RESET, 0, 0);
 	pcm_reset();
 }
 
+void
+video_init_headless()
+{
+	timing_only = true;
+	video_ram = malloc(0x20000);
+
+	video_reset();
+}
+
+#if !ESP_PLATFORM
+// -stream-lines on the host: the lines go to the simulated EVE display
+static void
+eve_mock_sink_line(void *ctx, uint16_t y, const uint8_t *pixels)
+{
+	eve_present_line(y, pixels);
+}
+
+static void
+eve_mock_sink_part(void *ctx, uint16_t y, uint16_t x, uint16_t width, const uint8_t *pixels)
+{
+	eve_present_line_part(y, x, width, pixels);
+}
+
+static void
+eve_mock_sink_frame(void *ctx, const uint16_t *palette, bool palette_dirty)
+{
+	eve_present_lines_end_frame(palette, palette_dirty);
+	eve_mock_end_frame();
+	if (sink_check) {
+		eve_mock_check_lines(sink_check);
+	}
+}
+
+static const struct video_line_sink eve_mock_sink = {
+	eve_mock_sink_line,
+	eve_mock_sink_part,
+	eve_mock_sink_frame,
+	NULL,
+};
+#endif
+
 bool
 video_init(int window_scale, float screen_x_scale, const char *quality, bool fullscreen, float opacity)
 {
 	uint32_t window_flags = SDL_WINDOW_ALLOW_HIGHDPI;
-	
-	framebuffer = calloc(SCREEN_WIDTH * SCREEN_HEIGHT, sizeof(*framebuffer));
 
 #if ESP_PLATFORM
 	extern void vga_init();
 	vga_init();
+#else
+	if (stream_lines) {
+		if (eve_mock == EVE_MOCK_OFF) {
+			eve_mock = EVE_MOCK_INFLATE;
+		}
+		video_set_line_sink(&eve_mock_sink);
+		if (stream_lines_check) {
+			sink_check = calloc(SCREEN_WIDTH * SCREEN_HEIGHT, 1);
+		}
+	} else if (eve_layers && eve_mock == EVE_MOCK_OFF) {
+		eve_mock = EVE_MOCK_INFLATE;
+	}
 #endif
 
+	if (eve_layers && line_sink) {
+		printf("-eve-layers is not available with -stream-lines\n");
+	} else if (eve_layers) {
+		layers = malloc(sizeof(*layers));
+	}
+
+	if (!line_sink) {
+		framebuffer = calloc(SCREEN_WIDTH * SCREEN_HEIGHT, sizeof(*framebuffer));
+	}
+	line_signatures = calloc(SCREEN_HEIGHT, sizeof(*line_signatures));
+
 #ifdef __EMSCRIPTEN__
 	// Setting this flag would render the web canvas outside of its bounds on high dpi screens
 	window_flags &= ~SDL_WINDOW_ALLOW_HIGHDPI;
@@ -349,9 +554,19 @@ printf("Video RAM = %p framebuffer = %p\n", video_ram, framebuffer);
 #endif
 	SDL_RenderSetLogicalSize(renderer, SCREEN_WIDTH * screen_x_scale, SCREEN_HEIGHT);
 
-	surface = SDL_ConvertSurfaceFormat(SDL_GetWindowSurface(window),
-									SDL_PIXELFORMAT_INDEX8,
-									0);
+#if !ESP_PLATFORM
+	// scaled by the renderer, with the filter chosen by -quality
+	sdlTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+
+	if (eve_mock != EVE_MOCK_OFF) {
+		const struct eve_transport *transport = eve_mock_transport(eve_mock == EVE_MOCK_INFLATE);
+		if (line_sink) {
+			eve_present_lines_init(transport);
+		} else {
+			eve_present_init(transport);
+		}
+	}
+#endif
 
 	SDL_SetWindowTitle(window, WINDOW_TITLE);
 	SDL_SetWindowIcon(window, CommanderX16Icon());
@@ -362,6 +577,10 @@ printf("Video RAM = %p framebuffer = %p\n", video_ram, framebuffer);
 
 	SDL_SetWindowOpacity(window, opacity);
 
+	if (record_gif != RECORD_GIF_DISABLED && line_sink) {
+		printf("GIF recording is not available with -stream-lines\n");
+		record_gif = RECORD_GIF_DISABLED;
+	}
 	if (record_gif != RECORD_GIF_DISABLED) {
 		if (!strcmp(gif_path+strlen(gif_path)-5, ",wait")) {
 			// wait for POKE
@@ -372,11 +591,22 @@ printf("Video RAM = %p framebuffer = %p\n", video_ram, framebuffer);
 			// start now
 			record_gif = RECORD_GIF_ACTIVE;
 		}
-		if (!GifBegin(&gif_writer, gif_path, SCREEN_WIDTH, SCREEN_HEIGHT, 1, 8, false)) {
+		if (!gif_recorder_begin(gif_path, SCREEN_WIDTH, SCREEN_HEIGHT)) {
 			record_gif = RECORD_GIF_DISABLED;
 		}
 	}
 
+	if (capture_path && line_sink) {
+		printf("-capture is not available with -stream-lines\n");
+	} else if (capture_path) {
+		capturing = capture_begin(capture_path, SCREEN_WIDTH, SCREEN_HEIGHT, PIXEL_FREQ * 1000000, VGA_SCAN_WIDTH * SCAN_HEIGHT, host_sample_rate);
+	}
+	if (shm_name && line_sink) {
+		printf("-shm is not available with -stream-lines\n");
+	} else if (shm_name) {
+		shm_exporting = shm_export_begin(shm_name, SCREEN_WIDTH, SCREEN_HEIGHT, PIXEL_FREQ * 1000000, VGA_SCAN_WIDTH * SCAN_HEIGHT, host_sample_rate);
+	}
+
 	if (debugger_enabled) {
 		DEBUGInitUI(renderer);
 	}
@@ -425,6 +655,7 @@ struct video_layer_properties
 
 #define NUM_LAYERS 2
 struct video_layer_properties layer_properties[NUM_LAYERS];
+struct video_layer_properties render_layer_properties[NUM_LAYERS];
 struct video_layer_properties prev_layer_properties[2][NUM_LAYERS];
 
 inline static int
@@ -453,24 +684,22 @@ calc_layer_map_addr_base2(const struct video_layer_properties *props, const int
 //	return props->map_base + ((eff_y / props->tileh) * props->mapw + (eff_x / props->tilew)) * 2;
 //}
 static void
-refresh_layer_properties(const uint8_t layer)
+refresh_layer_properties(struct video_layer_properties *props, const uint8_t *regs)
 {
-	struct video_layer_properties* props = &layer_properties[layer];
-
 	uint16_t prev_layerw_max = props->layerw_max;
 	uint16_t prev_hscroll = props->hscroll;
 
-	props->color_depth    = reg_layer[layer][0] & 0x3;
-	props->map_base       = reg_layer[layer][1] << 9;
-	props->tile_base      = (reg_layer[layer][2] & 0xFC) << 9;
-	props->bitmap_mode    = (reg_layer[layer][0] & 0x4) != 0;
+	props->color_depth    = regs[0] & 0x3;
+	props->map_base       = regs[1] << 9;
+	props->tile_base      = (regs[2] & 0xFC) << 9;
+	props->bitmap_mode    = (regs[0] & 0x4) != 0;
 	props->text_mode      = (props->color_depth == 0) && !props->bitmap_mode;
-	props->text_mode_256c = (reg_layer[layer][0] & 8) != 0;
+	props->text_mode_256c = (regs[0] & 8) != 0;
 	props->tile_mode      = !props->bitmap_mode && !props->text_mode;
 
 	if (!props->bitmap_mode) {
-		props->hscroll = reg_layer[layer][3] | (reg_layer[layer][4] & 0xf) << 8;
-		props->vscroll = reg_layer[layer][5] | (reg_layer[layer][6] & 0xf) << 8;
+		props->hscroll = regs[3] | (regs[4] & 0xf) << 8;
+		props->vscroll = regs[5] | (regs[6] & 0xf) << 8;
 	} else {
 		props->hscroll = 0;
 		props->vscroll = 0;
@@ -482,19 +711,19 @@ refresh_layer_properties(const uint8_t layer)
 	props->tileh = 0;
 
 	if (props->tile_mode || props->text_mode) {
-		props->mapw_log2 = 5 + ((reg_layer[layer][0] >> 4) & 3);
-		props->maph_log2 = 5 + ((reg_layer[layer][0] >> 6) & 3);
+		props->mapw_log2 = 5 + ((regs[0] >> 4) & 3);
+		props->maph_log2 = 5 + ((regs[0] >> 6) & 3);
 		mapw      = 1 << props->mapw_log2;
 		maph      = 1 << props->maph_log2;
 
 		// Scale the tiles or text characters according to TILEW and TILEH.
-		props->tilew_log2 = 3 + (reg_layer[layer][2] & 1);
-		props->tileh_log2 = 3 + ((reg_layer[layer][2] >> 1) & 1);
+		props->tilew_log2 = 3 + (regs[2] & 1);
+		props->tileh_log2 = 3 + ((regs[2] >> 1) & 1);
 		props->tilew      = 1 << props->tilew_log2;
 		props->tileh      = 1 << props->tileh_log2;
 	} else if (props->bitmap_mode) {
 		// bitmap mode is basically tiled mode with a single huge tile
-		props->tilew = (reg_layer[layer][2] & 1) ? 640 : 320;
+		props->tilew = (regs[2] & 1) ? 640 : 320;
 		props->tileh = SCREEN_HEIGHT;
 	}
 
@@ -571,6 +800,11 @@ screenshot(void)
 	const time_t now = time(NULL);
 	strftime(path, PATH_MAX, "x16emu-%Y-%m-%d-%H-%M-%S.png", localtime(&now));
 
+	if (!framebuffer) {
+		printf("Screenshots are not available with -stream-lines\n");
+		return;
+	}
+
 	png_buffer = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 3);
 	memset(png_buffer, 0, SCREEN_WIDTH * SCREEN_HEIGHT * 3);
 
@@ -625,9 +859,19 @@ refresh_sprite_properties(const uint16_t sprite)
 
 static void
 refresh_palette() {
-	const uint8_t out_mode = reg_composer[0] & 3;
-	const bool chroma_disable = ((reg_composer[0] & 0x07) == 6);
+	const uint8_t out_mode = render_reg_composer[0] & 3;
+	const bool chroma_disable = ((render_reg_composer[0] & 0x07) == 6);
 	for (int i = 0; i < 256; ++i) {
+		// only the entries that were written to, or all of them
+		// after a change of the output mode
+		if (!video_palette.dirty_entries[i >> 5]) {
+			i |= 31;
+			continue;
+		}
+		if (!(video_palette.dirty_entries[i >> 5] & (1u << (i & 31)))) {
+			continue;
+		}
+
 		uint8_t r;
 		uint8_t g;
 		uint8_t b;
@@ -657,9 +901,48 @@ refresh_palette() {
 		video_palette.entries[i].g = g;
 		video_palette.entries[i].b = b;
 		video_palette.entries[i].a = 255;
+		video_palette.argb[i] = 0xff000000 | (uint32_t)r << 16 | (uint32_t)g << 8 | b;
 #endif
 	}
+	memset(video_palette.dirty_entries, 0, sizeof(video_palette.dirty_entries));
 	video_palette.dirty = false;
+	palette_changed = true;
+}
+
+// The palette as 256 RGB triples
+static void
+palette_rgb(uint8_t *rgb)
+{
+	for (int i = 0; i < 256; i++) {
+#if ESP_PLATFORM
+		const pixel_t entry = video_palette.entries[i];
+		rgb[i * 3 + 0] = entry.r << 3 | entry.r >> 2;
+		rgb[i * 3 + 1] = entry.g << 2 | entry.g >> 4;
+		rgb[i * 3 + 2] = entry.b << 3 | entry.b >> 2;
+#else
+		rgb[i * 3 + 0] = video_palette.entries[i].r;
+		rgb[i * 3 + 1] = video_palette.entries[i].g;
+		rgb[i * 3 + 2] = video_palette.entries[i].b;
+#endif
+	}
+}
+
+// Video RAM reads of the renderer, recording which pages the line depends on
+inline static uint8_t
+render_vram_read(uint32_t address)
+{
+	address &= 0x1FFFF;
+	render_pages |= (uint64_t)1 << (address >> VRAM_PAGE_SHIFT);
+	return video_ram[address];
+}
+
+static void
+render_vram_read_range(uint8_t *dest, uint32_t address, uint32_t size)
+{
+	for (uint32_t page = address >> VRAM_PAGE_SHIFT; page <= (address + size - 1) >> VRAM_PAGE_SHIFT; page++) {
+		render_pages |= (uint64_t)1 << (page & (VRAM_PAGES - 1));
+	}
+	video_space_read_range(dest, address, size);
 }
 
 static void
@@ -676,11 +959,27 @@ expand_4bpp_data(uint8_t *dst, const uint8_t *src, int dst_size)
 	}
 }
 
-static void
-render_sprite_line(const uint16_t y)
+// The sprites on line y, as far as the sprite time allows: their
+// collisions, and with draw, their pixels in sprite_line_col/_z. Without
+// draw, sprites without a collision mask only use up the time.
+static uint8_t
+render_sprite_line(const uint16_t y, bool draw)
 {
-	memset(sprite_line_col, 0, SCREEN_WIDTH);
-	memset(sprite_line_z, 0, SCREEN_WIDTH);
+	struct line_cache *cache = &sprite_line_cache;
+	if (cache->valid && cache->eff_y == y && cache->vram_gen == vram_gen && (cache->drawn || !draw)) {
+		// same sprites on the same line: the collisions are the same, too
+		render_pages |= cache->pages;
+		return cache->collisions;
+	}
+
+	uint8_t collisions = 0;
+	const uint64_t pages = render_pages;
+	render_pages = 0;
+
+	if (draw) {
+		memset(sprite_line_col, 0, SCREEN_WIDTH);
+		memset(sprite_line_z, 0, SCREEN_WIDTH);
+	}
 	memset(sprite_line_mask, 0, SCREEN_WIDTH);
 
 	uint16_t sprite_budget = 800 + 1;
@@ -698,15 +997,31 @@ render_sprite_line(const uint16_t y)
 			continue;
 		}
 
+		if (!draw && props->sprite_collision_mask == 0) {
+			// the clocks of the loop below: one per fetched 32 bits and
+			// one per pixel on screen
+			const int32_t sx0 = props->sprite_x < 0 ? -props->sprite_x : 0;
+			int32_t sx1 = SCREEN_WIDTH - props->sprite_x;
+			sx1 = sx1 < props->sprite_width ? sx1 : props->sprite_width;
+			if (sx1 > sx0) {
+				const uint32_t clocks = (sx1 - sx0) + ((sx1 + 3) >> 2) - ((sx0 + 3) >> 2);
+				sprite_budget = clocks < sprite_budget ? sprite_budget - clocks : 0;
+			}
+			continue;
+		}
+
 		const uint16_t eff_sy = props->vflip ? ((props->sprite_height - 1) - (y - props->sprite_y)) : (y - props->sprite_y);
 
 		int16_t       eff_sx      = (props->hflip ? (props->sprite_width - 1) : 0);
 		const int16_t eff_sx_incr = props->hflip ? -1 : 1;
 
-		const uint8_t *bitmap_data = video_ram + props->sprite_address + (eff_sy << (props->sprite_width_log2 - (1 - props->color_mode)));
+		const uint32_t bitmap_addr = props->sprite_address + (eff_sy << (props->sprite_width_log2 - (1 - props->color_mode)));
+		const uint8_t *bitmap_data = video_ram + bitmap_addr;
 
 		uint8_t unpacked_sprite_line[64];
 		const uint16_t width = (props->sprite_width<64? props->sprite_width : 64);
+		render_pages |= (uint64_t)1 << ((bitmap_addr >> VRAM_PAGE_SHIFT) & (VRAM_PAGES - 1));
+		render_pages |= (uint64_t)1 << (((bitmap_addr + (width >> (1 - props->color_mode)) - 1) >> VRAM_PAGE_SHIFT) & (VRAM_PAGES - 1));
 		if (props->color_mode == 0) {
 			// 4bpp
 			expand_4bpp_data(unpacked_sprite_line, bitmap_data, width);
@@ -735,20 +1050,29 @@ render_sprite_line(const uint16_t y)
 
 			// palette offset
 			if (col_index > 0) {
-				sprite_line_collisions |= sprite_line_mask[line_x] & props->sprite_collision_mask;
+				collisions |= sprite_line_mask[line_x] & props->sprite_collision_mask;
 				sprite_line_mask[line_x] |= props->sprite_collision_mask;
 
-			if (props->sprite_zdepth > sprite_line_z[line_x]) {
+				if (draw && props->sprite_zdepth > sprite_line_z[line_x]) {
 					sprite_line_col[line_x] = col_index + props->palette_offset;
 					sprite_line_z[line_x] = props->sprite_zdepth;
 				}
 			}
 		}
 	}
+
+	cache->valid = true;
+	cache->eff_y = y;
+	cache->vram_gen = vram_gen;
+	cache->pages = render_pages;
+	cache->collisions = collisions;
+	cache->drawn = draw;
+	render_pages |= pages;
+	return collisions;
 }
 
 static void
-render_layer_line_text(uint8_t layer, uint16_t y)
+render_layer_line_text(uint8_t layer, uint16_t y, uint16_t width)
 {
 	const struct video_layer_properties *props = &prev_layer_properties[1][layer];
 	const struct video_layer_properties *props0 = &prev_layer_properties[0][layer];
@@ -765,7 +1089,7 @@ render_layer_line_text(uint8_t layer, uint16_t y)
 	const int      size           = (map_addr_end - map_addr_begin) + 2;
 
 	uint8_t tile_bytes[512]; // max 256 tiles, 2 bytes each.
-	video_space_read_range(tile_bytes, map_addr_begin, size);
+	render_vram_read_range(tile_bytes, map_addr_begin, size);
 
 	uint32_t tile_start;
 
@@ -799,12 +1123,12 @@ render_layer_line_text(uint8_t layer, uint16_t y)
 		const uint16_t x_add       = xx >> 3;
 		const uint32_t tile_offset = tile_start + y_add + x_add;
 
-		s           = video_space_read(props->tile_base + tile_offset);
+		s           = render_vram_read(props->tile_base + tile_offset);
 		color_shift = max_pixels_per_byte - (xx & 0x7);
 	}
 
 	// Render tile line.
-	for (int x = 0; x < SCREEN_WIDTH; x++) {
+	for (int x = 0; x < width; x++) {
 		// Scrolling
 		const int eff_x = calc_layer_eff_x(props, x);
 		const int xx = eff_x & props->tilew_max;
@@ -833,7 +1157,7 @@ render_layer_line_text(uint8_t layer, uint16_t y)
 			const uint16_t x_add       = xx >> 3;
 			const uint32_t tile_offset = tile_start + y_add + x_add;
 
-			s           = video_space_read(props->tile_base + tile_offset);
+			s           = render_vram_read(props->tile_base + tile_offset);
 			color_shift = max_pixels_per_byte;
 		}
 
@@ -845,7 +1169,7 @@ render_layer_line_text(uint8_t layer, uint16_t y)
 }
 
 static void
-render_layer_line_tile(uint8_t layer, uint16_t y)
+render_layer_line_tile(uint8_t layer, uint16_t y, uint16_t width)
 {
 	const struct video_layer_properties *props = &prev_layer_properties[1][layer];
 	const struct video_layer_properties *props0 = &prev_layer_properties[0][layer];
@@ -862,7 +1186,7 @@ render_layer_line_tile(uint8_t layer, uint16_t y)
 	const int      size           = (map_addr_end - map_addr_begin) + 2;
 
 	uint8_t tile_bytes[512]; // max 256 tiles, 2 bytes each.
-	video_space_read_range(tile_bytes, map_addr_begin, size);
+	render_vram_read_range(tile_bytes, map_addr_begin, size);
 
 	uint8_t  palette_offset;
 	bool     vflip;
@@ -895,22 +1219,21 @@ render_layer_line_tile(uint8_t layer, uint16_t y)
 
 		int xx = eff_x & props->tilew_max;
 		if (hflip) {
-			xx          = xx ^ (props->tilew_max);
-			color_shift = 0;
-		} else {
-			color_shift = props->first_color_pos;
+			xx = xx ^ (props->tilew_max);
 		}
+		// the line may start in the middle of a byte
+		color_shift = props->first_color_pos - (xx & max_pixels_per_byte) * props->bits_per_pixel;
 
 		// additional bytes to reach the correct column of the tile
 		uint16_t x_add       = (xx << props->color_depth) >> 3;
 		uint32_t tile_offset = tile_start + (vflip ? y_add_flip : y_add) + x_add;
 
-		s = video_space_read(props->tile_base + tile_offset);
+		s = render_vram_read(props->tile_base + tile_offset);
 	}
 
 
 	// Render tile line.
-	for (int x = 0; x < SCREEN_WIDTH; x++) {
+	for (int x = 0; x < width; x++) {
 		const int eff_x = calc_layer_eff_x(props, x);
 
 		if ((eff_x & max_pixels_per_byte) == 0) {
@@ -946,7 +1269,7 @@ render_layer_line_tile(uint8_t layer, uint16_t y)
 			const uint16_t x_add       = (xx << props->color_depth) >> 3;
 			const uint32_t tile_offset = tile_start + (vflip ? y_add_flip : y_add) + x_add;
 
-			s = video_space_read(props->tile_base + tile_offset);
+			s = render_vram_read(props->tile_base + tile_offset);
 		}
 
 		// convert tile byte to indexed color
@@ -963,7 +1286,7 @@ render_layer_line_tile(uint8_t layer, uint16_t y)
 
 
 static void
-render_layer_line_bitmap(uint8_t layer, uint16_t y)
+render_layer_line_bitmap(uint8_t layer, uint16_t y, uint16_t width)
 {
 	const struct video_layer_properties *props = &prev_layer_properties[1][layer];
 //	const struct video_layer_properties *props0 = &prev_layer_properties[0][layer];
@@ -973,16 +1296,16 @@ render_layer_line_bitmap(uint8_t layer, uint16_t y)
 	uint32_t y_add = (yy * props->tilew * props->bits_per_pixel) >> 3;
 
 	// Render tile line.
-	for (int x = 0; x < SCREEN_WIDTH; x++) {
+	for (int x = 0; x < width; x++) {
 		int xx = x % props->tilew;
 
 		// extract all information from the map
-		uint8_t palette_offset = reg_layer[layer][4] & 0xf;
+		uint8_t palette_offset = render_reg_layer[layer][4] & 0xf;
 
 		// additional bytes to reach the correct column of the tile
 		uint16_t x_add = (xx * props->bits_per_pixel) >> 3;
 		uint32_t tile_offset = y_add + x_add;
-		uint8_t s = video_space_read(props->tile_base + tile_offset);
+		uint8_t s = render_vram_read(props->tile_base + tile_offset);
 
 		// convert tile byte to indexed color
 		uint8_t col_index = (s >> (props->first_color_pos - ((xx & props->color_fields_max) << props->color_depth))) & props->color_mask;
@@ -995,6 +1318,85 @@ render_layer_line_bitmap(uint8_t layer, uint16_t y)
 	}
 }
 
+static void
+render_layer_line(uint8_t layer, uint16_t y, uint16_t width)
+{
+	struct line_cache *cache = &layer_line_cache[layer];
+	if (cache->valid && cache->eff_y == y && cache->width >= width &&
+		cache->vram_gen == vram_gen &&
+		cache->layer_gen[0] == render_layer_gen[layer] &&
+		cache->layer_gen[1] == prev_layer_gen[0][layer] &&
+		cache->layer_gen[2] == prev_layer_gen[1][layer]) {
+		// e.g. the second output line of a source line at VSCALE=64
+		render_pages |= cache->pages;
+		return;
+	}
+
+	const uint64_t pages = render_pages;
+	render_pages = 0;
+
+	if (prev_layer_properties[1][layer].text_mode) {
+		render_layer_line_text(layer, y, width);
+	} else if (prev_layer_properties[1][layer].bitmap_mode) {
+		render_layer_line_bitmap(layer, y, width);
+	} else {
+		render_layer_line_tile(layer, y, width);
+	}
+
+	cache->valid = true;
+	cache->eff_y = y;
+	cache->width = width;
+	cache->vram_gen = vram_gen;
+	cache->layer_gen[0] = render_layer_gen[layer];
+	cache->layer_gen[1] = prev_layer_gen[0][layer];
+	cache->layer_gen[2] = prev_layer_gen[1][layer];
+	cache->pages = render_pages;
+	render_pages |= pages;
+}
+
+static void
+invalidate_lines()
+{
+	if (line_signatures) {
+		for (int y = 0; y < SCREEN_HEIGHT; y++) {
+			line_signatures[y].valid = false;
+		}
+	}
+	memset(dirty_lines, 0xff, sizeof(dirty_lines));
+}
+
+static bool
+line_is_clean(const struct line_signature *sig, const struct line_inputs *inputs)
+{
+	if (!sig->valid || sig->sprite_gen != sprite_gen || memcmp(&sig->inputs, inputs, sizeof(*inputs))) {
+		return false;
+	}
+	for (uint64_t pages = sig->pages; pages; pages &= pages - 1) {
+		if (vram_page_gen[__builtin_ctzll(pages)] > sig->vram_gen) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void
+video_set_line_sink(const struct video_line_sink *sink)
+{
+	line_sink = sink;
+}
+
+bool
+video_line_is_dirty(uint16_t y)
+{
+	return (dirty_lines[y >> 5] >> (y & 31)) & 1;
+}
+
+bool
+video_palette_is_dirty()
+{
+	return palette_changed;
+}
+
 inline static uint8_t calculate_line_col_index(uint8_t spr_zindex, uint8_t spr_col_index, uint8_t l1_col_index, uint8_t l2_col_index)
 {
 	uint8_t col_index = 0;
@@ -1015,6 +1417,15 @@ inline static uint8_t calculate_line_col_index(uint8_t spr_zindex, uint8_t spr_c
 	return col_index;
 }
 
+// The part of a line that the sink has so far: a framebuffer would have
+// the rest of it from before
+static void
+sink_send_part()
+{
+	line_sink->part(line_sink->ctx, sink_y, sink_x0, sink_x - sink_x0, sink_line);
+	sink_x = 0;
+}
+
 static void
 render_line(uint16_t y, uint32_t scan_pos_x)
 {
@@ -1025,8 +1436,8 @@ render_line(uint16_t y, uint32_t scan_pos_x)
 
 	static uint8_t col_line[SCREEN_WIDTH];
 
-	uint8_t dc_video = reg_composer[0];
-	uint16_t vstart = reg_composer[6] << 1;
+	uint8_t dc_video = render_reg_composer[0];
+	uint16_t vstart = render_reg_composer[6] << 1;
 
 	if (y != y_prev) {
 		y_prev = y;
@@ -1041,12 +1452,16 @@ render_line(uint16_t y, uint32_t scan_pos_x)
 		// at scan-out
 
 		memcpy(prev_reg_composer[1], prev_reg_composer[0], sizeof(*reg_composer) * COMPOSER_SLOTS);
-		memcpy(prev_reg_composer[0], reg_composer, sizeof(*reg_composer) * COMPOSER_SLOTS);
+		memcpy(prev_reg_composer[0], render_reg_composer, sizeof(*render_reg_composer) * COMPOSER_SLOTS);
 
 		// Same with the layer properties
 
 		memcpy(prev_layer_properties[1], prev_layer_properties[0], sizeof(*layer_properties) * NUM_LAYERS);
-		memcpy(prev_layer_properties[0], layer_properties, sizeof(*layer_properties) * NUM_LAYERS);
+		memcpy(prev_layer_properties[0], render_layer_properties, sizeof(*render_layer_properties) * NUM_LAYERS);
+		memcpy(prev_layer_gen[1], prev_layer_gen[0], sizeof(prev_layer_gen[0]));
+		memcpy(prev_layer_gen[0], render_layer_gen, sizeof(render_layer_gen));
+		memcpy(prev_reg_layer[1], prev_reg_layer[0], sizeof(prev_reg_layer[0]));
+		memcpy(prev_reg_layer[0], render_reg_layer, sizeof(render_reg_layer));
 
 		if ((dc_video & 3) > 1) { // 480i or 240p
 			if ((y >> 1) == 0) {
@@ -1067,6 +1482,11 @@ render_line(uint16_t y, uint32_t scan_pos_x)
 		y &= 0xfffe;
 	}
 
+	// The beam left the sink's line before its end
+	if (sink_x && (y != sink_y || s_pos_x_p == 0)) {
+		sink_send_part();
+	}
+
 	// refresh palette for next entry
 	if (video_palette.dirty) {
 		refresh_palette();
@@ -1085,15 +1505,31 @@ render_line(uint16_t y, uint32_t scan_pos_x)
 		eff_x_fp = 0;
 	}
 
-	uint8_t out_mode = reg_composer[0] & 3;
+	uint8_t out_mode = render_reg_composer[0] & 3;
+
+	uint8_t border_color = render_reg_composer[3];
+	uint16_t hstart = render_reg_composer[4] << 2;
+	uint16_t hstop = render_reg_composer[5] << 2;
+	uint16_t vstop = render_reg_composer[7] << 1;
+	const uint32_t scale = render_reg_composer[1];
 
-	uint8_t border_color = reg_composer[3];
-	uint16_t hstart = reg_composer[4] << 2;
-	uint16_t hstop = reg_composer[5] << 2;
-	uint16_t vstop = reg_composer[7] << 1;
+	hstart = hstart < 640 ? hstart : 640;
+	hstop = hstop < 640 ? hstop : 640;
 
 	uint16_t eff_y = (eff_y_fp >> 16);
 
+	// The layers only need to be rendered as far as the composer samples
+	// them in this call, e.g. 320 pixels at HSCALE=64.
+	uint16_t layer_width = 0;
+	if (out_mode != 0 && y >= vstart && y <= vstop) {
+		const uint16_t x0 = MAX(hstart, s_pos_x_p);
+		const uint16_t x1 = hstop < s_pos_x ? hstop : s_pos_x;
+		if (x1 > x0) {
+			const uint32_t last_eff_x = (eff_x_fp + (x1 - x0 - 1) * (scale << 9)) >> 16;
+			layer_width = last_eff_x < SCREEN_WIDTH ? last_eff_x + 1 : SCREEN_WIDTH;
+		}
+	}
+
 	layer_line_enable[0] = dc_video & 0x10;
 	layer_line_enable[1] = dc_video & 0x20;
 	sprite_line_enable   = dc_video & 0x40;
@@ -1101,58 +1537,80 @@ render_line(uint16_t y, uint32_t scan_pos_x)
 	// clear layer_line if layer gets disabled
 	for (uint8_t layer = 0; layer < 2; layer++) {
 		if (!layer_line_enable[layer] && old_layer_line_enable[layer]) {
-			memset(&layer_line[layer][s_pos_x_p], 0, SCREEN_WIDTH - s_pos_x_p);
-			//for (uint16_t i = s_pos_x_p; i < SCREEN_WIDTH; i++) {
-			//	layer_line[layer][i] = 0;
-			//}
+			// The part left of the beam has been composed already, and the
+			// layer is only partially rendered, so clear the whole line
+			// to keep stale pixels out of the following lines.
+			memset(layer_line[layer], 0, SCREEN_WIDTH);
+			layer_line_cache[layer].valid = false;
 		}
 		if (s_pos_x_p == 0)
 			old_layer_line_enable[layer] = layer_line_enable[layer];
 	}
 
 	// clear sprite_line if sprites get disabled
+	// (all of it, as with the layers: a disabled sprite layer has to be
+	// transparent on the following lines, too)
 	if (!sprite_line_enable && old_sprite_line_enable) {
-		memset(&sprite_line_col[s_pos_x_p], 0, SCREEN_WIDTH - s_pos_x_p);
-		memset(&sprite_line_z[s_pos_x_p], 0, SCREEN_WIDTH - s_pos_x_p);
-		memset(&sprite_line_mask[s_pos_x_p], 0, SCREEN_WIDTH - s_pos_x_p);
-		//for (uint16_t i = s_pos_x_p; i < SCREEN_WIDTH; i++) {
-		//	sprite_line_col[i] = 0;
-		//	sprite_line_z[i] = 0;
-		//	sprite_line_mask[i] = 0;
-		//}
+		memset(sprite_line_col, 0, SCREEN_WIDTH);
+		memset(sprite_line_z, 0, SCREEN_WIDTH);
+		memset(sprite_line_mask, 0, SCREEN_WIDTH);
+		sprite_line_cache.valid = false;
 	}
 
 	if (s_pos_x_p == 0)
 		old_sprite_line_enable = sprite_line_enable;
 
+	if (timing_only) {
+		if (sprite_line_enable) {
+			sprite_line_collisions |= render_sprite_line(eff_y, false);
+		}
+		s_pos_x_p = s_pos_x;
+		return;
+	}
 
+	// A line rendered in one go from the same inputs as last time
+	// is still in the framebuffer.
+	struct line_signature *sig = &line_signatures[y];
+	struct line_inputs inputs;
+	const bool full_line = s_pos_x_p == 0 && s_pos_x == SCREEN_WIDTH && out_mode != 0;
+	if (full_line) {
+		memcpy(inputs.composer, render_reg_composer, sizeof(inputs.composer));
+		memcpy(inputs.layer[0], render_reg_layer, sizeof(inputs.layer[0]));
+		memcpy(inputs.layer[1], prev_reg_layer[0], sizeof(inputs.layer[1]));
+		memcpy(inputs.layer[2], prev_reg_layer[1], sizeof(inputs.layer[2]));
+		inputs.eff_y = eff_y;
+		if (line_is_clean(sig, &inputs)) {
+			if (sprite_line_enable) {
+				sprite_line_collisions |= sig->collisions;
+			}
+			lines_skipped++;
+			s_pos_x_p = s_pos_x;
+			return;
+		}
+		lines_rendered++;
+	} else {
+		sig->valid = false;
+	}
 
+	uint8_t line_collisions = 0;
+	render_pages = 0;
 	if (sprite_line_enable) {
-		render_sprite_line(eff_y);
+		line_collisions = render_sprite_line(eff_y, true);
+		sprite_line_collisions |= line_collisions;
 	}
 
-	if (warp_mode && (frame_count & 3)) {
+	if (render_skip_frame) {
 		// sprites were needed for the collision IRQ, but we can skip
-		// everything else if we're in warp mode, most of the time
+		// everything else
 		return;
 	}
 
-	if (layer_line_enable[0]) {
-		if (prev_layer_properties[1][0].text_mode) {
-			render_layer_line_text(0, eff_y);
-		} else if (prev_layer_properties[1][0].bitmap_mode) {
-			render_layer_line_bitmap(0, eff_y);
-		} else {
-			render_layer_line_tile(0, eff_y);
+	if (layer_width) {
+		if (layer_line_enable[0]) {
+			render_layer_line(0, eff_y, layer_width);
 		}
-	}
-	if (layer_line_enable[1]) {
-		if (prev_layer_properties[1][1].text_mode) {
-			render_layer_line_text(1, eff_y);
-		} else if (prev_layer_properties[1][1].bitmap_mode) {
-			render_layer_line_bitmap(1, eff_y);
-		} else {
-			render_layer_line_tile(1, eff_y);
+		if (layer_line_enable[1]) {
+			render_layer_line(1, eff_y, layer_width);
 		}
 	}
 
@@ -1165,15 +1623,26 @@ render_line(uint16_t y, uint32_t scan_pos_x)
 			border_fill = border_fill | (border_fill << 16);
 			memset(col_line, border_fill, SCREEN_WIDTH);
 		} else {
-			hstart = hstart < 640 ? hstart : 640;
-			hstop = hstop < 640 ? hstop : 640;
-
 			for (uint16_t x = s_pos_x_p; x < hstart && x < s_pos_x; ++x) {
 				col_line[x] = border_color;
 			}
 
-			const uint32_t scale = reg_composer[1];
-			for (uint16_t x = MAX(hstart, s_pos_x_p); x < hstop && x < s_pos_x; ++x) {
+			uint16_t x = MAX(hstart, s_pos_x_p);
+			if (scale == 64 && (eff_x_fp & 0x7fff) == 0) {
+				// HSCALE=64: every source pixel covers two output pixels
+				const uint16_t x_end = hstop < s_pos_x ? hstop : s_pos_x;
+				if (x < x_end && (eff_x_fp & 0x8000)) {
+					uint16_t eff_x = eff_x_fp >> 16;
+					col_line[x++] = calculate_line_col_index(sprite_line_z[eff_x], sprite_line_col[eff_x], layer_line[0][eff_x], layer_line[1][eff_x]);
+					eff_x_fp += 0x8000;
+				}
+				for (; x + 1 < x_end; x += 2) {
+					uint16_t eff_x = eff_x_fp >> 16;
+					col_line[x] = col_line[x + 1] = calculate_line_col_index(sprite_line_z[eff_x], sprite_line_col[eff_x], layer_line[0][eff_x], layer_line[1][eff_x]);
+					eff_x_fp += 0x10000;
+				}
+			}
+			for (; x < hstop && x < s_pos_x; ++x) {
 				uint16_t eff_x = eff_x_fp >> 16;
 				col_line[x] = calculate_line_col_index(sprite_line_z[eff_x], sprite_line_col[eff_x], layer_line[0][eff_x], layer_line[1][eff_x]);
 				eff_x_fp += (scale << 9);
@@ -1185,7 +1654,14 @@ render_line(uint16_t y, uint32_t scan_pos_x)
 	}
 
 	// Look up all color indices.
-	uint8_t* framebuffer4_begin = framebuffer + (y * SCREEN_WIDTH) + s_pos_x_p;
+	uint8_t* framebuffer4_begin = (framebuffer ? framebuffer + (y * SCREEN_WIDTH) : sink_line) + s_pos_x_p;
+	if (line_sink) {
+		if (!sink_x) {
+			sink_y = y;
+			sink_x0 = s_pos_x_p;
+		}
+		sink_x = s_pos_x;
+	}
 	{
 		uint8_t* framebuffer4 = framebuffer4_begin;
 		for (uint16_t x = s_pos_x_p; x < s_pos_x; x++) {
@@ -1211,13 +1687,213 @@ render_line(uint16_t y, uint32_t scan_pos_x)
 		}
 	}
 
+	if (sink_check) {
+		memcpy(sink_check + y * SCREEN_WIDTH + s_pos_x_p, framebuffer4_begin, s_pos_x - s_pos_x_p);
+	}
+
+	if (full_line) {
+		sig->valid = true;
+		sig->collisions = line_collisions;
+		sig->inputs = inputs;
+		sig->pages = render_pages;
+		sig->vram_gen = vram_gen;
+		sig->sprite_gen = sprite_gen;
+	}
+	dirty_lines[y >> 5] |= 1u << (y & 31);
+	if (render_reg_composer[1] != 64 || prev_reg_composer[1][2] != 64) {
+		frame_scaled_2x = false;
+	}
+	if (line_sink && s_pos_x == SCREEN_WIDTH && s_pos_x_p < s_pos_x) {
+		if (sink_x0) {
+			line_sink->part(line_sink->ctx, y, sink_x0, SCREEN_WIDTH - sink_x0, sink_line);
+		} else {
+			line_sink->line(line_sink->ctx, y, sink_line);
+		}
+		sink_x = 0;
+	}
+
 	s_pos_x_p = s_pos_x;
 }
 
+static void
+apply_composer(uint8_t i, uint8_t value)
+{
+	if (i == 0) {
+		// if progressive mode field goes from 0 to 1
+		// or if mode goes from vga to something else with
+		// progressive mode on, clear the framebuffer
+		if (((render_reg_composer[0] & 0x8) == 0 && (value & 0x8)) ||
+			((render_reg_composer[0] & 0x3) == 1 && (value & 0x3) > 1 && (value & 0x8))) {
+			if (framebuffer) {
+				memset(framebuffer, 0x00, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(*framebuffer));
+			} else if (line_sink && !timing_only) {
+				if (sink_check) {
+					memset(sink_check, 0x00, SCREEN_WIDTH * SCREEN_HEIGHT);
+				}
+				memset(sink_line, 0x00, SCREEN_WIDTH);
+				for (uint16_t y = 0; y < SCREEN_HEIGHT; y++) {
+					line_sink->line(line_sink->ctx, y, sink_line);
+				}
+				// the line so far is black, like the rest
+				sink_x0 = 0;
+			}
+			invalidate_lines();
+		}
+		// the palette depends on the output mode and chroma disable
+		if ((render_reg_composer[0] ^ value) & 0x07) {
+			memset(video_palette.dirty_entries, 0xff, sizeof(video_palette.dirty_entries));
+			video_palette.dirty = true;
+		}
+		render_reg_composer[0] = value;
+	} else {
+		render_reg_composer[i] = value;
+	}
+}
+
+static void
+video_flush()
+{
+	for (uint16_t i = 0; i < journal_len; i++) {
+		const struct journal_entry *e = &journal[i];
+		switch (e->type) {
+			case JOURNAL_LINE:
+				render_line(e->a, e->b);
+				break;
+			case JOURNAL_COMPOSER:
+				apply_composer(e->a, e->value);
+				break;
+			case JOURNAL_LAYER:
+				render_reg_layer[e->a][e->b] = e->value;
+				refresh_layer_properties(&render_layer_properties[e->a], render_reg_layer[e->a]);
+				render_layer_gen[e->a]++;
+				break;
+			case JOURNAL_FRAME:
+				last_frame_skipped = render_skip_frame;
+				render_skip_frame = e->value;
+				break;
+		}
+	}
+	journal_len = 0;
+}
+
+static void
+palette_entry_changed(uint8_t i)
+{
+	video_palette.dirty_entries[i >> 5] |= 1u << (i & 31);
+	video_palette.dirty = true;
+}
+
+// A display register changed, after the beam caught up with it
+static void
+register_write_prepare()
+{
+	if (vga_scan_pos_y < SCREEN_HEIGHT) {
+		layers_raster = true;
+	}
+}
+
+// Called before anything in video RAM changes: the lines the beam has
+// already passed must still be rendered from the old contents.
+static void
+vram_write_prepare(uint32_t address)
+{
+	address &= 0x1FFFF;
+	if (address >= ADDR_PSG_START && address < ADDR_PSG_END) {
+		// the PSG's registers aren't drawn: music keeps the lines that
+		// were rendered
+		return;
+	}
+	video_flush();
+	if (vga_scan_pos_y < SCREEN_HEIGHT) {
+		if (address >= ADDR_PALETTE_START) {
+			// the palette and the sprite attributes
+			layers_raster = true;
+		} else {
+			layers_vram = true;
+		}
+	}
+	vram_gen++;
+	vram_page_gen[address >> VRAM_PAGE_SHIFT] = vram_gen;
+}
+
+static void
+journal_add(uint8_t type, uint16_t a, uint16_t b, uint8_t value)
+{
+	if (journal_len == JOURNAL_SIZE) {
+		video_flush();
+	}
+	struct journal_entry *e = &journal[journal_len++];
+	e->type = type;
+	e->value = value;
+	e->a = a;
+	e->b = b;
+}
+
+static void
+journal_line(uint16_t y, uint16_t scan_pos_x)
+{
+	// a line that is continued without any writes in between
+	// only needs to be rendered once, up to the later position
+	if (journal_len) {
+		struct journal_entry *e = &journal[journal_len - 1];
+		if (e->type == JOURNAL_LINE && e->a == y && e->b <= scan_pos_x) {
+			e->b = scan_pos_x;
+			return;
+		}
+	}
+	journal_add(JOURNAL_LINE, y, scan_pos_x, 0);
+}
+
+// At VSYNC: sends the frame as a display list if it is drawn like that,
+// and finds out whether the next one can be
+static void
+layers_end_frame()
+{
+	layers_sent = false;
+	if (!layers) {
+		return;
+	}
+
+	struct eve_layers_state state;
+	state.vram = video_ram;
+	state.palette = palette;
+	state.sprites = sprite_data[0];
+	memcpy(state.composer, render_reg_composer, sizeof(state.composer));
+	memcpy(state.layer, render_reg_layer, sizeof(state.layer));
+	state.y_scale = EVE_DISPLAY_Y_SCALE;
+	const eve_layers_result_t result = eve_layers_build(&state, layers);
+
+	if (layers_frame && result == EVE_LAYERS_OK) {
+		eve_present_list(&state, layers);
+		layers_sent = true;
+		layers_frames++;
+#if !ESP_PLATFORM
+		// only the frames that didn't change while they were on the
+		// screen look the same
+		if (framebuffer && !layers_raster && !layers_vram && !render_skip_frame) {
+			eve_mock_check_list(framebuffer, video_palette.argb);
+		}
+#endif
+	}
+
+	// a line IRQ most likely means raster effects, too
+	const bool raster = layers_raster || (ien & 2);
+	if (raster) {
+		layers_raster_frames++;
+	} else if (result != EVE_LAYERS_OK) {
+		layers_fallbacks[result]++;
+	}
+	layers_next = !raster && result == EVE_LAYERS_OK;
+}
+
 static void
 update_isr_and_coll(uint16_t y, uint16_t compare)
 {
 	if (y == SCREEN_HEIGHT) {
+		// Sprite collisions are only latched here, so catching up with
+		// the beam at VSYNC is all the ISR needs to be exact.
+		video_flush();
+		layers_end_frame();
 		if (sprite_line_collisions != 0) {
 			isr |= 4;
 		}
@@ -1230,6 +1906,42 @@ update_isr_and_coll(uint16_t y, uint16_t compare)
 	}
 }
 
+// Decides at the start of a frame whether to render it
+static bool
+skip_next_frame()
+{
+	static int skipped;
+	bool skip;
+
+	if (warp_mode && frameskip <= 0) {
+		// warp mode shows every 4th frame, unless told otherwise
+		skip = (frame_count & 3) != 0;
+	} else if (frameskip == FRAMESKIP_AUTO) {
+		skip = timing_is_behind() && skipped < FRAMESKIP_AUTO_MAX;
+	} else {
+		skip = skipped < frameskip;
+	}
+	skipped = skip ? skipped + 1 : 0;
+	return skip;
+}
+
+static void
+start_frame()
+{
+	frame_count++;
+	const bool skip = skip_next_frame();
+	layers_frame = layers && layers_next && !skip;
+	layers_raster = false;
+	layers_vram = false;
+#if ESP_PLATFORM
+	// the EVE draws it, only the sprite collisions are needed
+	journal_add(JOURNAL_FRAME, 0, 0, skip || layers_frame);
+#else
+	// rendered anyway, to check the display list against
+	journal_add(JOURNAL_FRAME, 0, 0, skip);
+#endif
+}
+
 bool
 video_step(uint32_t mhz, uint32_t steps, bool midline)
 {
@@ -1244,14 +1956,14 @@ video_step(uint32_t mhz, uint32_t steps, bool midline)
 	if (vga_scan_pos_x > VGA_SCAN_WIDTH) {
 		vga_scan_pos_x -= VGA_SCAN_WIDTH;
 		if (!ntsc_mode) {
-			render_line(vga_scan_pos_y - VGA_Y_OFFSET, VGA_SCAN_WIDTH);
+			journal_line(vga_scan_pos_y - VGA_Y_OFFSET, VGA_SCAN_WIDTH);
 		}
 		vga_scan_pos_y++;
 		if (vga_scan_pos_y == SCAN_HEIGHT) {
 			vga_scan_pos_y = 0;
 			if (!ntsc_mode) {
 				new_frame = true;
-				frame_count++;
+				start_frame();
 			}
 		}
 		if (!ntsc_mode) {
@@ -1259,7 +1971,7 @@ video_step(uint32_t mhz, uint32_t steps, bool midline)
 		}
 	} else if (midline) {
 		if (!ntsc_mode) {
-			render_line(vga_scan_pos_y - VGA_Y_OFFSET, vga_scan_pos_x);
+			journal_line(vga_scan_pos_y - VGA_Y_OFFSET, vga_scan_pos_x);
 		}
 	}
 	ntsc_half_cnt += num;
@@ -1269,12 +1981,12 @@ video_step(uint32_t mhz, uint32_t steps, bool midline)
 			if (ntsc_scan_pos_y < SCAN_HEIGHT) {
 				y = ntsc_scan_pos_y - NTSC_Y_OFFSET_LOW;
 				if ((y & 1) == 0) {
-					render_line(y, NTSC_HALF_SCAN_WIDTH);
+					journal_line(y, NTSC_HALF_SCAN_WIDTH);
 				}
 			} else {
 				y = ntsc_scan_pos_y - NTSC_Y_OFFSET_HIGH;
 				if ((y & 1) == 0) {
-					render_line(y | 1, NTSC_HALF_SCAN_WIDTH);
+					journal_line(y | 1, NTSC_HALF_SCAN_WIDTH);
 				}
 			}
 		}
@@ -1283,7 +1995,7 @@ video_step(uint32_t mhz, uint32_t steps, bool midline)
 			reg_composer[0] |= 0x80;
 			if (ntsc_mode) {
 				new_frame = true;
-				frame_count++;
+				start_frame();
 			}
 		}
 		if (ntsc_scan_pos_y == SCAN_HEIGHT*2) {
@@ -1291,7 +2003,7 @@ video_step(uint32_t mhz, uint32_t steps, bool midline)
 			ntsc_scan_pos_y = 0;
 			if (ntsc_mode) {
 				new_frame = true;
-				frame_count++;
+				start_frame();
 			}
 		}
 		if (ntsc_mode) {
@@ -1307,12 +2019,12 @@ video_step(uint32_t mhz, uint32_t steps, bool midline)
 			if (ntsc_scan_pos_y < SCAN_HEIGHT) {
 				y = ntsc_scan_pos_y - NTSC_Y_OFFSET_LOW;
 				if ((y & 1) == 0) {
-					render_line(y, ntsc_half_cnt);
+					journal_line(y, ntsc_half_cnt);
 				}
 			} else {
 				y = ntsc_scan_pos_y - NTSC_Y_OFFSET_HIGH;
 				if ((y & 1) == 0) {
-					render_line(y | 1, ntsc_half_cnt);
+					journal_line(y | 1, ntsc_half_cnt);
 				}
 			}
 		}
@@ -1342,12 +2054,84 @@ video_save(SDL_RWops *f)
 	SDL_RWwrite(f, &sprite_data[0], sizeof(uint8_t), sizeof(sprite_data));
 }
 
+#if !ESP_PLATFORM
+// The palette as the ESP32 sends it to the EVE display
+static const uint16_t *
+eve_mock_palette()
+{
+	static uint16_t palette565[256];
+	for (int i = 0; i < 256; i++) {
+		const SDL_Color *c = &video_palette.entries[i];
+		palette565[i] = (c->r >> 3) << 11 | (c->g >> 2) << 5 | c->b >> 3;
+	}
+	return palette565;
+}
+
+// Looks up a line of color indices in the palette
+static void
+expand_line_argb(uint32_t *dst, const uint8_t *src, const uint32_t *argb)
+{
+	// 8 independent lookups per iteration, SCREEN_WIDTH is a multiple of 8
+	for (uint16_t x = 0; x < SCREEN_WIDTH; x += 8) {
+		dst[x + 0] = argb[src[x + 0]];
+		dst[x + 1] = argb[src[x + 1]];
+		dst[x + 2] = argb[src[x + 2]];
+		dst[x + 3] = argb[src[x + 3]];
+		dst[x + 4] = argb[src[x + 4]];
+		dst[x + 5] = argb[src[x + 5]];
+		dst[x + 6] = argb[src[x + 6]];
+		dst[x + 7] = argb[src[x + 7]];
+	}
+}
+
+// Brings the lines that changed since the last update into the texture,
+// or all of them if the palette changed.
+static void
+update_texture(const uint8_t *source)
+{
+	uint16_t y0 = 0;
+	uint16_t y1 = SCREEN_HEIGHT;
+	if (!palette_changed) {
+		while (y0 < y1 && !video_line_is_dirty(y0)) {
+			y0++;
+		}
+		while (y1 > y0 && !video_line_is_dirty(y1 - 1)) {
+			y1--;
+		}
+	}
+	if (y0 == y1) {
+		return;
+	}
+
+	// The locked pixels are write-only, so every line in the
+	// rectangle gets written.
+	const SDL_Rect rect = { 0, y0, SCREEN_WIDTH, y1 - y0 };
+	void *pixels;
+	int pitch;
+	if (SDL_LockTexture(sdlTexture, &rect, &pixels, &pitch)) {
+		return;
+	}
+	for (uint16_t y = y0; y < y1; y++) {
+		expand_line_argb((uint32_t *)((uint8_t *)pixels + (y - y0) * pitch), source + y * SCREEN_WIDTH, video_palette.argb);
+	}
+	SDL_UnlockTexture(sdlTexture);
+}
+#endif
+
 bool
 video_update()
 {
 	static bool cmd_down = false;
 
 	bool mouse_changed = false;
+
+	video_flush();
+
+	if (log_video && lines_rendered + lines_skipped >= SCREEN_HEIGHT * 60) {
+		printf("Video: %u%% of lines unchanged\n", lines_skipped * 100 / (lines_rendered + lines_skipped));
+		lines_rendered = 0;
+		lines_skipped = 0;
+	}
 /*
 	// for activity LED, overlay red 8x4 square into top right of framebuffer
 	// for progressive modes, draw LED only on even scanlines
@@ -1365,34 +2149,62 @@ video_update()
 		}
 	}
 */
+	// a skipped frame left the framebuffer as it was: nothing to show,
+	// and the changes so far are kept for the next frame that is shown
+	if (!last_frame_skipped) {
 #if ESP_PLATFORM
-	extern void vga_display(void* framebuffer, void* palette);
-	vga_display(framebuffer, video_palette.entries);
+		extern void vga_display(void* framebuffer, void* palette, const uint32_t *dirty_lines, bool palette_dirty, bool scaled_2x);
+		if (line_sink) {
+			if (sink_x) {
+				sink_send_part();
+			}
+			line_sink->frame(line_sink->ctx, (const uint16_t *)video_palette.entries, palette_changed);
+		} else {
+			vga_display(framebuffer, video_palette.entries, dirty_lines, palette_changed, frame_scaled_2x);
+		}
 #else
-	//SDL_UpdateTexture(sdlTexture, NULL, framebuffer, SCREEN_WIDTH * sizeof(*framebuffer));
-	SDL_LockSurface(surface);
-	SDL_memcpy(surface->pixels, framebuffer, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(*framebuffer));
-	SDL_UnlockSurface(surface);
+		if (line_sink) {
+			if (sink_x) {
+				sink_send_part();
+			}
+			line_sink->frame(line_sink->ctx, eve_mock_palette(), palette_changed);
+			// show what is on the simulated display
+			if (eve_mock_screen()) {
+				update_texture(eve_mock_screen());
+			}
+		} else {
+			if (eve_mock != EVE_MOCK_OFF && !layers_sent) {
+				// what the ESP32 would send to its display
+				eve_present_submit(framebuffer, eve_mock_palette(), dirty_lines, palette_changed, frame_scaled_2x, false);
+			}
+			update_texture(framebuffer);
+		}
 
-	SDL_SetPaletteColors(surface->format->palette, video_palette.entries, 0, 256);
-	SDL_BlitSurface(surface, NULL, SDL_GetWindowSurface(window), NULL);
-	SDL_UpdateWindowSurface(window);
-	/*
-	SDL_RenderClear(renderer);
-	SDL_RenderCopy(renderer, sdlTexture, NULL, NULL);
+		SDL_RenderClear(renderer);
+		SDL_RenderCopy(renderer, sdlTexture, NULL, NULL);
 
-	if (debugger_enabled && showDebugOnRender != 0) {
-		DEBUGRenderDisplay(SCREEN_WIDTH, SCREEN_HEIGHT);
-	}
+		if (debugger_enabled && showDebugOnRender != 0) {
+			DEBUGRenderDisplay(SCREEN_WIDTH, SCREEN_HEIGHT);
+		}
 
-	SDL_RenderPresent(renderer);
-	*/
+		SDL_RenderPresent(renderer);
 #endif
 
+		// after a display list, the buffers on the EVE still need
+		// the changes
+		if (!layers_sent) {
+			memset(dirty_lines, 0, sizeof(dirty_lines));
+			palette_changed = false;
+		}
+		frame_scaled_2x = true;
+	}
+
 	if (record_gif > RECORD_GIF_PAUSED) {
-		if(false /*!GifWriteFrame(&gif_writer, framebuffer, SCREEN_WIDTH, SCREEN_HEIGHT, 2, 8, false)*/) {
+		uint8_t rgb[256 * 3];
+		palette_rgb(rgb);
+		if (!gif_recorder_frame(framebuffer, rgb)) {
 			// if that failed, stop recording
-			GifEnd(&gif_writer);
+			gif_recorder_end();
 			record_gif = RECORD_GIF_DISABLED;
 			printf("Unexpected end of recording.\n");
 		}
@@ -1401,6 +2213,20 @@ video_update()
 		}
 	}
 
+	// skipped frames are missing from the capture and the shared memory
+	if ((capturing || shm_exporting) && !last_frame_skipped) {
+		uint8_t rgb[256 * 3];
+		palette_rgb(rgb);
+		if (capturing && !capture_frame(framebuffer, rgb, frame_count)) {
+			capture_end();
+			capturing = false;
+			printf("Unexpected end of capture.\n");
+		}
+		if (shm_exporting) {
+			shm_export_frame(framebuffer, rgb, frame_count);
+		}
+	}
+
 	if (debugger_enabled && showDebugOnRender != 0)
 		return true;
 
@@ -1539,13 +2365,46 @@ video_end()
 		DEBUGFreeUI();
 	}
 
+#if !ESP_PLATFORM
+	if (layers) {
+		printf("EVE layers: %u frames drawn from display lists, rendered: %u with raster effects", layers_frames, layers_raster_frames);
+		for (int i = EVE_LAYERS_OK + 1; i < EVE_LAYERS_RESULTS; i++) {
+			if (layers_fallbacks[i]) {
+				printf(", %u %s", layers_fallbacks[i], eve_layers_result_string(i));
+			}
+		}
+		printf("\n");
+	}
+	if (eve_mock != EVE_MOCK_OFF && framebuffer) {
+		// whatever was dropped or drawn from a display list, the last
+		// frame has to be on the screen
+		eve_present_submit(framebuffer, eve_mock_palette(), dirty_lines, palette_changed, frame_scaled_2x, true);
+		eve_present_flush();
+		eve_mock_check(framebuffer, eve_mock_palette());
+	}
+	if (eve_mock != EVE_MOCK_OFF) {
+		eve_mock_report();
+	}
+#endif
+
 	if (record_gif != RECORD_GIF_DISABLED) {
-		GifEnd(&gif_writer);
+		gif_recorder_end();
 		record_gif = RECORD_GIF_DISABLED;
 	}
+	if (capturing) {
+		capture_end();
+		capturing = false;
+	}
+	if (shm_exporting) {
+		shm_export_end();
+		shm_exporting = false;
+	}
 
 	is_fullscreen = false;
 	SDL_SetWindowFullscreen(window, 0);
+	if (sdlTexture) {
+		SDL_DestroyTexture(sdlTexture);
+	}
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 }
@@ -1705,17 +2564,19 @@ video_space_read_range(uint8_t* dest, uint32_t address, uint32_t size)
 void
 video_space_write(uint32_t address, uint8_t value)
 {
+	vram_write_prepare(address);
+
 	video_ram[address & 0x1FFFF] = value;
 
 	if (address >= ADDR_PSG_START && address < ADDR_PSG_END) {
-		audio_render();
-		psg_writereg(address & 0x3f, value);
+		audio_write_psg(address & 0x3f, value);
 	} else if (address >= ADDR_PALETTE_START && address < ADDR_PALETTE_END) {
 		palette[address & 0x1ff] = value;
-		video_palette.dirty = true;
+		palette_entry_changed((address & 0x1ff) >> 1);
 	} else if (address >= ADDR_SPRDATA_START && address < ADDR_SPRDATA_END) {
 		sprite_data[(address >> 3) & 0x7f][address & 0x7] = value;
 		refresh_sprite_properties((address >> 3) & 0x7f);
+		sprite_gen++;
 	}
 }
 
@@ -1723,6 +2584,8 @@ video_space_write(uint32_t address, uint8_t value)
 void
 fx_video_space_write(uint32_t address, bool nibble, uint8_t value)
 {
+	vram_write_prepare(address);
+
 	if (fx_4bit_mode) {
 		if (nibble) {
 			if (!fx_trans_writes || (value & 0x0f) > 0) {
@@ -1737,20 +2600,22 @@ fx_video_space_write(uint32_t address, bool nibble, uint8_t value)
 		if (!fx_trans_writes || value > 0) video_ram[address & 0x1FFFF] = value;
 	}
 	if (address >= ADDR_PSG_START && address < ADDR_PSG_END) {
-		audio_render();
-		psg_writereg(address & 0x3f, value);
+		audio_write_psg(address & 0x3f, value);
 	} else if (address >= ADDR_PALETTE_START && address < ADDR_PALETTE_END) {
 		palette[address & 0x1ff] = value;
-		video_palette.dirty = true;
+		palette_entry_changed((address & 0x1ff) >> 1);
 	} else if (address >= ADDR_SPRDATA_START && address < ADDR_SPRDATA_END) {
 		sprite_data[(address >> 3) & 0x7f][address & 0x7] = value;
 		refresh_sprite_properties((address >> 3) & 0x7f);
+		sprite_gen++;
 	}
 }
 
 void
 fx_vram_cache_write(uint32_t address, uint8_t value, uint8_t mask)
 {
+	vram_write_prepare(address);
+
 	if (!fx_trans_writes || value > 0) {
 		switch (mask) {
 			case 0:
@@ -1911,7 +2776,7 @@ uint8_t video_read(uint8_t reg, bool debugOn) {
 		case 0x19:
 		case 0x1A: return reg_layer[1][reg - 0x14];
 
-		case 0x1B: audio_render(); return pcm_read_ctrl();
+		case 0x1B: audio_render_pcm(); return pcm_read_ctrl();
 		case 0x1C: return pcm_read_rate();
 		case 0x1D: return 0;
 
@@ -1953,6 +2818,7 @@ void video_write(uint8_t reg, uint8_t value) {
 		case 0x04: {
 			if (fx_2bit_poking && fx_addr1_mode) {
 				fx_2bit_poking = false;
+				vram_write_prepare(io_addr[1]);
 				uint8_t mask = value >> 6;
 				switch (mask) {
 					case 0x00:
@@ -2044,19 +2910,16 @@ void video_write(uint8_t reg, uint8_t value) {
 			video_step(MHZ, 0, true); // potential midline raster effect
 			int i = reg - 0x09 + (io_dcsel << 2);
 			if (i == 0) {
-				// if progressive mode field goes from 0 to 1
-				// or if mode goes from vga to something else with
-				// progressive mode on, clear the framebuffer
-				if (((reg_composer[0] & 0x8) == 0 && (value & 0x8)) ||
-					((reg_composer[0] & 0x3) == 1 && (value & 0x3) > 1 && (value & 0x8))) {
-					memset(framebuffer, 0x00, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(*framebuffer));
-				}
-
 				// interlace field bit is read-only
 				reg_composer[0] = (reg_composer[0] & ~0x7f) | (value & 0x7f);
-				video_palette.dirty = true;
+				journal_add(JOURNAL_COMPOSER, 0, 0, value & 0x7f);
+				register_write_prepare();
 			} else {
 				reg_composer[i] = value;
+				if (i < 8) {
+					journal_add(JOURNAL_COMPOSER, i, 0, value);
+					register_write_prepare();
+				}
 			}
 
 			switch (i) {
@@ -2166,7 +3029,9 @@ void video_write(uint8_t reg, uint8_t value) {
 		case 0x13:
 			video_step(MHZ, 0, true); // potential midline raster effect
 			reg_layer[0][reg - 0x0D] = value;
-			refresh_layer_properties(0);
+			refresh_layer_properties(&layer_properties[0], reg_layer[0]);
+			journal_add(JOURNAL_LAYER, 0, reg - 0x0D, value);
+			register_write_prepare();
 			break;
 
 		case 0x14:
@@ -2178,12 +3043,14 @@ void video_write(uint8_t reg, uint8_t value) {
 		case 0x1A:
 			video_step(MHZ, 0, true); // potential midline raster effect
 			reg_layer[1][reg - 0x14] = value;
-			refresh_layer_properties(1);
+			refresh_layer_properties(&layer_properties[1], reg_layer[1]);
+			journal_add(JOURNAL_LAYER, 1, reg - 0x14, value);
+			register_write_prepare();
 			break;
 
-		case 0x1B: audio_render(); pcm_write_ctrl(value); break;
-		case 0x1C: audio_render(); pcm_write_rate(value); break;
-		case 0x1D: audio_render(); pcm_write_fifo(value); break;
+		case 0x1B: audio_render_pcm(); sound_log_write(SOUND_LOG_PCM_CTRL, 0, value); pcm_write_ctrl(value); break;
+		case 0x1C: audio_render_pcm(); sound_log_write(SOUND_LOG_PCM_RATE, 0, value); pcm_write_rate(value); break;
+		case 0x1D: audio_render_pcm(); sound_log_write(SOUND_LOG_PCM_FIFO, 0, value); pcm_write_fifo(value); break;
 
 		case 0x1E:
 		case 0x1F:
@@ -12,6 +12,7 @@
 #include "glue.h"
 
 bool video_init(int window_scale, float screen_x_scale, const char *quality, bool fullscreen, float opacity);
+void video_init_headless(void);
 void video_reset(void);
 bool video_step(uint32_t mhz, uint32_t steps, bool midline);
 bool video_update(void);
@@ -35,4 +36,26 @@ bool video_is_special_address(int addr);
 
 uint32_t video_get_address(uint8_t sel);
 
+// Changes since the last video_update(), for display backends that only
+// want to transfer what changed
+bool video_line_is_dirty(uint16_t y);
+bool video_palette_is_dirty(void);
+
+// Output without a framebuffer (-stream-lines): every line that changed
+// is handed over as soon as it is complete, and at the end of each frame
+// the palette (256 RGB565 entries) with whether it changed. The sink has
+// to keep the lines, unchanged ones are not sent again. A line that the
+// beam left or entered mid-way (a switch of the output mode or of
+// progressive scan) comes as part, the pixels from x to x + width; the
+// rest of it stays as it was, like in a framebuffer.
+struct video_line_sink {
+	void (*line)(void *ctx, uint16_t y, const uint8_t *pixels);
+	void (*part)(void *ctx, uint16_t y, uint16_t x, uint16_t width, const uint8_t *pixels);
+	void (*frame)(void *ctx, const uint16_t *palette, bool palette_dirty);
+	void *ctx;
+};
+
+// before video_init()
+void video_set_line_sink(const struct video_line_sink *sink);
+
 #endif
@@ -1,6 +1,38 @@
 #include "ymglue.h"
 #include "ymfm_opm.h"
+// fm_engine_base::clock(), which ymfm_opm.cpp only has inlined
+#include "ymfm_fm.ipp"
 #include <cstdint>
+#include <cstring>
+
+// The chip, with the FM engine open to tell when it is silent
+class ym2151_chip : public ymfm::ym2151 {
+	public:
+		ym2151_chip(ymfm::ymfm_interface &intf):
+			ymfm::ym2151(intf)
+		{ }
+
+		// Every operator is released and fully attenuated, and no timer
+		// keys them on (CSM): the output is zero until a register write
+		bool quiet() {
+			if (m_fm.regs().csm()) {
+				return false;
+			}
+			for (uint32_t i = 0; i < fm_engine::OPERATORS; i++) {
+				const auto *op = m_fm.debug_operator(i);
+				if (op->debug_eg_state() != ymfm::EG_RELEASE || op->debug_eg_attenuation() != 0x3ff) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// A sample of the envelope counter, the LFO and the noise, without
+		// the operators: they stay silent, and key on resets their phase
+		void clock_idle() {
+			m_fm.clock(0);
+		}
+};
 
 class ym2151_interface : public ymfm::ymfm_interface {
 	public:
@@ -8,7 +40,8 @@ class ym2151_interface : public ymfm::ymfm_interface {
 			m_chip(*this),
 			m_timers{0, 0},
 			m_busy_timer{ 0 },
-			m_irq_status{ false }
+			m_irq_status{ false },
+			m_idle{ false }
 		{ }
 		~ym2151_interface() { }
 
@@ -53,6 +86,7 @@ class ym2151_interface : public ymfm::ymfm_interface {
 			if (!ymfm_is_busy()) {
 				m_chip.write_address(addr);
 				m_chip.write_data(value);
+				m_idle = false;
 			} else {
 				printf("YM2151 write received while busy.\n");
 			}
@@ -62,6 +96,14 @@ class ym2151_interface : public ymfm::ymfm_interface {
 			int s = 0;
 			int ls, rs;
 			update_clocks(numsamples);
+			if (m_idle) {
+				// the timers and the busy time above still run
+				for (uint32_t i = 0; i < numsamples; i++) {
+					m_chip.clock_idle();
+				}
+				memset(output, 0, numsamples * 2 * sizeof(int16_t));
+				return;
+			}
 			for (uint32_t i = 0; i < numsamples; i++) {
 				m_chip.generate(&opm_out);
 				ls = opm_out.data[0];
@@ -73,6 +115,8 @@ class ym2151_interface : public ymfm::ymfm_interface {
 				output[s++] = ls;
 				output[s++] = rs;
 			}
+			// after a write, a sample has run the engine with it
+			m_idle = numsamples > 0 && m_chip.quiet();
 		}
 
 		uint8_t read_status() {
@@ -84,16 +128,98 @@ class ym2151_interface : public ymfm::ymfm_interface {
 		}
 
 	private:
-		ymfm::ym2151 m_chip;
+		ym2151_chip m_chip;
 		int32_t m_timers[2];
 		int32_t m_busy_timer;
 		bool m_irq_status;
+		bool m_idle;
 
 		ymfm::ym2151::output_data opm_out;
 };
 
+// The timers as ymfm runs them, but computed for any point in time
+// instead of counted down while rendering. Times are in samples, which
+// are 64 clocks of the chip.
+class ym2151_timers {
+	public:
+		void write(uint64_t sample, uint8_t reg, uint8_t val) {
+			if (busy(sample)) {
+				// the chip ignores it, too
+				return;
+			}
+			advance(sample);
+			m_last_write = sample + 1;
+			switch (reg) {
+				case 0x10: m_timer_a = (m_timer_a & 3) | val << 2; break;
+				case 0x11: m_timer_a = (m_timer_a & ~3) | (val & 3); break;
+				case 0x12: m_timer_b = val; break;
+				case 0x14:
+					m_mode = val;
+					m_status &= ~(val >> 4 & 3);
+					// timer B's first period is shorter, its *16
+					// prescaler is free running
+					load(1, val & 2, sample, -(int32_t)(sample & 15));
+					load(0, val & 1, sample, 0);
+					break;
+			}
+		}
+
+		uint8_t status(uint64_t sample) {
+			advance(sample);
+			return m_status | (busy(sample) ? 0x80 : 0);
+		}
+
+		bool irq(uint64_t sample) {
+			advance(sample);
+			return m_status != 0;
+		}
+
+	private:
+		// a write keeps the chip busy until the next sample
+		bool busy(uint64_t sample) {
+			return m_last_write == sample + 1;
+		}
+
+		uint32_t period(int t) {
+			return t == 0 ? 1024 - m_timer_a : 16 * (256 - m_timer_b);
+		}
+
+		void load(int t, bool enable, uint64_t sample, int32_t delta) {
+			if (enable && !m_running[t]) {
+				m_expiry[t] = sample + period(t) + delta;
+				m_running[t] = true;
+			} else if (!enable) {
+				m_running[t] = false;
+			}
+		}
+
+		void advance(uint64_t sample) {
+			for (int t = 0; t < 2; t++) {
+				if (!m_running[t] || m_expiry[t] > sample) {
+					continue;
+				}
+				// the flag is set if the timer's IRQ is enabled, and the
+				// timer restarts right away
+				if (m_mode & (4 << t)) {
+					m_status |= 1 << t;
+				}
+				const uint32_t p = period(t);
+				m_expiry[t] += ((sample - m_expiry[t]) / p + 1) * p;
+			}
+		}
+
+		uint16_t m_timer_a = 0;
+		uint8_t m_timer_b = 0;
+		uint8_t m_mode = 0;
+		uint8_t m_status = 0;
+		bool m_running[2] = { false, false };
+		uint64_t m_expiry[2] = { 0, 0 };
+		uint64_t m_last_write = 0; // plus one, 0 is none
+};
+
 namespace {
 	ym2151_interface opm_iface;
+	ym2151_timers opm_timers;
 }
 
 extern "C" {
@@ -113,11 +239,15 @@ extern "C" {
 		opm_iface.write(reg, val);
 	}
 
-	uint8_t YM_read_status() {
-		return opm_iface.read_status();
+	void YM_timers_write(uint64_t sample, uint8_t reg, uint8_t val) {
+		opm_timers.write(sample, reg, val);
+	}
+
+	uint8_t YM_read_status(uint64_t sample) {
+		return opm_timers.status(sample);
 	}
 
-	bool YM_irq() {
-		return opm_iface.irq();
+	bool YM_irq(uint64_t sample) {
+		return opm_timers.irq(sample);
 	}
 }
@@ -5,13 +5,20 @@
 extern "C" {
 #endif
 	#include <stdint.h>
+	#include <stdbool.h>
 
-	uint8_t YM_read_status(void);
 	void YM_Create(int clock);
 	void YM_init(int sample_rate, int frame_rate);
 	void YM_stream_update(uint16_t* output, uint32_t numsamples);
 	void YM_write_reg(uint8_t reg, uint8_t val);
-	bool YM_irq(void);
+
+	// The chip as the CPU sees it, while its writes are only rendered
+	// later: the timers and the busy flag, at a time in samples. Every
+	// write goes here as it happens, and to YM_write_reg() once the
+	// samples in front of it are rendered.
+	void YM_timers_write(uint64_t sample, uint8_t reg, uint8_t val);
+	uint8_t YM_read_status(uint64_t sample);
+	bool YM_irq(uint64_t sample);
 
 #ifdef __cplusplus
 }
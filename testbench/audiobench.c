@@ -0,0 +1,501 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+// Replays a sound register log (x16emu -soundlog) without the CPU: each
+// synth on its own, to tell how many samples per second it renders, and
+// then everything through the mixer the way the emulator does it
+// offline. That output can be written to a WAV and checked against one
+// recorded with x16emu -headless -wav, which it matches sample for
+// sample.
+//
+//   make audio-bench SOUNDLOG=<file> [GOLDEN=<file.wav>]
+//   audiobench <file> [-wav <file.wav>] [-golden <file.wav>] [-resample {nearest|normal|high}]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/audio.h"
+#include "../src/glue.h"
+#include "../src/sound_log.h"
+#include "../src/vera_pcm.h"
+#include "../src/vera_psg.h"
+#include "../src/ymglue.h"
+
+#define VERA_CLOCK 25000000
+#define VERA_DIVIDER 512
+#define YM_CLOCK 3579545
+#define YM_DIVIDER 64
+#define BLOCK 256
+
+uint8_t MHZ;
+bool log_audio = false;
+
+static uint8_t *sound_log;
+static size_t sound_log_size;
+
+// What the mixer puts out, in place of the recorders; only the first
+// replay is kept
+static uint64_t mixed;
+static bool keep_output;
+static int16_t *output;
+static uint32_t output_count;
+static uint32_t output_capacity;
+
+void
+wav_recorder_process(const int16_t *samples, const int num_samples)
+{
+	mixed += num_samples;
+	if (!keep_output) {
+		return;
+	}
+	if (output_count + num_samples > output_capacity) {
+		output_capacity = (output_count + num_samples) * 2;
+		output = realloc(output, output_capacity * 2 * sizeof(int16_t));
+		if (!output) {
+			printf("Out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(&output[output_count * 2], samples, num_samples * 2 * sizeof(int16_t));
+	output_count += num_samples;
+}
+
+void
+capture_audio(const int16_t *samples, uint32_t count)
+{
+}
+
+void
+shm_export_audio(const int16_t *samples, uint32_t count)
+{
+}
+
+static bool
+load(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		printf("Cannot open %s\n", path);
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	sound_log_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	sound_log = malloc(sound_log_size + 1);
+	if (!sound_log || fread(sound_log, 1, sound_log_size, f) != sound_log_size) {
+		printf("Cannot read %s\n", path);
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	// a log that was cut off ends anyway
+	sound_log[sound_log_size] = SOUND_LOG_END;
+
+	const size_t magic = strlen(SOUND_LOG_MAGIC);
+	if (sound_log_size < magic + 2 || memcmp(sound_log, SOUND_LOG_MAGIC, magic) || sound_log[magic] != SOUND_LOG_VERSION) {
+		printf("%s is not a sound log\n", path);
+		return false;
+	}
+	MHZ = sound_log[magic + 1];
+	return true;
+}
+
+// The commands one after the other; wait is the CPU clocks in front of
+// a command. Returns false at the end.
+struct command {
+	sound_log_command_t command;
+	uint32_t wait;
+	uint8_t reg;
+	uint8_t value;
+};
+
+static size_t
+first_command(void)
+{
+	return strlen(SOUND_LOG_MAGIC) + 2;
+}
+
+static bool
+next_command(size_t *pos, struct command *c)
+{
+	c->wait = 0;
+	for (;;) {
+		const uint8_t *p = &sound_log[*pos];
+		c->command = p[0];
+		switch (c->command) {
+			case SOUND_LOG_WAIT8:
+				c->wait += p[1];
+				*pos += 2;
+				continue;
+			case SOUND_LOG_WAIT32:
+				c->wait += p[1] | p[2] << 8 | p[3] << 16 | (uint32_t)p[4] << 24;
+				*pos += 5;
+				continue;
+			case SOUND_LOG_YM:
+			case SOUND_LOG_PSG:
+				c->reg = p[1];
+				c->value = p[2];
+				*pos += 3;
+				return true;
+			case SOUND_LOG_PCM_CTRL:
+			case SOUND_LOG_PCM_RATE:
+			case SOUND_LOG_PCM_FIFO:
+				c->value = p[1];
+				*pos += 2;
+				return true;
+			case SOUND_LOG_PSG_RESET:
+			case SOUND_LOG_PCM_RESET:
+				*pos += 1;
+				return true;
+			case SOUND_LOG_END:
+				return false;
+			default:
+				printf("Unknown command $%02X at %zu\n", c->command, *pos);
+				return false;
+		}
+	}
+}
+
+// A chip on its own: the samples it renders until each write, then the write
+struct synth {
+	const char *name;
+	uint32_t clock;
+	uint32_t divider;
+	void (*reset)(void);
+	void (*render)(uint32_t count);
+	bool (*write)(const struct command *c);
+};
+
+static int32_t vera_buf[BLOCK * 2];
+static uint16_t ym_buf[BLOCK * 2];
+
+static void
+psg_render_block(uint32_t count)
+{
+	psg_render(vera_buf, count);
+}
+
+static bool
+psg_write(const struct command *c)
+{
+	switch (c->command) {
+		case SOUND_LOG_PSG:
+			psg_writereg(c->reg, c->value);
+			return true;
+		case SOUND_LOG_PSG_RESET:
+			psg_reset();
+			return true;
+		default:
+			return false;
+	}
+}
+
+static void
+pcm_render_block(uint32_t count)
+{
+	pcm_render(vera_buf, count);
+}
+
+static bool
+pcm_write(const struct command *c)
+{
+	switch (c->command) {
+		case SOUND_LOG_PCM_CTRL:
+			pcm_write_ctrl(c->value);
+			return true;
+		case SOUND_LOG_PCM_RATE:
+			pcm_write_rate(c->value);
+			return true;
+		case SOUND_LOG_PCM_FIFO:
+			pcm_write_fifo(c->value);
+			return true;
+		case SOUND_LOG_PCM_RESET:
+			pcm_reset();
+			return true;
+		default:
+			return false;
+	}
+}
+
+static void
+ym_reset(void)
+{
+	// there is no reset, the chip goes on from the mixer's replay
+}
+
+static void
+ym_render_block(uint32_t count)
+{
+	YM_stream_update(ym_buf, count);
+}
+
+static bool
+ym_write(const struct command *c)
+{
+	if (c->command != SOUND_LOG_YM) {
+		return false;
+	}
+	YM_write_reg(c->reg, c->value);
+	return true;
+}
+
+static const struct synth synths[] = {
+	{"PSG", VERA_CLOCK, VERA_DIVIDER, psg_reset, psg_render_block, psg_write},
+	{"PCM", VERA_CLOCK, VERA_DIVIDER, pcm_reset, pcm_render_block, pcm_write},
+	{"YM2151", YM_CLOCK, YM_DIVIDER, ym_reset, ym_render_block, ym_write},
+};
+
+// The samples of the synth in cpu_clocks
+static uint64_t
+samples_at(const struct synth *s, uint64_t cpu_clocks)
+{
+	return cpu_clocks * s->clock / s->divider / (MHZ * 1000000ULL);
+}
+
+// Returns the samples rendered
+static uint64_t
+replay_synth(const struct synth *s)
+{
+	uint64_t clocks = 0;
+	uint64_t rendered = 0;
+	size_t pos = first_command();
+	struct command c;
+	bool more;
+	s->reset();
+	do {
+		more = next_command(&pos, &c);
+		clocks += c.wait;
+		const uint64_t to = samples_at(s, clocks);
+		while (rendered < to) {
+			const uint32_t n = to - rendered < BLOCK ? to - rendered : BLOCK;
+			s->render(n);
+			rendered += n;
+		}
+		if (more) {
+			s->write(&c);
+		}
+	} while (more);
+	return rendered;
+}
+
+static double
+seconds_since(clock_t start)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void
+report(const char *name, uint64_t samples, double seconds, double rate)
+{
+	printf("%-8s %10llu samples in %7.3f s: %12.0f samples/s, %7.1fx real time\n",
+	       name, (unsigned long long)samples, seconds, samples / seconds, samples / seconds / rate);
+}
+
+// Each synth for half a second at least
+static void
+bench_synth(const struct synth *s)
+{
+	uint64_t samples = 0;
+	clock_t start = clock();
+	do {
+		samples += replay_synth(s);
+	} while (seconds_since(start) < 0.5);
+	report(s->name, samples, seconds_since(start), (double)s->clock / s->divider);
+}
+
+// Everything through audio.c, as the emulator does it without a
+// device; returns the samples mixed
+static uint64_t
+replay_mixer(resampler_quality_t quality)
+{
+	size_t pos = first_command();
+	struct command c;
+	bool more;
+	const uint64_t start = mixed;
+	audio_init_offline(quality);
+	do {
+		more = next_command(&pos, &c);
+		// audio_step() takes an int
+		while (c.wait > 0) {
+			const uint32_t n = c.wait < 0x10000000 ? c.wait : 0x10000000;
+			audio_step(n);
+			c.wait -= n;
+		}
+		if (!more) {
+			break;
+		}
+		switch (c.command) {
+			case SOUND_LOG_YM:
+				audio_write_ym(c.reg, c.value);
+				break;
+			case SOUND_LOG_PSG:
+				audio_write_psg(c.reg, c.value);
+				break;
+			case SOUND_LOG_PSG_RESET:
+				audio_reset_psg();
+				break;
+			default:
+				// as VERA does it
+				audio_render_pcm();
+				pcm_write(&c);
+				break;
+		}
+	} while (more);
+	audio_close();
+	return mixed - start;
+}
+
+static void
+bench_mixer(resampler_quality_t quality)
+{
+	uint64_t samples = 0;
+	clock_t start = clock();
+	do {
+		samples += replay_mixer(quality);
+		keep_output = false;
+	} while (seconds_since(start) < 0.5);
+	report("mixed", samples, seconds_since(start), host_sample_rate);
+}
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t
+get32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool
+write_wav(const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		printf("Cannot open %s\n", path);
+		return false;
+	}
+	const uint32_t bytes = output_count * 4;
+	uint8_t header[44] = "RIFF....WAVEfmt ....\1\0\2\0........\4\0\20\0data....";
+	put32(&header[4], 36 + bytes);
+	put32(&header[16], 16);
+	put32(&header[24], host_sample_rate);
+	put32(&header[28], host_sample_rate * 4);
+	put32(&header[40], bytes);
+	fwrite(header, 1, sizeof(header), f);
+	// little endian, like the host
+	fwrite(output, 4, output_count, f);
+	fclose(f);
+	return true;
+}
+
+// The 16 bit stereo samples of a WAV have to be the output's
+static bool
+compare_wav(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		printf("Cannot open %s\n", path);
+		return false;
+	}
+	uint8_t chunk[8];
+	uint8_t fmt[16] = {0};
+	bool ok = fread(chunk, 1, 8, f) == 8 && !memcmp(chunk, "RIFF", 4) && fread(chunk, 1, 4, f) == 4 && !memcmp(chunk, "WAVE", 4);
+	while (ok && fread(chunk, 1, 8, f) == 8) {
+		const uint32_t size = get32(&chunk[4]);
+		if (!memcmp(chunk, "fmt ", 4)) {
+			ok = size >= sizeof(fmt) && fread(fmt, 1, sizeof(fmt), f) == sizeof(fmt);
+			fseek(f, size - sizeof(fmt) + (size & 1), SEEK_CUR);
+		} else if (!memcmp(chunk, "data", 4)) {
+			break;
+		} else {
+			fseek(f, size + (size & 1), SEEK_CUR);
+		}
+	}
+	if (!ok || fmt[2] != 2 || fmt[14] != 16) {
+		printf("%s is not a 16 bit stereo WAV\n", path);
+		fclose(f);
+		return false;
+	}
+	if (get32(&fmt[4]) != host_sample_rate) {
+		printf("%s is at %u Hz, not %u Hz\n", path, get32(&fmt[4]), host_sample_rate);
+		fclose(f);
+		return false;
+	}
+
+	const uint32_t count = get32(&chunk[4]) / 4;
+	int16_t sample[2];
+	for (uint32_t i = 0; i < count && i < output_count; i++) {
+		if (fread(sample, 4, 1, f) != 1) {
+			break;
+		}
+		if (sample[0] != output[i * 2] || sample[1] != output[i * 2 + 1]) {
+			printf("FAIL: sample %u is %d/%d, not %d/%d as in %s\n", i, output[i * 2], output[i * 2 + 1], sample[0], sample[1], path);
+			fclose(f);
+			return false;
+		}
+	}
+	fclose(f);
+	if (count != output_count) {
+		printf("FAIL: %u samples, not %u as in %s\n", output_count, count, path);
+		return false;
+	}
+	printf("Same as %s\n", path);
+	return true;
+}
+
+static void
+usage(void)
+{
+	printf("audiobench <sound log> [-wav <file.wav>] [-golden <file.wav>] [-resample {nearest|normal|high}]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *wav_path = NULL;
+	const char *golden_path = NULL;
+	resampler_quality_t quality = RESAMPLER_DEFAULT;
+	if (argc < 2) {
+		usage();
+	}
+	for (int i = 2; i < argc; i++) {
+		if (i + 1 < argc && !strcmp(argv[i], "-wav")) {
+			wav_path = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "-golden")) {
+			golden_path = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "-resample")) {
+			if (!resampler_parse_quality(argv[++i], &quality)) {
+				usage();
+			}
+		} else {
+			usage();
+		}
+	}
+	if (!load(argv[1])) {
+		return 1;
+	}
+
+	// first, while the YM2151 is as it is after power on
+	keep_output = true;
+	bench_mixer(quality);
+	for (int i = 0; i < sizeof(synths) / sizeof(synths[0]); i++) {
+		bench_synth(&synths[i]);
+	}
+
+	if (wav_path && !write_wav(wav_path)) {
+		return 1;
+	}
+	if (golden_path && !compare_wav(golden_path)) {
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,299 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+// The EVE audio ring against a mock of the EVE's playback, which plays
+// the ring as far as a test says: the samples come out in order, once
+// each, around the end of the ring many times, and when the EVE gets
+// past them, it plays silence and the samples go on after it.
+//
+//   make eveaudiotest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/eve_audio.h"
+
+#define RING_SIZE EVE_DISPLAY_AUDIO_SIZE
+
+static uint8_t ring[RING_SIZE];
+static uint32_t play_pos;       // in the ring
+static uint32_t play_calls;
+static uint32_t play_address;
+static uint32_t play_length;
+static uint8_t play_format;
+static uint32_t written;        // bytes, since the test reset it
+static uint32_t writes;
+static bool bad_write;
+
+// the samples pulled, and the ones expected next from the EVE
+static uint32_t next_pulled;
+static uint32_t next_played;
+
+static void
+mock_mem_write(void *ctx, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	if (address < EVE_DISPLAY_AUDIO_RING || address + length > EVE_DISPLAY_AUDIO_RING + RING_SIZE) {
+		printf("FAIL: write to $%06X-$%06X outside of the ring\n", address, address + length - 1);
+		bad_write = true;
+		return;
+	}
+	memcpy(ring + address - EVE_DISPLAY_AUDIO_RING, data, length);
+	written += length;
+	writes++;
+}
+
+static void
+mock_play(void *ctx, uint32_t address, uint32_t length, uint16_t rate, uint8_t format)
+{
+	play_calls++;
+	play_address = address;
+	play_length = length;
+	play_format = format;
+}
+
+static uint32_t
+mock_play_position(void *ctx)
+{
+	return EVE_DISPLAY_AUDIO_RING + play_pos;
+}
+
+static const struct eve_transport transport = {
+	mock_mem_write,
+	NULL,
+	NULL,
+	NULL,
+	mock_play,
+	mock_play_position,
+	NULL,
+};
+
+static const struct eve_transport transport_silent = {
+	mock_mem_write,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+};
+
+// Linear samples that are never silence (0), the same on both channels
+static uint8_t
+sample_value(uint32_t n)
+{
+	return 1 + n % 250;
+}
+
+static void
+pull(int16_t *samples, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		samples[i * 2] = samples[i * 2 + 1] = sample_value(next_pulled++) << 8;
+	}
+}
+
+// The EVE plays count samples. Returns how many were silence, or -1 if
+// one was out of order.
+static int
+play(uint32_t count)
+{
+	int silent = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		const uint8_t value = ring[play_pos];
+		play_pos = (play_pos + 1) % RING_SIZE;
+		if (!value) {
+			silent++;
+		} else if (value != sample_value(next_played++)) {
+			printf("FAIL: %u played at %u, %u expected\n", value, (play_pos + RING_SIZE - 1) % RING_SIZE, sample_value(next_played - 1));
+			return -1;
+		}
+	}
+	return silent;
+}
+
+// Plays count samples without looking at them, and without keeping
+// track of the samples played
+static void
+skip(uint32_t count)
+{
+	play_pos = (play_pos + count) % RING_SIZE;
+}
+
+static void
+start(uint32_t pos)
+{
+	memset(ring, 0x55, sizeof(ring));
+	play_pos = pos;
+	play_calls = 0;
+	next_pulled = 0;
+	next_played = 0;
+	eve_audio_init(&transport, EVE_AUDIO_LINEAR, 24000, pull);
+}
+
+static bool
+check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+	}
+	return ok;
+}
+
+static uint32_t
+underruns(void)
+{
+	struct eve_audio_stats stats;
+	eve_audio_get_stats(&stats);
+	return stats.underruns;
+}
+
+static bool
+test_start(void)
+{
+	bool ok = true;
+	start(0);
+	ok &= check(play_calls == 1 && play_address == EVE_DISPLAY_AUDIO_RING && play_length == RING_SIZE && play_format == EVE_AUDIO_LINEAR, "playback started on the ring");
+	bool silent = true;
+	for (uint32_t i = 0; i < RING_SIZE; i++) {
+		silent &= ring[i] == 0;
+	}
+	ok &= check(silent, "the ring is silence before the first turn");
+
+	// it has started to play by the first turn
+	skip(100);
+	eve_audio_service();
+	ok &= check(underruns() == 0, "the first turn is no underrun");
+	ok &= check(next_pulled == EVE_AUDIO_MAX_CHUNK, "the first turn writes a chunk");
+	ok &= check(play(EVE_AUDIO_LEAD) == EVE_AUDIO_LEAD, "the samples start after the lead");
+	ok &= check(play(EVE_AUDIO_MAX_CHUNK) == 0, "the first chunk is played");
+	return ok;
+}
+
+// Turns between random stretches of playback, always in time: every
+// sample is played once, in order, and the writes wrap around the ring
+static bool
+test_steady(void)
+{
+	bool ok = true;
+	start(RING_SIZE - 10);
+	eve_audio_service();
+	play(EVE_AUDIO_LEAD);
+	uint32_t max_written = 0;
+	uint64_t total = 0;
+	srand(1);
+	for (int i = 0; i < 20000 && ok; i++) {
+		const uint32_t count = rand() % EVE_AUDIO_MAX_CHUNK;
+		ok &= check(play(count) == 0, "no silence while the turns are in time");
+		total += count;
+		written = 0;
+		eve_audio_service();
+		if (written > max_written) {
+			max_written = written;
+		}
+	}
+	ok &= check(underruns() == 0, "no underruns while the turns are in time");
+	ok &= check(max_written <= EVE_AUDIO_MAX_CHUNK + EVE_AUDIO_PAD, "a turn writes a chunk and the pad at most");
+	ok &= check(total > 100 * RING_SIZE, "around the ring many times");
+	ok &= check(next_pulled - next_played <= EVE_AUDIO_TARGET, "no more than the target ahead");
+	ok &= check(!bad_write, "all writes into the ring");
+	return ok;
+}
+
+// Short stretches don't get a write of their own
+static bool
+test_min_chunk(void)
+{
+	bool ok = true;
+	start(0);
+	eve_audio_service();
+	play(EVE_AUDIO_LEAD + EVE_AUDIO_MAX_CHUNK);
+	// up to the target in two chunks
+	eve_audio_service();
+	eve_audio_service();
+	writes = 0;
+	play(EVE_AUDIO_MIN_CHUNK - 1);
+	eve_audio_service();
+	ok &= check(writes == 0, "no write for less than the minimum chunk");
+	play(1);
+	eve_audio_service();
+	ok &= check(writes == 1 && next_pulled - next_played == EVE_AUDIO_TARGET, "a write once there is enough");
+	return ok;
+}
+
+static bool
+test_underrun(void)
+{
+	bool ok = true;
+	start(RING_SIZE - 1000);
+	eve_audio_service();
+	play(EVE_AUDIO_LEAD);
+	for (int i = 0; i < 4; i++) {
+		play(EVE_AUDIO_MAX_CHUNK);
+		eve_audio_service();
+	}
+
+	// a late turn: the EVE plays the samples, then the silent pad
+	const uint32_t queued = next_pulled - next_played;
+	ok &= check(play(queued + EVE_AUDIO_PAD) == EVE_AUDIO_PAD, "the pad is silence");
+	eve_audio_service();
+	ok &= check(underruns() == 1, "the underrun is counted");
+	ok &= check(play(EVE_AUDIO_LEAD) == EVE_AUDIO_LEAD && play(EVE_AUDIO_MAX_CHUNK) == 0,
+	            "after the lead, the samples go on where they stopped");
+	ok &= check(next_played == next_pulled, "nothing pulled is lost");
+
+	// much later, past the pad into the last lap's samples
+	skip(3 * RING_SIZE / 2);
+	next_played = next_pulled;
+	eve_audio_service();
+	ok &= check(underruns() == 2, "a longer underrun is counted");
+	ok &= check(play(EVE_AUDIO_LEAD) == EVE_AUDIO_LEAD && play(EVE_AUDIO_MAX_CHUNK) == 0, "the samples go on after it");
+
+	// in time again
+	eve_audio_service();
+	for (int i = 0; i < 100; i++) {
+		play(EVE_AUDIO_MAX_CHUNK / 2);
+		eve_audio_service();
+	}
+	ok &= check(underruns() == 2, "no more underruns once the turns are in time");
+	ok &= check(!bad_write, "all writes into the ring");
+	return ok;
+}
+
+static bool
+test_encode(void)
+{
+	bool ok = true;
+	ok &= check(eve_audio_encode(EVE_AUDIO_LINEAR, 0) == 0 && eve_audio_encode(EVE_AUDIO_LINEAR, 0x7fff) == 0x7f &&
+	            eve_audio_encode(EVE_AUDIO_LINEAR, -0x8000) == 0x80, "linear");
+	ok &= check(eve_audio_encode(EVE_AUDIO_ULAW, 0) == 0xff && eve_audio_encode(EVE_AUDIO_ULAW, 0x7fff) == 0x80 &&
+	            eve_audio_encode(EVE_AUDIO_ULAW, -0x8000) == 0x00, "µ-law at 0 and the limits");
+	uint8_t last = 0;
+	for (int32_t v = 0; v <= 0x7fff; v++) {
+		const uint8_t pos = eve_audio_encode(EVE_AUDIO_ULAW, v);
+		const uint8_t neg = eve_audio_encode(EVE_AUDIO_ULAW, -v);
+		const uint8_t level = ~pos & 0x7f;
+		if (level < last || (v && (pos ^ neg) != 0x80)) {
+			return check(false, "µ-law is monotonic and symmetric");
+		}
+		last = level;
+	}
+	return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+	bool ok = true;
+	ok &= check(!eve_audio_init(&transport_silent, EVE_AUDIO_LINEAR, 24000, pull), "no playback without play()");
+	ok &= test_start();
+	ok &= test_steady();
+	ok &= test_min_chunk();
+	ok &= test_underrun();
+	ok &= test_encode();
+	if (!ok) {
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
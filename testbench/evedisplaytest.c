@@ -0,0 +1,254 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+// eve_display_send() over fixed workloads through the EVE mock, once
+// raw and once with CMD_INFLATE: what the screen shows has to be the
+// framebuffer, and the compressed transfer has to be smaller by at least
+// the workload's ratio. It prints the bytes per frame of both.
+//
+//   make evedisplaytest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/eve_display.h"
+#include "../src/eve_mock.h"
+
+#define WIDTH EVE_DISPLAY_WIDTH
+#define HEIGHT EVE_DISPLAY_HEIGHT
+#define FRAMES 30
+
+struct workload {
+	const char *name;
+	bool half;       // sent at 320x240
+	double ratio;    // raw bytes per compressed byte, at least
+};
+
+static const struct workload workloads[] = {
+	{"text, typing",     false, 5.0},
+	{"text, scrolling",  false, 3.5},
+	{"palette cycling",  false, 3.0},
+	{"tiles at 320x240", true, 12.0},
+	{"noise",            false, 1.0},
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static uint8_t frame[WIDTH * HEIGHT];     // what is sent
+static uint8_t full[WIDTH * HEIGHT];      // and at full resolution
+static uint8_t sent[EVE_DISPLAY_BUFFERS][WIDTH * HEIGHT];
+static uint16_t palette[256];
+static uint16_t sent_palette[EVE_DISPLAY_BUFFERS][256];
+static uint8_t font[256][8];
+
+static uint32_t seed;
+
+static uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void
+make_palette(uint32_t shift)
+{
+	for (int i = 0; i < 256; i++) {
+		const uint32_t c = (i + shift) & 255;
+		palette[i] = (c << 8) | (c ^ 0x5a) << 3 | c >> 3;
+	}
+}
+
+// 80x60 characters, the screen scrolled up by scroll pixels
+static void
+draw_text(uint32_t chars, uint32_t scroll)
+{
+	for (uint32_t y = 0; y < HEIGHT; y++) {
+		const uint32_t ty = y + scroll;
+		for (uint32_t x = 0; x < WIDTH; x++) {
+			const uint32_t cell = ty / 8 * 80 + x / 8;
+			const uint8_t c = cell < chars ? (cell * 7 + cell / 13) & 255 : ' ';
+			const bool on = (font[c][ty & 7] >> (7 - (x & 7))) & 1;
+			frame[y * WIDTH + x] = on ? 1 : 6;
+		}
+	}
+}
+
+// 16x16 tiles scrolled to the left, and sprites that move
+static void
+draw_tiles(uint32_t n)
+{
+	const uint16_t w = EVE_DISPLAY_HALF_WIDTH;
+	const uint16_t h = EVE_DISPLAY_HALF_HEIGHT;
+	for (uint32_t y = 0; y < h; y++) {
+		for (uint32_t x = 0; x < w; x++) {
+			const uint32_t tx = x + n;
+			const uint32_t tile = (tx / 16 * 5 + y / 16 * 3) % 7;
+			frame[y * w + x] = 16 + tile * 16 + (((tx & 15) ^ (y & 15)) >> 2);
+		}
+	}
+	for (uint32_t s = 0; s < 8; s++) {
+		const uint32_t sx = (s * 37 + n * 3) % (w - 16);
+		const uint32_t sy = (s * 23 + n * 2) % (h - 16);
+		for (uint32_t y = 0; y < 16; y++) {
+			memset(&frame[(sy + y) * w + sx], 200 + s, 16);
+		}
+	}
+}
+
+static void
+draw(uint32_t w, uint32_t n)
+{
+	switch (w) {
+		case 0:
+			// a line of text is typed, and the cursor blinks
+			draw_text(80 * 40 + n * 4, 0);
+			if (n & 8) {
+				memset(&frame[(40 * 8 + 7) * WIDTH], 1, 8);
+			}
+			break;
+		case 1:
+			draw_text(80 * 60, n);
+			break;
+		case 2:
+			draw_text(80 * 60, 0);
+			make_palette(n);
+			break;
+		case 3:
+			draw_tiles(n);
+			break;
+		case 4:
+			for (uint32_t i = 0; i < WIDTH * HEIGHT; i++) {
+				frame[i] = rnd();
+			}
+			break;
+	}
+}
+
+static void
+expand(bool half)
+{
+	if (!half) {
+		memcpy(full, frame, sizeof(full));
+		return;
+	}
+	for (uint32_t y = 0; y < HEIGHT; y++) {
+		for (uint32_t x = 0; x < WIDTH; x++) {
+			full[y * WIDTH + x] = frame[y / 2 * EVE_DISPLAY_HALF_WIDTH + x / 2];
+		}
+	}
+}
+
+// The lines that differ from what the buffer has, like eve_present.c
+// keeps track of them
+static uint32_t
+dirty_lines(uint8_t buffer, bool half, bool all, uint32_t *dirty)
+{
+	const uint16_t w = half ? EVE_DISPLAY_HALF_WIDTH : WIDTH;
+	const uint16_t h = half ? EVE_DISPLAY_HALF_HEIGHT : HEIGHT;
+	uint32_t bytes = 0;
+	memset(dirty, 0, EVE_DISPLAY_DIRTY_WORDS * sizeof(*dirty));
+	for (uint16_t y = 0; y < h; y++) {
+		if (all || memcmp(&frame[y * w], &sent[buffer][y * w], w)) {
+			dirty[y >> 5] |= 1u << (y & 31);
+			bytes += w;
+		}
+	}
+	memcpy(sent[buffer], frame, (uint32_t)w * h);
+	return bytes;
+}
+
+struct result {
+	uint64_t bytes;
+	uint64_t transactions;
+	uint64_t inflated;
+	uint64_t deflated;
+	uint64_t payload; // the dirty lines
+	bool ok;
+};
+
+static struct result
+run(uint32_t w, const struct eve_transport *transport)
+{
+	const struct workload *wl = &workloads[w];
+	struct result r;
+	struct eve_mock_stats before, after;
+	memset(&r, 0, sizeof(r));
+	r.ok = true;
+	eve_mock_get_stats(&before);
+	seed = 1;
+	make_palette(0);
+	for (uint32_t n = 0; n < FRAMES; n++) {
+		const uint8_t buffer = n % EVE_DISPLAY_BUFFERS;
+		uint32_t dirty[EVE_DISPLAY_DIRTY_WORDS];
+		draw(w, n);
+		expand(wl->half);
+		const bool all = n < EVE_DISPLAY_BUFFERS;
+		r.payload += dirty_lines(buffer, wl->half, all, dirty);
+		const bool palette_dirty = all || memcmp(palette, sent_palette[buffer], sizeof(palette));
+		memcpy(sent_palette[buffer], palette, sizeof(palette));
+
+		eve_display_send(transport, buffer, frame, palette, dirty, palette_dirty, wl->half);
+		transport->show(transport->ctx, buffer, wl->half);
+		eve_mock_check(full, palette);
+
+		struct eve_mock_stats stats;
+		eve_mock_get_stats(&stats);
+		if (stats.mismatch) {
+			printf("FAIL: %s, frame %u: the screen differs from the framebuffer\n", wl->name, n);
+			r.ok = false;
+			break;
+		}
+	}
+	eve_mock_get_stats(&after);
+	if (after.torn_writes != before.torn_writes) {
+		printf("FAIL: %s: %u writes to the buffer on screen\n", wl->name, after.torn_writes - before.torn_writes);
+		r.ok = false;
+	}
+	r.bytes = after.bytes - before.bytes;
+	r.transactions = after.transactions - before.transactions;
+	r.inflated = after.inflated_bytes - before.inflated_bytes;
+	r.deflated = after.deflated_bytes - before.deflated_bytes;
+	return r;
+}
+
+int
+main(int argc, char **argv)
+{
+	bool ok = true;
+	eve_mock_set_paced(false);
+	seed = 2;
+	for (int c = 0; c < 256; c++) {
+		for (int y = 0; y < 8; y++) {
+			font[c][y] = c == ' ' ? 0 : rnd();
+		}
+	}
+
+	printf("%-18s %15s %15s %7s %s\n", "", "raw", "inflate", "ratio", "transactions");
+	for (uint32_t w = 0; w < NUM_WORKLOADS; w++) {
+		const struct result raw = run(w, eve_mock_transport(false));
+		const struct result inflate = run(w, eve_mock_transport(true));
+		const double ratio = (double)raw.bytes / inflate.bytes;
+		printf("%-18s %6.1f KB/frame %6.1f KB/frame %5.1f:1 %6.1f per frame",
+		       workloads[w].name, raw.bytes / 1024.0 / FRAMES, inflate.bytes / 1024.0 / FRAMES, ratio, (double)inflate.transactions / FRAMES);
+		if (inflate.deflated) {
+			printf(", compressed lines %.1f:1", (double)inflate.inflated / inflate.deflated);
+		}
+		printf("\n");
+		ok &= raw.ok && inflate.ok;
+		if (raw.bytes < raw.payload) {
+			printf("FAIL: %s: fewer raw bytes than changed pixels\n", workloads[w].name);
+			ok = false;
+		}
+		if (ratio < workloads[w].ratio) {
+			printf("FAIL: %s: compressed %.2f:1, at least %.1f:1 expected\n", workloads[w].name, ratio, workloads[w].ratio);
+			ok = false;
+		}
+	}
+	if (!ok) {
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
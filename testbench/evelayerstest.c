@@ -0,0 +1,343 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+// eve_layers_build() on fixed VERA states, against the display lists and
+// the hashes of the images in evelayers.golden, and eve_layers_send() on
+// a stream of frames that change, against the writes in the same file:
+// none may go to an image that the list on the screen draws from. A
+// change that alters what is sent to the EVE shows up as the first line
+// that differs; if it is meant to, the file is written again with
+//
+//   make evelayerstest
+//   build/x16emu/evelayerstest -write testbench/evelayers.golden
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/eve_layers.h"
+
+#define VRAM_SIZE 0x20000
+
+static uint8_t vram[VRAM_SIZE];
+static uint8_t palette[512];
+static uint8_t sprites[128 * 8];
+static struct eve_layers_frame frame;
+
+static uint32_t seed;
+
+static uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+// Text at $1B000 with its font at $1F000, like the KERNAL sets it up,
+// and for the others, tiles at $4000 with the map at 0
+#define TEXT_MAP  0x1B000
+#define TEXT_FONT 0x1F000
+// and a screen full of characters
+#define TEXT_FULL 0x14000
+#define TILE_MAP  0x00000
+#define TILES     0x04000
+
+struct test {
+	const char *name;
+	uint8_t composer[8];
+	uint8_t layer[2][7];
+	uint8_t sprites;     // how many, 16x16 at 4 bpp
+	bool sprite_line;    // all of them on the same lines, at 64x64 8 bpp
+};
+
+static const struct test tests[] = {
+	{"text 40x30 at 2x",
+	 {0x21, 64, 64, 0x06, 0, 160, 0, 240},
+	 {{0}, {0x60, TEXT_MAP >> 9, TEXT_FONT >> 9, 0, 0, 0, 0}}, 0, false},
+	{"text 256 colors, window",
+	 {0x21, 64, 64, 0x0e, 10, 150, 20, 200},
+	 {{0}, {0x68, TEXT_MAP >> 9, TEXT_FONT >> 9, 3, 0, 5, 0}}, 0, false},
+	{"4 bpp 16x16 tiles, text and sprites",
+	 {0x71, 64, 64, 0x00, 20, 140, 30, 210},
+	 {{0x12, TILE_MAP >> 9, TILES >> 9 | 3, 0x05, 0x00, 0x03, 0x00},
+	  {0x60, TEXT_MAP >> 9, TEXT_FONT >> 9, 0, 0, 0, 0}}, 16, false},
+	{"8 bpp 8x8 tiles, scrolled",
+	 {0x11, 64, 64, 0x00, 30, 130, 40, 200},
+	 {{0x13, TILE_MAP >> 9, TILES >> 9, 0x23, 0x01, 0x45, 0x00}, {0}}, 0, false},
+	{"2 bpp 16x8 tiles, odd scroll",
+	 {0x11, 64, 64, 0x00, 0, 160, 0, 240},
+	 {{0x01, TILE_MAP >> 9, TILES >> 9 | 1, 0x07, 0x00, 0x0b, 0x00}, {0}}, 0, false},
+	{"1 bpp 8x16 tiles under 2 bpp",
+	 {0x31, 64, 128, 0x00, 40, 120, 60, 180},
+	 {{0x00, TEXT_MAP >> 9, TEXT_FONT >> 9 | 2, 0x02, 0x00, 0x01, 0x00},
+	  {0x01, TILE_MAP >> 9, TILES >> 9, 0x00, 0x00, 0x00, 0x00}}, 0, false},
+	{"8 bpp 8x8 tiles at 640x480",
+	 {0x11, 128, 128, 0x00, 0, 160, 0, 240},
+	 {{0x13, TILE_MAP >> 9, TILES >> 9, 0x23, 0x01, 0x45, 0x00}, {0}}, 0, false},
+	{"sprites over the budget",
+	 {0x41, 64, 64, 0x00, 0, 160, 0, 240},
+	 {{0}, {0}}, 128, true},
+	{"bitmap layer",
+	 {0x11, 64, 64, 0x00, 0, 160, 0, 240},
+	 {{0x07, 0, TILES >> 9, 0, 0, 0, 0}, {0}}, 0, false},
+	{"text 80x60, every cell a character",
+	 {0x21, 128, 128, 0x06, 0, 160, 0, 240},
+	 {{0}, {0x60, TEXT_FULL >> 9, TEXT_FONT >> 9, 0, 0, 0, 0}}, 0, false},
+	{"text 80x60 256 colors, every cell a character, scrolled",
+	 {0x21, 128, 128, 0x06, 0, 160, 0, 240},
+	 {{0}, {0x68, TEXT_FULL >> 9, TEXT_FONT >> 9, 3, 0, 5, 0}}, 0, false},
+	{"NTSC",
+	 {0x22, 128, 128, 0x00, 0, 160, 0, 240},
+	 {{0}, {0x60, TEXT_MAP >> 9, TEXT_FONT >> 9, 0, 0, 0, 0}}, 0, false},
+};
+
+#define NUM_TESTS (sizeof(tests) / sizeof(tests[0]))
+
+// The same video RAM for every test: text with spaces, tiles of which
+// some are transparent, sprites, and text without spaces in the colors
+// of the KERNAL, with a word in other colors on every row
+static void
+fill(void)
+{
+	seed = 1;
+	for (uint32_t i = 0; i < VRAM_SIZE; i++) {
+		vram[i] = rnd();
+	}
+	for (uint32_t i = 0; i < 128 * 64; i++) {
+		vram[TEXT_MAP + i * 2] = rnd() % 3 ? 0x20 : rnd();
+		vram[TEXT_MAP + i * 2 + 1] = rnd() % 4 ? 0x61 : rnd();
+	}
+	memset(&vram[TEXT_FONT + 0x20 * 8], 0, 8);
+	for (uint32_t i = 0; i < 64 * 64; i++) {
+		vram[TILE_MAP + i * 2] = rnd() % 5 ? rnd() % 48 : 0;
+		vram[TILE_MAP + i * 2 + 1] = rnd() & 0x0c;
+	}
+	// tile 0 is transparent at every depth
+	memset(&vram[TILES], 0, 256);
+	for (uint32_t i = 0; i < sizeof(palette); i++) {
+		palette[i] = rnd();
+	}
+	for (uint32_t i = 0; i < 128 * 64; i++) {
+		vram[TEXT_FULL + i * 2] = 0x21 + rnd() % 0xdf;
+		vram[TEXT_FULL + i * 2 + 1] = (i % 128) / 8 == (i / 128) % 10 ? 0x07 : 0x61;
+	}
+}
+
+static void
+place_sprites(const struct test *test)
+{
+	memset(sprites, 0, sizeof(sprites));
+	for (uint32_t i = 0; i < test->sprites; i++) {
+		uint8_t *s = &sprites[i * 8];
+		const uint32_t source = 0x10000 + (i % 8) * 0x800;
+		const uint16_t x = test->sprite_line ? i * 2 : rnd() % 300;
+		const uint16_t y = test->sprite_line ? 100 : rnd() % 220;
+		s[0] = source >> 5;
+		s[1] = source >> 13 | (test->sprite_line ? 0x80 : 0);
+		s[2] = x;
+		s[3] = x >> 8;
+		s[4] = y;
+		s[5] = y >> 8;
+		s[6] = (1 + i % 3) << 2 | (i & 1);
+		s[7] = test->sprite_line ? 0xf0 : 0x50;
+	}
+}
+
+static uint32_t
+hash(const uint8_t *data, uint32_t length)
+{
+	uint32_t h = 2166136261u;
+	for (uint32_t i = 0; i < length; i++) {
+		h = (h ^ data[i]) * 16777619u;
+	}
+	return h;
+}
+
+static const char *
+image_type(eve_layers_image_t type)
+{
+	switch (type) {
+		case EVE_LAYERS_PALETTES:
+			return "palettes";
+		case EVE_LAYERS_TILES:
+			return "tiles";
+		case EVE_LAYERS_TEXT:
+			return "text";
+		default:
+			return "sprite";
+	}
+}
+
+// What a test sends to the EVE, as text
+static void
+run(const struct test *test, FILE *out)
+{
+	struct eve_layers_state state;
+	state.vram = vram;
+	state.palette = palette;
+	state.sprites = sprites;
+	memcpy(state.composer, test->composer, sizeof(state.composer));
+	memcpy(state.layer, test->layer, sizeof(state.layer));
+	state.y_scale = EVE_DISPLAY_Y_SCALE;
+	seed = 2;
+	place_sprites(test);
+
+	const eve_layers_result_t result = eve_layers_build(&state, &frame);
+	fprintf(out, "test: %s\n", test->name);
+	fprintf(out, "result: %s\n", eve_layers_result_string(result));
+	if (result != EVE_LAYERS_OK) {
+		return;
+	}
+	fprintf(out, "display list: %u words\n", frame.dl_length);
+	for (uint16_t i = 0; i < frame.dl_length; i++) {
+		fprintf(out, "%s%08X%s", i & 7 ? " " : "  ", frame.dl[i], (i & 7) == 7 || i == frame.dl_length - 1 ? "\n" : "");
+	}
+	fprintf(out, "images: %u\n", frame.image_count);
+	for (uint16_t i = 0; i < frame.image_count; i++) {
+		const struct eve_layers_image *image = &frame.images[i];
+		uint8_t *data = malloc(image->length);
+		eve_layers_expand(&state, image, data);
+		fprintf(out, "  %s, %u bpp, %ux%u, %u at $%05X: $%06X, %u bytes, %08X\n",
+		        image_type(image->type), image->bpp, image->width, image->height, image->count, image->source,
+		        image->address, image->length, hash(data, image->length));
+		free(data);
+	}
+}
+
+// The frame on the screen, whose images must stay as they are
+static struct eve_layers_frame live;
+static bool live_written;
+static FILE *stream_out;
+
+static void
+stream_mem_write(void *ctx, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	fprintf(stream_out, "  write $%06X, %u bytes, %08X\n", address, length, hash(data, length));
+	for (uint16_t i = 0; i < live.image_count; i++) {
+		const struct eve_layers_image *image = &live.images[i];
+		if (address < image->address + image->length && address + length > image->address) {
+			printf("FAIL: write to $%06X-$%06X, which the %s at $%06X on the screen is drawn from\n",
+			       address, address + length - 1, image_type(image->type), image->address);
+			live_written = true;
+		}
+	}
+}
+
+static void
+stream_show_list(void *ctx, const uint32_t *dl, uint16_t length)
+{
+	fprintf(stream_out, "  display list, %u words\n", length);
+	live = frame;
+}
+
+static const struct eve_transport stream_transport = {
+	stream_mem_write,
+	NULL,
+	NULL,
+	stream_show_list,
+	NULL,
+	NULL,
+	NULL,
+};
+
+// Sends a frame of a test, after a change to video RAM or the palette
+static void
+send(const struct test *test, const char *change, FILE *out)
+{
+	struct eve_layers_state state;
+	state.vram = vram;
+	state.palette = palette;
+	state.sprites = sprites;
+	memcpy(state.composer, test->composer, sizeof(state.composer));
+	memcpy(state.layer, test->layer, sizeof(state.layer));
+	state.y_scale = EVE_DISPLAY_Y_SCALE;
+
+	fprintf(out, "test: stream, %s\n", change);
+	const eve_layers_result_t result = eve_layers_build(&state, &frame);
+	fprintf(out, "result: %s\n", eve_layers_result_string(result));
+	if (result == EVE_LAYERS_OK) {
+		stream_out = out;
+		eve_layers_send(&stream_transport, &state, &frame);
+	}
+}
+
+// Frames of the test with text, tiles and sprites: every change is sent
+// to both regions in turn, and what is in a region already isn't sent
+// again
+static void
+stream(FILE *out)
+{
+	const struct test *test = &tests[2];
+	seed = 2;
+	place_sprites(test);
+	send(test, "first frame", out);
+	send(test, "the same, into the other region", out);
+	send(test, "the same again", out);
+	palette[5 * 2] ^= 0xff;
+	send(test, "a color changed", out);
+	send(test, "the same", out);
+	vram[TILES + 7 * 128 + 3] ^= 0x11;
+	send(test, "a tile changed", out);
+	vram[TILE_MAP + 2 * 64 * 2 + 4] = 47;
+	vram[TILE_MAP + 2 * 64 * 2 + 5] = 0x01;
+	send(test, "more tiles, the sprite images move", out);
+	send(test, "the same", out);
+	send(test, "the same again", out);
+}
+
+int
+main(int argc, char **argv)
+{
+	const bool write = argc > 2 && !strcmp(argv[1], "-write");
+	const char *path = argc > 1 ? argv[argc - 1] : "testbench/evelayers.golden";
+
+	fill();
+	FILE *out = tmpfile();
+	for (uint32_t t = 0; t < NUM_TESTS; t++) {
+		run(&tests[t], out);
+	}
+	stream(out);
+	rewind(out);
+	if (live_written) {
+		return 1;
+	}
+
+	FILE *golden = fopen(path, write ? "w" : "r");
+	if (!golden) {
+		printf("FAIL: can't open %s\n", path);
+		return 1;
+	}
+	char line[256];
+	if (write) {
+		while (fgets(line, sizeof(line), out)) {
+			fputs(line, golden);
+		}
+		fclose(golden);
+		printf("%s written\n", path);
+		return 0;
+	}
+
+	// the first line that differs, with the test it is in
+	char expected[256];
+	char test[256] = "";
+	for (uint32_t n = 1;; n++) {
+		const bool have_line = fgets(line, sizeof(line), out) != NULL;
+		const bool have_expected = fgets(expected, sizeof(expected), golden) != NULL;
+		if (!have_line && !have_expected) {
+			break;
+		}
+		if (!have_line || !have_expected || strcmp(line, expected)) {
+			printf("FAIL: %s, line %u of %s differs\n", test, n, path);
+			printf("  expected: %s", have_expected ? expected : "(the end)\n");
+			printf("  built:    %s", have_line ? line : "(the end)\n");
+			return 1;
+		}
+		if (!strncmp(line, "test: ", 6)) {
+			strcpy(test, line + 6);
+			test[strlen(test) - 1] = 0;
+		}
+	}
+	fclose(golden);
+	printf("%u tests and a stream of frames, OK\n", (uint32_t)NUM_TESTS);
+	return 0;
+}
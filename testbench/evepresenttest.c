@@ -0,0 +1,253 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+// eve_present_submit() against the EVE mock, with a display that takes
+// a while to swap buffers: frames are shown in the order they were
+// submitted, none is written while it is on the screen, and the lines
+// of frames that were dropped still get to the EVE. With "lines", the
+// lines are streamed (-stream-lines) instead, and the audio has to keep
+// playing while the screen doesn't change.
+//
+//   make evepresenttest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "../src/eve_present.h"
+#include "../src/eve_audio.h"
+#include "../src/eve_mock.h"
+
+#define WIDTH EVE_DISPLAY_WIDTH
+#define HEIGHT EVE_DISPLAY_HEIGHT
+
+// how long a swap takes, like waiting for the next frame on the panel
+#define SWAP_MS 2
+
+static const struct eve_transport *mock;
+static uint8_t framebuffer[WIDTH * HEIGHT];
+static uint16_t palette[256];
+
+// samples the EVE played, from the start of the ring
+static uint32_t played;
+
+// what the worker showed, in its thread
+static SDL_atomic_t shown_count;
+static SDL_atomic_t last_shown;
+static SDL_atomic_t out_of_order;
+
+// Every frame has its number in the first pixels
+static uint32_t
+frame_number(const uint8_t *pixels)
+{
+	return pixels[0] | pixels[1] << 8 | pixels[2] << 16 | (uint32_t)pixels[3] << 24;
+}
+
+static void
+test_mem_write(void *ctx, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	mock->mem_write(mock->ctx, address, data, length);
+}
+
+static void
+test_inflate(void *ctx, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	mock->inflate(mock->ctx, address, data, length);
+}
+
+static void
+test_show(void *ctx, uint8_t buffer, bool half)
+{
+	SDL_Delay(SWAP_MS);
+	mock->show(mock->ctx, buffer, half);
+	const uint32_t n = frame_number(eve_mock_screen());
+	if ((int32_t)n <= SDL_AtomicGet(&last_shown)) {
+		SDL_AtomicAdd(&out_of_order, 1);
+	}
+	SDL_AtomicSet(&last_shown, n);
+	SDL_AtomicAdd(&shown_count, 1);
+}
+
+static void
+test_show_list(void *ctx, const uint32_t *dl, uint16_t length)
+{
+	mock->show_list(mock->ctx, dl, length);
+}
+
+static void
+test_play(void *ctx, uint32_t address, uint32_t length, uint16_t rate, uint8_t format)
+{
+}
+
+static uint32_t
+test_play_position(void *ctx)
+{
+	return EVE_DISPLAY_AUDIO_RING + played % EVE_DISPLAY_AUDIO_SIZE;
+}
+
+static const struct eve_transport transport = {
+	test_mem_write,
+	test_inflate,
+	test_show,
+	test_show_list,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static const struct eve_transport transport_audio = {
+	test_mem_write,
+	test_inflate,
+	test_show,
+	test_show_list,
+	test_play,
+	test_play_position,
+	NULL,
+};
+
+// Frame n: its number, and a line of its own
+static void
+submit(uint32_t n, bool wait, bool *taken)
+{
+	uint32_t dirty[EVE_DISPLAY_DIRTY_WORDS];
+	memset(dirty, 0, sizeof(dirty));
+	framebuffer[0] = n;
+	framebuffer[1] = n >> 8;
+	framebuffer[2] = n >> 16;
+	framebuffer[3] = n >> 24;
+	dirty[0] |= 1;
+	const uint16_t y = 1 + n % (HEIGHT - 1);
+	memset(&framebuffer[y * WIDTH], n * 7 + 1, WIDTH);
+	dirty[y >> 5] |= 1u << (y & 31);
+	*taken = eve_present_submit(framebuffer, palette, dirty, n == 1, false, wait);
+}
+
+static void
+pull(int16_t *samples, uint32_t count)
+{
+	memset(samples, 0, count * 2 * sizeof(int16_t));
+}
+
+static int
+nothing(void *arg)
+{
+	return 0;
+}
+
+static bool
+check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+	}
+	return ok;
+}
+
+static bool
+screen_is_framebuffer(void)
+{
+	struct eve_mock_stats stats;
+	eve_mock_check(framebuffer, palette);
+	eve_mock_get_stats(&stats);
+	return !stats.mismatch;
+}
+
+// Streamed lines for a few frames, then a screen that doesn't change:
+// the audio is serviced on every frame, with or without transfers
+static bool
+test_lines(void)
+{
+	bool ok = true;
+	const uint32_t per_frame = EVE_AUDIO_RATE / 60;
+	eve_audio_init(&transport_audio, EVE_AUDIO_LINEAR, EVE_AUDIO_RATE, pull);
+	eve_present_lines_init(&transport_audio);
+	for (uint32_t n = 0; n < 300; n++) {
+		if (n < 10) {
+			for (uint16_t y = 0; y < HEIGHT; y += 7) {
+				memset(&framebuffer[y * WIDTH], n + y, WIDTH);
+				eve_present_line(y, &framebuffer[y * WIDTH]);
+			}
+		}
+		eve_present_lines_end_frame(palette, n == 0);
+		played += per_frame;
+	}
+	struct eve_audio_stats stats;
+	eve_audio_get_stats(&stats);
+	printf("%u samples played, %u sent, %u underruns\n", played, (uint32_t)stats.samples, stats.underruns);
+	ok &= check(stats.samples + EVE_AUDIO_TARGET >= played, "the audio keeps up while the screen doesn't change");
+	ok &= check(stats.underruns == 0, "no underruns while the screen doesn't change");
+	return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+	bool ok = true;
+	uint32_t n = 1;
+	bool taken;
+
+	eve_mock_set_paced(false);
+	mock = eve_mock_transport(true);
+	for (int i = 0; i < 256; i++) {
+		palette[i] = i * 0x0101;
+	}
+	if (argc > 1 && !strcmp(argv[1], "lines")) {
+		if (!test_lines()) {
+			return 1;
+		}
+		printf("OK\n");
+		return 0;
+	}
+	SDL_AtomicSet(&last_shown, 0);
+	const bool threaded = SDL_CreateThread(nothing, "nothing", NULL) != NULL;
+	eve_present_init(&transport);
+
+	// Waiting: every frame is shown, in order
+	const uint32_t waited = 100;
+	bool all_taken = true;
+	for (uint32_t i = 0; i < waited; i++, n++) {
+		submit(n, true, &taken);
+		all_taken &= taken;
+	}
+	eve_present_flush();
+	ok &= check(all_taken, "a frame is always taken when waiting for it");
+	ok &= check(SDL_AtomicGet(&shown_count) == waited, "every frame is shown when waiting");
+	ok &= check(screen_is_framebuffer(), "the last frame is on the screen after waiting");
+
+	// Without waiting, faster than the display: frames are dropped, the
+	// ones shown are in order, and the last one has the lines of all
+	const uint32_t submitted = 300;
+	uint32_t dropped = 0;
+	const uint32_t shown_before = SDL_AtomicGet(&shown_count);
+	for (uint32_t i = 0; i < submitted; i++, n++) {
+		submit(n, false, &taken);
+		dropped += !taken;
+		SDL_Delay(i & 1);
+	}
+	// the last one for sure
+	submit(n++, true, &taken);
+	eve_present_flush();
+	const uint32_t shown = SDL_AtomicGet(&shown_count) - shown_before;
+	printf("%u frames without waiting: %u shown, %u dropped\n", submitted + 1, shown, dropped);
+	if (threaded) {
+		ok &= check(dropped > 0, "frames are dropped without waiting");
+	} else {
+		// eve_present.c sends them synchronously
+		printf("No threads, no frames to drop\n");
+	}
+	ok &= check(shown + dropped == submitted + 1, "every frame is either shown or dropped");
+	ok &= check((uint32_t)SDL_AtomicGet(&last_shown) == n - 1, "the last frame is shown last");
+	ok &= check(screen_is_framebuffer(), "the lines of dropped frames get to the screen");
+
+	ok &= check(SDL_AtomicGet(&out_of_order) == 0, "frames are shown in order");
+	struct eve_mock_stats stats;
+	eve_mock_get_stats(&stats);
+	ok &= check(stats.torn_writes == 0, "no writes to the buffer on the screen");
+
+	if (!ok) {
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,255 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+// Checks that pcm_render() is bit exact with rendering sample by sample,
+// the way the PCM FIFO was emulated before, in the output and in the
+// state the CPU sees: random FIFO and register writes between blocks of
+// random lengths, for every format and rate.
+//
+//   make pcmtest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/vera_pcm.h"
+
+static uint8_t  fifo[4096];
+static unsigned fifo_wridx;
+static unsigned fifo_rdidx;
+static unsigned fifo_cnt;
+
+static uint8_t ctrl;
+static uint8_t rate;
+static uint8_t loop;
+
+static uint8_t volume_lut[16] = {0, 2, 4, 6, 8, 10, 12, 16, 21, 27, 35, 45, 59, 76, 99, 128};
+
+static int16_t cur_l, cur_r;
+static uint8_t phase;
+
+static void
+fifo_reset(void)
+{
+	fifo_wridx = 0;
+	fifo_rdidx = 0;
+	fifo_cnt   = 0;
+}
+
+static void
+fifo_restart(void)
+{
+	fifo_rdidx = 0;
+	fifo_cnt = fifo_wridx;
+}
+
+static void
+ref_reset(void)
+{
+	fifo_reset();
+	ctrl  = 0;
+	rate  = 0;
+	cur_l = 0;
+	cur_r = 0;
+	phase = 0;
+}
+
+static void
+ref_write_ctrl(uint8_t val)
+{
+	if ((val & 0xc0) == 0xc0) {
+		loop = true;
+	} else {
+		loop = false;
+		if (val & 0x80) {
+			fifo_reset();
+		}
+	}
+	if (val & 0x40) {
+		fifo_restart();
+	}
+	ctrl = val & 0x3F;
+}
+
+static uint8_t
+ref_read_ctrl(void)
+{
+	uint8_t result = ctrl;
+	if (fifo_cnt == sizeof(fifo) - 1) {
+		result |= 0x80;
+	}
+	if (fifo_cnt == 0) {
+		result |= 0x40;
+	}
+	return result;
+}
+
+static void
+ref_write_rate(uint8_t val)
+{
+	rate = (val > 128) ? (256 - val) : val;
+}
+
+static uint8_t
+ref_read_rate(void)
+{
+	return rate;
+}
+
+static void
+ref_write_fifo(uint8_t val)
+{
+	if (fifo_cnt < sizeof(fifo) - 1) {
+		fifo[fifo_wridx++] = val;
+		if (fifo_wridx == sizeof(fifo)) {
+			fifo_wridx = 0;
+		}
+		fifo_cnt++;
+	}
+}
+
+static uint8_t
+read_fifo()
+{
+	static uint8_t result = 0;
+	if (fifo_cnt == 0) {
+		return 0;
+	}
+	result = fifo[fifo_rdidx++];
+	if (fifo_rdidx == sizeof(fifo)) {
+		fifo_rdidx = 0;
+	}
+	fifo_cnt--;
+	return result;
+}
+
+static bool
+ref_is_fifo_almost_empty(void)
+{
+	return fifo_cnt < 1024;
+}
+
+static void
+ref_render(int32_t *buf, unsigned num_samples)
+{
+	while (num_samples--) {
+		uint8_t old_phase = phase;
+		phase += rate;
+		if ((old_phase & 0x80) != (phase & 0x80)) {
+			if (fifo_cnt == 0) {
+				cur_l = 0;
+				cur_r = 0;
+			} else {
+				switch ((ctrl >> 4) & 3) {
+					case 0: { // mono 8-bit
+						cur_l = (int16_t)read_fifo() << 8;
+						cur_r = cur_l;
+						break;
+					}
+					case 1: { // stereo 8-bit
+						if (fifo_cnt < 2) {
+							fifo_cnt = 0;
+							fifo_rdidx = fifo_wridx;
+						} else {
+							cur_l = read_fifo() << 8;
+							cur_r = read_fifo() << 8;
+						}
+						break;
+					}
+					case 2: { // mono 16-bit
+						if (fifo_cnt < 2) {
+							fifo_cnt = 0;
+							fifo_rdidx = fifo_wridx;
+						} else {
+							cur_l = read_fifo();
+							cur_l |= read_fifo() << 8;
+							cur_r = cur_l;
+						}
+						break;
+					}
+					case 3: { // stereo 16-bit
+						if (fifo_cnt < 4) {
+							fifo_cnt = 0;
+							fifo_rdidx = fifo_wridx;
+						} else {
+							cur_l = read_fifo();
+							cur_l |= read_fifo() << 8;
+							cur_r = read_fifo();
+							cur_r |= read_fifo() << 8;
+						}
+						break;
+					}
+				}
+				if (loop && fifo_cnt == 0) {
+					fifo_restart();
+				}
+			}
+		}
+		*(buf++) = (int32_t)cur_l * volume_lut[ctrl & 0xF];
+		*(buf++) = (int32_t)cur_r * volume_lut[ctrl & 0xF];
+	}
+}
+
+static uint32_t seed = 1;
+
+static uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+int
+main(int argc, char **argv)
+{
+	static int32_t buf[2 * 1024];
+	static int32_t ref[2 * 1024];
+	uint64_t samples = 0;
+
+	pcm_reset();
+	ref_reset();
+	for (int step = 0; step < 1000000; step++) {
+		unsigned n = rnd() % 8 ? rnd() % 80 : rnd() % 1024;
+		pcm_render(buf, n);
+		ref_render(ref, n);
+		if (memcmp(buf, ref, n * 2 * sizeof(int32_t))) {
+			for (unsigned j = 0; j < n * 2; j++) {
+				if (buf[j] != ref[j]) {
+					printf("FAIL: sample %llu, %s is %d instead of %d\n", (unsigned long long)(samples + j / 2), j & 1 ? "right" : "left", buf[j], ref[j]);
+					break;
+				}
+			}
+			return 1;
+		}
+		samples += n;
+		if (pcm_read_ctrl() != ref_read_ctrl() || pcm_read_rate() != ref_read_rate() || pcm_is_fifo_almost_empty() != ref_is_fifo_almost_empty()) {
+			printf("FAIL: FIFO state after sample %llu\n", (unsigned long long)samples);
+			return 1;
+		}
+
+		uint32_t r = rnd() % 100;
+		if (r < 60) {
+			// a burst of data, sometimes enough to fill the FIFO
+			int count = rnd() % 8 ? rnd() % 64 : rnd() % 4096;
+			while (count--) {
+				uint8_t val = rnd();
+				pcm_write_fifo(val);
+				ref_write_fifo(val);
+			}
+		} else if (r < 70) {
+			// format and volume, and now and then reset, restart or loop
+			uint8_t val = rnd() % 16 ? rnd() & 0x3F : rnd();
+			pcm_write_ctrl(val);
+			ref_write_ctrl(val);
+		} else if (r < 80) {
+			uint8_t val = rnd();
+			pcm_write_rate(val);
+			ref_write_rate(val);
+		} else if (r < 81) {
+			pcm_reset();
+			ref_reset();
+		}
+	}
+	printf("OK: %llu samples\n", (unsigned long long)samples);
+	return 0;
+}
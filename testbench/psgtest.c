@@ -0,0 +1,196 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+// Checks that psg_render() is bit exact with rendering sample by sample,
+// the way the PSG was emulated before: random register writes between
+// blocks of random lengths, for every waveform.
+//
+//   make psgtest
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/vera_psg.h"
+
+struct channel {
+	uint16_t freq;
+	uint16_t volume;
+	bool     left, right;
+	uint8_t  pw;
+	uint8_t  waveform;
+
+	uint16_t noiseval;
+	uint32_t phase;
+};
+
+static struct channel channels[16];
+
+static uint16_t volume_lut[64] = {
+	  0,                                          14,  15,  16,
+	 16,  17,  19,  20,  21,  22,  23,  25,  26,  28,  30,  32,
+	 33,  35,  38,  40,  42,  45,  47,  50,  53,  57,  60,  64,
+	 67,  71,  76,  80,  85,  90,  95, 101, 107, 114, 120, 128,
+	135, 143, 152, 161, 170, 181, 191, 203, 215, 228, 241, 256,
+	271, 287, 304, 322, 341, 362, 383, 406, 430, 456, 483, 512
+};
+
+static uint16_t noise_out, noise_state;
+
+static void
+ref_reset(void)
+{
+	memset(channels, 0, sizeof(channels));
+	noise_out = 0;
+	noise_state = 1;
+}
+
+static void
+ref_writereg(uint8_t reg, uint8_t val)
+{
+	reg &= 0x3f;
+
+	int ch  = reg / 4;
+	int idx = reg & 3;
+
+	switch (idx) {
+		case 0: channels[ch].freq = (channels[ch].freq & 0xFF00) | val; break;
+		case 1: channels[ch].freq = (channels[ch].freq & 0x00FF) | (val << 8); break;
+		case 2: {
+			channels[ch].right  = (val & 0x80) != 0;
+			channels[ch].left   = (val & 0x40) != 0;
+			channels[ch].volume = volume_lut[val & 0x3F];
+			break;
+		}
+		case 3: {
+			channels[ch].pw       = val & 0x3F;
+			channels[ch].waveform = val >> 6;
+			break;
+		}
+	}
+}
+
+static void
+ref_render_sample(int32_t *left, int32_t *right)
+{
+	int32_t l = 0;
+	int32_t r = 0;
+
+	for (int i = 0; i < 16; i++) {
+		noise_out = ((noise_out << 1) | (noise_state & 1)) & 0x3FF;
+		noise_state = (noise_state << 1) | (((noise_state >> 1) ^ (noise_state >> 2) ^ (noise_state >> 4) ^ (noise_state >> 15)) & 1);
+
+		struct channel *ch = &channels[i];
+
+		uint32_t new_phase = (ch->left || ch->right) ? ((ch->phase + ch->freq) & 0x1FFFF) : 0;
+		if ((ch->phase & 0x10000) != (new_phase & 0x10000)) {
+			ch->noiseval = noise_out;
+		}
+		ch->phase = new_phase;
+
+		uint32_t v = 0;
+		switch (ch->waveform) {
+			case 0: v = ((ch->phase >> 10) > ch->pw) ? 0 : 0x3FF; break;
+			case 1: v = ch->phase >> 7; break;
+			case 2: v = (ch->phase & 0x10000) ? (~(ch->phase >> 6) & 0x3FF) : ((ch->phase >> 6) & 0x3FF); break;
+			case 3: v = ch->noiseval; break;
+		}
+		int32_t sv = (v ^ 0x200);
+		if (sv & 0x200) {
+			sv |= 0xFFFFFC00;
+		}
+
+		int32_t val = sv * ch->volume;
+
+		if (ch->left) {
+			l += val;
+		}
+		if (ch->right) {
+			r += val;
+		}
+	}
+
+	*left  = l;
+	*right = r;
+}
+
+static void
+ref_render(int32_t *buf, unsigned num_samples)
+{
+	while (num_samples--) {
+		ref_render_sample(&buf[0], &buf[1]);
+		buf += 2;
+	}
+}
+
+static uint32_t seed = 1;
+
+static uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void
+write_both(uint8_t reg, uint8_t val)
+{
+	psg_writereg(reg, val);
+	ref_writereg(reg, val);
+}
+
+static uint8_t
+random_value(uint8_t reg)
+{
+	uint8_t val = rnd();
+	switch (reg & 3) {
+		case 1:
+			// low frequencies too, where the phase crosses bit 16 rarely
+			return rnd() % 4 ? val : val & 3;
+		case 2:
+			// silent and disabled channels too
+			return rnd() % 8 ? val : (rnd() % 2 ? val & 0xC0 : val & 0x3F);
+	}
+	return val;
+}
+
+int
+main(int argc, char **argv)
+{
+	static int32_t buf[2 * 1024];
+	static int32_t ref[2 * 1024];
+	uint64_t samples = 0;
+
+	psg_reset();
+	ref_reset();
+	for (int reg = 0; reg < 64; reg++) {
+		write_both(reg, random_value(reg));
+	}
+	for (int step = 0; step < 200000; step++) {
+		unsigned n = rnd() % 8 ? rnd() % 80 : rnd() % 1024;
+		psg_render(buf, n);
+		ref_render(ref, n);
+		if (memcmp(buf, ref, n * 2 * sizeof(int32_t))) {
+			for (unsigned j = 0; j < n * 2; j++) {
+				if (buf[j] != ref[j]) {
+					printf("FAIL: sample %llu, %s is %d instead of %d\n", (unsigned long long)(samples + j / 2), j & 1 ? "right" : "left", buf[j], ref[j]);
+					break;
+				}
+			}
+			return 1;
+		}
+		samples += n;
+		int writes = rnd() % 4;
+		while (writes--) {
+			uint8_t reg = rnd() % 64;
+			write_both(reg, random_value(reg));
+		}
+		if (rnd() % 50000 == 0) {
+			psg_reset();
+			ref_reset();
+		}
+	}
+	printf("OK: %llu samples\n", (unsigned long long)samples);
+	return 0;
+}
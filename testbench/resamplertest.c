@@ -0,0 +1,300 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+// The frequency response of the resampler's presets, from VERA's and the
+// YM2151's sample rates to common host sample rates: how much of a sine
+// in the passband comes through, how much of one above the host's
+// Nyquist frequency comes back as an alias, and, at a higher host rate,
+// how much of the passband's image above the source's Nyquist frequency
+// is left. With "bench", how long each preset takes instead.
+//
+//   make resamplertest
+//   make resamplerbench
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/resampler.h"
+
+#define PI 3.14159265358979323846
+#define FRAC_BITS 24
+#define SOURCE_LEN 32768
+#define AMPLITUDE 16384
+
+struct source {
+	const char *name;
+	uint64_t clock;
+	uint32_t divider;
+};
+
+static const struct source sources[] = {
+	{"VERA", 25000000, 512},
+	{"YM2151", 3579545, 64},
+};
+
+static const uint32_t host_rates[] = {24414, 44100, 48000, 96000};
+
+static const char *quality_names[] = {"nearest", "normal", "high"};
+
+static int16_t src_l[SOURCE_LEN];
+static int16_t src_r[SOURCE_LEN];
+static int32_t out_l[SOURCE_LEN * 4];
+static int32_t out_r[SOURCE_LEN * 4];
+
+static double
+source_rate(const struct source *s)
+{
+	return (double)s->clock / s->divider;
+}
+
+static uint32_t
+step_for(const struct source *s, uint32_t host_rate)
+{
+	// as audio_init() does it
+	return (uint32_t)((s->clock << FRAC_BITS) / s->divider / host_rate);
+}
+
+// Everything the source has, in blocks like the emulator renders them;
+// returns the number of output samples
+static uint32_t
+resample(const struct resampler *r)
+{
+	uint64_t pos = 0;
+	uint32_t count = 0;
+	for (;;) {
+		// the positions in a block are less than 256 source samples apart
+		uint32_t n = ((uint64_t)255 << FRAC_BITS) / r->step;
+		uint64_t last = pos + (uint64_t)(n - 1) * r->step;
+		if ((last >> FRAC_BITS) + r->taps > SOURCE_LEN) {
+			return count;
+		}
+		uint32_t base = pos >> FRAC_BITS;
+		resampler_run(r, src_l + base, src_r + base, pos & ((1 << FRAC_BITS) - 1), n, out_l + count, out_r + count);
+		count += n;
+		pos += (uint64_t)n * r->step;
+	}
+}
+
+static void
+make_sine(double freq, double rate)
+{
+	for (int i = 0; i < SOURCE_LEN; i++) {
+		double v = AMPLITUDE * sin(2 * PI * freq * i / rate);
+		src_l[i] = (int16_t)lrint(v);
+		src_r[i] = (int16_t)lrint(-v);
+	}
+}
+
+// Amplitude of freq in the output relative to the sine's, in dB, with
+// a Hann window against the leakage of other frequencies
+static double
+level(uint32_t count, double freq, double rate)
+{
+	double re = 0, im = 0, weight = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		double w = 0.5 - 0.5 * cos(2 * PI * i / (count - 1));
+		double v = (out_l[i] - out_r[i]) / 2.0 / 32768.0;
+		re += w * v * cos(2 * PI * freq * i / rate);
+		im += w * v * sin(2 * PI * freq * i / rate);
+		weight += w;
+	}
+	double amp = 2 * sqrt(re * re + im * im) / weight;
+	return 20 * log10(amp / AMPLITUDE + 1e-12);
+}
+
+static bool
+check(bool ok, const char *what, const char *quality, const struct source *s, uint32_t host_rate, double freq, double db)
+{
+	if (!ok) {
+		printf("FAIL: %s, %s from %s to %u Hz at %.0f Hz: %.2f dB\n", what, quality, s->name, host_rate, freq, db);
+	}
+	return ok;
+}
+
+// Limits per preset: the passband that is flat, with its images, and the
+// stopband, whose aliases have to be down, as parts of the lower Nyquist
+// frequency. nearest and normal interpolate, but don't filter on the way
+// down (at 2:1, they pick every other sample), so their aliases are not
+// checked (0); their filter shows in the images.
+struct limits {
+	double passband;
+	double ripple;    // dB
+	double image;     // dB
+	double stopband;
+	double alias;     // dB
+};
+
+static const struct limits limits[] = {
+	{0.09, 0.1,  -25.0, 1.0,   0.0},
+	{0.36, 0.25, -29.0, 1.0,   0.0},
+	{0.72, 0.05, -75.0, 1.1, -67.0},
+};
+
+static bool
+test_response(resampler_quality_t q, const struct source *s, uint32_t host_rate)
+{
+	bool ok = true;
+	struct resampler r;
+	resampler_init(&r, q, step_for(s, host_rate), FRAC_BITS);
+	const double rate = source_rate(s);
+	const double nyquist = (rate < host_rate ? rate : host_rate) / 2;
+	const struct limits *lim = &limits[q];
+	double worst_pass = 0;
+	double worst_image = -200;
+	double worst_alias = -200;
+
+	for (double f = 250; f < rate / 2; f += 250) {
+		make_sine(f, rate);
+		uint32_t count = resample(&r);
+		if (f < host_rate / 2.0) {
+			double db = level(count, f, host_rate);
+			if (f <= lim->passband * nyquist) {
+				ok &= check(fabs(db) <= lim->ripple, "passband", quality_names[q], s, host_rate, f, db);
+				if (fabs(db) > fabs(worst_pass)) {
+					worst_pass = db;
+				}
+				if (rate - f < host_rate / 2.0) {
+					db = level(count, rate - f, host_rate);
+					ok &= check(db <= lim->image, "image", quality_names[q], s, host_rate, f, db);
+					if (db > worst_image) {
+						worst_image = db;
+					}
+				}
+			}
+		} else if (f >= lim->stopband * nyquist) {
+			double alias = host_rate - f;
+			double db = level(count, alias, host_rate);
+			if (lim->alias < 0) {
+				ok &= check(db <= lim->alias, "alias", quality_names[q], s, host_rate, f, db);
+			}
+			if (db > worst_alias) {
+				worst_alias = db;
+			}
+		}
+	}
+	printf("%-8s %-7s -> %5u Hz: passband to %5.0f Hz %+6.2f dB, images %7.1f dB, aliases %7.1f dB\n",
+	       quality_names[q], s->name, host_rate, lim->passband * nyquist, worst_pass, worst_image, worst_alias);
+	resampler_free(&r);
+	return ok;
+}
+
+// The same sample rate: what comes out is what went in
+static bool
+test_same_rate(resampler_quality_t q)
+{
+	const struct source *s = &sources[0];
+	struct resampler r;
+	resampler_init(&r, q, step_for(s, (uint32_t)source_rate(s)), FRAC_BITS);
+	for (int i = 0; i < SOURCE_LEN; i++) {
+		src_l[i] = rand();
+		src_r[i] = rand();
+	}
+	uint32_t count = resample(&r);
+	// at the middle tap, like the filters
+	uint32_t skipped = r.taps / 2 - 1;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t j = i + skipped;
+		if (out_l[i] != src_l[j] * 32768 || out_r[i] != src_r[j] * 32768) {
+			// the rate is rounded down to the Hz, once in a while a
+			// sample is left out
+			skipped++;
+			j++;
+			if (out_l[i] != src_l[j] * 32768 || out_r[i] != src_r[j] * 32768) {
+				printf("FAIL: %s at the same rate, sample %u\n", quality_names[q], i);
+				resampler_free(&r);
+				return false;
+			}
+		}
+	}
+	resampler_free(&r);
+	return true;
+}
+
+// A whole ratio with the step adjusted like audio.c follows the host's
+// rate: the output samples are between the source's, at every phase
+static bool
+test_adjusted_step(resampler_quality_t q, uint32_t host_rate)
+{
+	const struct source *s = &sources[0];
+	const double rate = source_rate(s);
+	const double freq = 1000;
+	struct resampler r;
+	resampler_init(&r, q, step_for(s, host_rate), FRAC_BITS);
+	// 0.5% faster, as far as audio.c goes
+	r.step += r.step / 200;
+	make_sine(freq, rate);
+	const uint32_t count = resample(&r);
+	// a filter's output is at its middle tap
+	const uint32_t center = r.taps / 2 - 1;
+	double worst = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		const double pos = (double)i * r.step / (1 << FRAC_BITS) + center;
+		const double error = fabs(out_l[i] / 32768.0 - AMPLITUDE * sin(2 * PI * freq * pos / rate));
+		if (error > worst) {
+			worst = error;
+		}
+	}
+	resampler_free(&r);
+	// half a sample off would be -24 dB
+	const double db = 20 * log10(worst / AMPLITUDE);
+	if (db > -30) {
+		printf("FAIL: %s with the step adjusted from %.0f Hz to %u Hz: off by %.1f dB\n", quality_names[q], rate, host_rate, db);
+		return false;
+	}
+	return true;
+}
+
+static void
+bench(void)
+{
+	make_sine(1000, source_rate(&sources[0]));
+	for (int q = RESAMPLER_NEAREST; q <= RESAMPLER_HIGH; q++) {
+		for (int i = 0; i < sizeof(host_rates) / sizeof(host_rates[0]); i++) {
+			struct resampler r;
+			resampler_init(&r, q, step_for(&sources[0], host_rates[i]), FRAC_BITS);
+			uint64_t samples = 0;
+			clock_t start = clock();
+			while (clock() - start < CLOCKS_PER_SEC / 2) {
+				for (int k = 0; k < 16; k++) {
+					samples += resample(&r);
+				}
+			}
+			double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+			printf("%-8s -> %5u Hz: %6.2f ns per stereo sample, %6.0fx real time\n",
+			       quality_names[q], host_rates[i], seconds * 1e9 / samples, samples / seconds / host_rates[i]);
+			resampler_free(&r);
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		bench();
+		return 0;
+	}
+
+	bool ok = true;
+	for (int q = RESAMPLER_NEAREST; q <= RESAMPLER_HIGH; q++) {
+		for (int s = 0; s < sizeof(sources) / sizeof(sources[0]); s++) {
+			for (int i = 0; i < sizeof(host_rates) / sizeof(host_rates[0]); i++) {
+				ok &= test_response(q, &sources[s], host_rates[i]);
+			}
+		}
+		ok &= test_same_rate(q);
+		if (q != RESAMPLER_NEAREST) {
+			// it has no phases
+			ok &= test_adjusted_step(q, (uint32_t)source_rate(&sources[0]));
+			ok &= test_adjusted_step(q, host_rates[0]);
+		}
+	}
+	if (!ok) {
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
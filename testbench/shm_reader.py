@@ -0,0 +1,119 @@
+"""
+Reads the frames and the audio an emulator started with -shm <name>
+publishes. The layout and the protocol are described in src/shm_export.h.
+
+Run it as a script to watch an emulator:
+    python3 shm_reader.py <name>
+"""
+import mmap
+import struct
+import time
+
+MAGIC = b"X16SHM1\0"
+NO_FRAME = 0xFFFFFFFF
+HEADER = struct.Struct("=8sHHIIIIIIIIIQQ")
+FRAME_HEADER = struct.Struct("=II")
+PALETTE_SIZE = 256 * 3
+
+class X16SharedMemory:
+    """
+    Class constructor. Waits until the emulator has created the object.
+
+    Args:
+        name: The name given to -shm
+        timeout: Number of seconds until abort waiting
+
+    Raises:
+        Exception: If aborted by timeout
+    """
+    def __init__(self, name, timeout=5):
+        path = "/dev/shm/" + name.lstrip("/")
+        end = time.time() + timeout
+        self.shm = None
+        while self.shm is None:
+            try:
+                with open(path, "rb") as f:
+                    m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+                if m[:len(MAGIC)] == MAGIC:
+                    self.shm = m
+                else:
+                    m.close()
+            except (FileNotFoundError, ValueError):
+                pass
+            if self.shm is None:
+                if time.time() > end:
+                    raise Exception("Timeout waiting for " + path)
+                time.sleep(0.05)
+
+        (_, self.width, self.height, self.frame_rate_num, self.frame_rate_den,
+         self.sample_rate, self.frame_size, self.frames_offset, self.audio_offset,
+         self.audio_capacity, _, _, _, _) = HEADER.unpack_from(self.shm, 0)
+
+    def close(self):
+        self.shm.close()
+
+    def __field(self, name):
+        h = HEADER.unpack_from(self.shm, 0)
+        return {"latest": h[10], "audio_written": h[12], "audio_writing": h[13]}[name]
+
+    def __sequence(self, index):
+        return FRAME_HEADER.unpack_from(self.shm, self.frames_offset + index * self.frame_size)[0]
+
+    """
+    Returns the newest frame as (number, palette, pixels), with the palette
+    as 256 RGB triples, or None if there is no frame yet. A frame that was
+    overwritten while it was read is read again.
+    """
+    def frame(self):
+        while True:
+            index = self.__field("latest")
+            if index == NO_FRAME:
+                return None
+            offset = self.frames_offset + index * self.frame_size
+            sequence = self.__sequence(index)
+            if sequence & 1:
+                continue
+            number = FRAME_HEADER.unpack_from(self.shm, offset)[1]
+            start = offset + FRAME_HEADER.size
+            palette = self.shm[start:start + PALETTE_SIZE]
+            start += PALETTE_SIZE
+            pixels = self.shm[start:start + self.width * self.height]
+            if self.__sequence(index) == sequence:
+                return (number, palette, pixels)
+
+    """
+    Returns the audio from sample position on as (samples, position, lost):
+    the interleaved 16 bit stereo samples, the position to continue from,
+    and how many samples were overwritten before they could be read.
+    """
+    def audio(self, position=0):
+        written = self.__field("audio_written")
+        start = max(position, written - self.audio_capacity)
+        data = bytearray()
+        pos = start
+        while pos < written:
+            ring = pos % self.audio_capacity
+            n = min(written - pos, self.audio_capacity - ring)
+            offset = self.audio_offset + ring * 4
+            data += self.shm[offset:offset + n * 4]
+            pos += n
+        # drop what was overwritten while it was read
+        valid = min(written, self.__field("audio_writing") - self.audio_capacity)
+        if valid > start:
+            data = data[(valid - start) * 4:]
+            start = valid
+        return (bytes(data), written, start - position)
+
+if __name__ == '__main__':
+    import sys
+    shm = X16SharedMemory(sys.argv[1] if len(sys.argv) > 1 else "x16emu")
+    print("%dx%d, %.2f frames/s, %d Hz" % (shm.width, shm.height, shm.frame_rate_num / shm.frame_rate_den, shm.sample_rate))
+    position = 0
+    last = None
+    while True:
+        f = shm.frame()
+        samples, position, lost = shm.audio(position)
+        if f and f[0] != last:
+            last = f[0]
+            print("frame %d, %d samples, %d lost" % (f[0], len(samples) // 4, lost))
+        time.sleep(1 / 60)
@@ -0,0 +1,86 @@
+import os
+import subprocess
+import time
+import unittest
+from shm_reader import X16SharedMemory
+
+# Runs without a display or a sound card
+ENV = dict(os.environ, SDL_VIDEODRIVER="dummy", SDL_AUDIODRIVER="dummy")
+NAME = "x16emu-shmtest-%d" % os.getpid()
+
+class SharedMemoryTest(unittest.TestCase):
+    emu = None
+    shm = None
+
+    @classmethod
+    def setUpClass(cls):
+        cls.emu = subprocess.Popen(["../x16emu", "-shm", NAME], env=ENV, stdout=subprocess.DEVNULL)
+        cls.shm = X16SharedMemory(NAME)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.shm.close()
+        cls.emu.terminate()
+        cls.emu.wait()
+        # the emulator removes it when it quits, but not when it crashed
+        if os.path.exists("/dev/shm/" + NAME):
+            os.remove("/dev/shm/" + NAME)
+
+    def wait_frame(self, after=None, timeout=5):
+        end = time.time() + timeout
+        while time.time() < end:
+            f = self.shm.frame()
+            if f and (after is None or f[0] > after):
+                return f
+            time.sleep(0.005)
+        self.fail("no new frame")
+
+    def test_header(self):
+        self.assertEqual((self.shm.width, self.shm.height), (640, 480))
+        self.assertAlmostEqual(self.shm.frame_rate_num / self.shm.frame_rate_den, 59.52, places=2)
+        self.assertGreaterEqual(self.shm.audio_capacity, self.shm.sample_rate)
+        self.assertEqual(self.shm.audio_capacity & (self.shm.audio_capacity - 1), 0)
+
+    def test_frames(self):
+        number = self.wait_frame()[0]
+        for i in range(30):
+            f = self.wait_frame(number)
+            self.assertGreater(f[0], number)
+            number = f[0]
+            self.assertEqual(len(f[2]), 640 * 480)
+
+    def test_palette(self):
+        # 12 bit VERA colors, with 4 bits repeated
+        palette = self.wait_frame()[1]
+        for c in palette:
+            self.assertEqual(c >> 4, c & 15)
+        self.assertEqual(palette[0:3], b"\x00\x00\x00")
+        self.assertEqual(palette[3:6], b"\xff\xff\xff")
+
+    def test_consistency(self):
+        # a frame that is read twice with the same sequence is the same;
+        # frames are written all the time, so this catches torn reads
+        frames = dict()
+        end = time.time() + 2
+        while time.time() < end:
+            f = self.shm.frame()
+            if f is None:
+                continue
+            if f[0] in frames:
+                self.assertEqual(frames[f[0]], f[1] + f[2])
+            else:
+                frames[f[0]] = f[1] + f[2]
+        self.assertGreater(len(frames), 10)
+
+    def test_audio(self):
+        if not self.shm.sample_rate:
+            self.skipTest("no audio")
+        samples, position, lost = self.shm.audio(0)
+        time.sleep(0.5)
+        samples, position2, lost = self.shm.audio(position)
+        self.assertGreater(position2, position)
+        self.assertEqual(len(samples) // 4, position2 - position - lost)
+        self.assertEqual(lost, 0)
+
+if __name__ == '__main__':
+    unittest.main()
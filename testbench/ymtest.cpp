@@ -0,0 +1,249 @@
+// Commander X16 Emulator
+// Copyright (c) 2026 agent
+// All rights reserved. License: 2-clause BSD
+
+// The YM2151's timers as ymglue.cpp computes them for the CPU, against
+// ymfm rendered sample by sample, the way the status and the IRQ were
+// emulated before: the status and the IRQ have to be the same at every
+// sample, for the timers' reload, timer B's shorter first period, the
+// busy flag and the flag resets, and for random writes.
+//
+//   make ymtest
+
+#include <stdio.h>
+#include <stdlib.h>
+// for the chip and the timers, which it keeps to itself
+#include "../src/ymglue.cpp"
+
+// the register that starts, stops and resets the timers
+#define MODE 0x14
+#define LOAD_A      0x01
+#define LOAD_B      0x02
+#define IRQ_A       0x04
+#define IRQ_B       0x08
+#define RESET_A     0x10
+#define RESET_B     0x20
+#define STATUS_BUSY 0x80
+
+static uint64_t now; // samples rendered
+static const char *test;
+static bool failed;
+
+static uint32_t seed;
+
+static uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+// The status as the CPU reads it from the timers, and checks it against
+// the chip's
+static uint8_t
+status(void)
+{
+	const uint8_t computed = opm_timers.status(now);
+	const bool computed_irq = opm_timers.irq(now);
+	const uint8_t rendered = opm_iface.read_status();
+	const bool rendered_irq = opm_iface.irq();
+	if (!failed && (computed != rendered || computed_irq != rendered_irq)) {
+		printf("FAIL: %s, sample %llu: status $%02X, IRQ %d, the chip has $%02X, IRQ %d\n",
+		       test, (unsigned long long)now, computed, computed_irq, rendered, rendered_irq);
+		failed = true;
+	}
+	return computed;
+}
+
+static void
+ym_write(uint8_t reg, uint8_t val)
+{
+	opm_timers.write(now, reg, val);
+	opm_iface.write(reg, val);
+	status();
+}
+
+// Renders count samples, checking the status before each one
+static void
+render(uint32_t count)
+{
+	int16_t out[2];
+	for (uint32_t i = 0; i < count; i++) {
+		status();
+		opm_iface.generate(out, 1);
+		now++;
+	}
+}
+
+// Renders until a timer's flag is set, for at most limit samples;
+// returns how many it took, or limit
+static uint32_t
+until_flag(uint8_t flag, uint32_t limit)
+{
+	for (uint32_t n = 0; n < limit; n++) {
+		if (status() & flag) {
+			return n;
+		}
+		render(1);
+	}
+	return limit;
+}
+
+static bool
+check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("FAIL: %s: %s\n", test, what);
+		failed = true;
+	}
+	return ok;
+}
+
+// Both stopped, both flags clear, and not busy
+static void
+stop(void)
+{
+	render(1);
+	ym_write(MODE, RESET_A | RESET_B);
+	render(1);
+}
+
+// Timer A restarts when it expires, with what its registers have then
+static bool
+test_reload(void)
+{
+	test = "timer A reload";
+	stop();
+	ym_write(0x10, 1000 >> 2);
+	render(1);
+	ym_write(0x11, 1000 & 3);
+	render(1);
+	ym_write(MODE, LOAD_A | IRQ_A);
+	// it is looked at again a sample after the flag was reset
+	bool periods = true;
+	for (int i = 0; i < 8; i++) {
+		uint32_t n = until_flag(1, 100);
+		periods &= i == 0 || n == 24 - 1;
+		render(1);
+		ym_write(MODE, LOAD_A | IRQ_A | RESET_A);
+	}
+	check(periods, "timer A runs at 1024 - 1000 samples");
+
+	// a new value only counts from the next expiry on
+	render(1);
+	ym_write(0x10, 1010 >> 2);
+	render(1);
+	ym_write(0x11, 1010 & 3);
+	until_flag(1, 100);
+	render(1);
+	ym_write(MODE, LOAD_A | IRQ_A | RESET_A);
+	check(until_flag(1, 100) == 14 - 1, "timer A reloads with the new value");
+	return !failed;
+}
+
+// Timer B's *16 prescaler is free running, so its first period is
+// shorter by where that is when it is started
+static bool
+test_first_period(void)
+{
+	test = "timer B first period";
+	for (uint32_t phase = 0; phase < 16; phase++) {
+		stop();
+		ym_write(0x12, 250);
+		render(1);
+		render((phase - now) & 15);
+		ym_write(MODE, LOAD_B | IRQ_B);
+		const uint32_t first = until_flag(2, 200);
+		render(1);
+		ym_write(MODE, LOAD_B | IRQ_B | RESET_B);
+		const uint32_t second = until_flag(2, 200);
+		check(first == 16 * (256 - 250) - phase, "timer B's first period is shorter by where its prescaler is");
+		check(second == 16 * (256 - 250) - 1, "after the first one, timer B runs at 16 * (256 - 250) samples");
+	}
+	return !failed;
+}
+
+// A write keeps the chip busy until the next sample, and one in that
+// time is ignored
+static bool
+test_busy(void)
+{
+	test = "busy";
+	stop();
+	ym_write(0x12, 200);
+	check(status() & STATUS_BUSY, "busy after a write");
+	printf("The chip reports the next write, as it should:\n  ");
+	ym_write(0x12, 100);
+	render(1);
+	check(!(status() & STATUS_BUSY), "not busy a sample after the write");
+	ym_write(MODE, LOAD_B | IRQ_B);
+	check(until_flag(2, 3000) <= 16 * (256 - 200), "the write while busy is ignored");
+	return !failed;
+}
+
+// Each timer's flag is reset on its own, and the IRQ is set while one is
+static bool
+test_flag_reset(void)
+{
+	test = "flag reset";
+	stop();
+	ym_write(0x10, 0xff);
+	render(1);
+	ym_write(0x12, 0xff);
+	render(1);
+	ym_write(MODE, LOAD_A | LOAD_B | IRQ_A | IRQ_B);
+	render(200);
+	check((status() & 3) == 3 && opm_timers.irq(now), "both flags set");
+	ym_write(MODE, LOAD_A | LOAD_B | RESET_A);
+	render(1);
+	check((status() & 3) == 2 && opm_timers.irq(now), "timer A's flag reset, B's still set");
+	ym_write(MODE, LOAD_A | LOAD_B | RESET_B);
+	render(1);
+	check(!(status() & 3) && !opm_timers.irq(now), "both reset, no IRQ");
+
+	// without their IRQs enabled, the timers run but set no flag
+	render(200);
+	check(!(status() & 3), "no flags without the IRQ enabled");
+	return !failed;
+}
+
+// Random writes to the timers, between random stretches of samples
+static bool
+test_random(void)
+{
+	test = "random writes";
+	static const uint8_t regs[] = {0x10, 0x11, 0x12, MODE, MODE};
+	seed = 1;
+	stop();
+	for (int i = 0; i < 20000 && !failed; i++) {
+		const uint8_t reg = regs[rnd() % sizeof(regs)];
+		uint8_t val = rnd();
+		if (reg == 0x10) {
+			// short enough to expire many times
+			val |= 0xf0;
+		} else if (reg == MODE) {
+			val &= 0x3f;
+		}
+		if (!(opm_timers.status(now) & STATUS_BUSY)) {
+			ym_write(reg, val);
+		}
+		render(rnd() % 64);
+	}
+	return !failed;
+}
+
+int
+main(int argc, char **argv)
+{
+	bool ok = true;
+	ok &= test_reload();
+	ok &= test_first_period();
+	ok &= test_busy();
+	ok &= test_flag_reset();
+	ok &= test_random();
+	if (!ok) {
+		return 1;
+	}
+	printf("%llu samples, OK\n", (unsigned long long)now);
+	return 0;
+}